@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "Headless.h"
+
+#ifdef wabcWithHeadless
+namespace wabc {
+
+HeadlessContext::~HeadlessContext()
+{
+    release();
+}
+
+bool HeadlessContext::initialize()
+{
+    release();
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    // needs neither a display server nor a GPU device
+    auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+        EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY && createContext(display, false))
+            return true;
+    }
+#endif
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && createContext(display, true))
+        return true;
+
+    printf("HeadlessContext::initialize(): failed to create an EGL context (0x%x)\n", eglGetError());
+    return false;
+}
+
+bool HeadlessContext::createContext(EGLDisplay display, bool pbuffer)
+{
+    EGLint major, minor;
+    if (!eglInitialize(display, &major, &minor))
+        return false;
+
+    const EGLint config_attrs[] = {
+        EGL_SURFACE_TYPE, pbuffer ? EGL_PBUFFER_BIT : 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    const EGLint context_attrs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 3,
+        EGL_NONE
+    };
+    // the renderer draws into its own framebuffer. the surface is only needed to make the context current.
+    const EGLint pbuffer_attrs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+
+    EGLConfig config{};
+    EGLint num_configs = 0;
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLSurface surface = EGL_NO_SURFACE;
+    bool ok = eglBindAPI(EGL_OPENGL_ES_API) &&
+        eglChooseConfig(display, config_attrs, &config, 1, &num_configs) && num_configs > 0;
+    if (ok) {
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attrs);
+        ok = context != EGL_NO_CONTEXT;
+    }
+    if (ok && pbuffer) {
+        surface = eglCreatePbufferSurface(display, config, pbuffer_attrs);
+        ok = surface != EGL_NO_SURFACE;
+    }
+    // without a surface, this requires EGL_KHR_surfaceless_context. Mesa has it.
+    if (ok)
+        ok = eglMakeCurrent(display, surface, surface, context);
+
+    if (!ok) {
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(display, surface);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+
+    m_display = display;
+    m_context = context;
+    m_surface = surface;
+    printf("HeadlessContext: EGL %d.%d %s, %s\n", major, minor, pbuffer ? "pbuffer" : "surfaceless", (const char*)glGetString(GL_RENDERER));
+    return true;
+}
+
+void HeadlessContext::release()
+{
+    if (m_display == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_surface != EGL_NO_SURFACE)
+        eglDestroySurface(m_display, m_surface);
+    if (m_context != EGL_NO_CONTEXT)
+        eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+    m_display = EGL_NO_DISPLAY;
+    m_context = EGL_NO_CONTEXT;
+    m_surface = EGL_NO_SURFACE;
+}
+
+
+
+ImageWriter::ImageWriter(int max_queue)
+    : m_max_queue(std::max(max_queue, 1))
+{
+    m_thread = std::thread([this]() { process(); });
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void ImageWriter::push(const std::string& path, int width, int height, std::vector<uint8_t>&& rgba)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return (int)m_queue.size() < m_max_queue; });
+        m_queue.push_back({ path, width, height, std::move(rgba) });
+    }
+    m_cond.notify_all();
+}
+
+void ImageWriter::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this]() { return m_queue.empty() && m_busy == 0; });
+}
+
+double ImageWriter::getEncodeTime() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_encode_time;
+}
+
+int ImageWriter::getErrorCount() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_errors;
+}
+
+void ImageWriter::process()
+{
+    std::vector<uint8_t> encoded;
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                return; // stopped and drained
+            job = std::move(m_queue.front());
+            m_queue.erase(m_queue.begin());
+            m_busy = 1;
+        }
+        m_cond.notify_all();
+
+        // uncompressed 32 bit TGA. rows are bottom-up, the same as glReadPixels().
+        auto begin = std::chrono::steady_clock::now();
+        bool ok = job.width > 0 && job.width <= 0xffff && job.height > 0 && job.height <= 0xffff &&
+            job.rgba.size() == (size_t)job.width * job.height * 4;
+        if (ok) {
+            size_t num_pixels = (size_t)job.width * job.height;
+            encoded.resize(18 + num_pixels * 4);
+            uint8_t* header = encoded.data();
+            std::fill_n(header, 18, 0);
+            header[2] = 2; // uncompressed true color
+            header[12] = (uint8_t)(job.width & 0xff);
+            header[13] = (uint8_t)(job.width >> 8);
+            header[14] = (uint8_t)(job.height & 0xff);
+            header[15] = (uint8_t)(job.height >> 8);
+            header[16] = 32;
+            header[17] = 8; // 8 bit alpha, bottom-left origin
+
+            const uint8_t* src = job.rgba.data();
+            uint8_t* dst = encoded.data() + 18;
+            for (size_t i = 0; i < num_pixels; ++i, src += 4, dst += 4) {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                dst[3] = src[3];
+            }
+
+            if (!job.path.empty()) {
+                FILE* f = fopen(job.path.c_str(), "wb");
+                ok = f && fwrite(encoded.data(), 1, encoded.size(), f) == encoded.size();
+                if (f)
+                    ok = fclose(f) == 0 && ok;
+                if (!ok)
+                    printf("ImageWriter: failed to write %s\n", job.path.c_str());
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_encode_time += std::chrono::duration<double, std::milli>(end - begin).count();
+            if (!ok)
+                ++m_errors;
+            m_busy = 0;
+        }
+        m_cond.notify_all();
+    }
+}
+
+} // namespace wabc
+#endif // wabcWithHeadless
@@ -0,0 +1,61 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+#ifdef wabcWithHeadless
+namespace wabc {
+
+// GL ES 3 context without a window for batch rendering on machines without a display.
+// tries the Mesa surfaceless platform first, then a pbuffer on the default display. both work with llvmpipe.
+// the renderer is expected to draw into its own framebuffer (IRenderer::initializeOffscreen()).
+class HeadlessContext
+{
+public:
+    ~HeadlessContext();
+    bool initialize();
+    void release();
+
+private:
+    bool createContext(EGLDisplay display, bool pbuffer);
+
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLContext m_context = EGL_NO_CONTEXT;
+    EGLSurface m_surface = EGL_NO_SURFACE;
+};
+
+// writes RGBA8 images with bottom-up rows as TGA files on a background thread,
+// so that encoding overlaps with seeking and rendering of the following frames.
+class ImageWriter
+{
+public:
+    explicit ImageWriter(int max_queue = 4);
+    ~ImageWriter();
+
+    // blocks while max_queue images are waiting. an empty path only encodes (for benchmarks).
+    void push(const std::string& path, int width, int height, std::vector<uint8_t>&& rgba);
+    void wait();
+    double getEncodeTime() const; // total milliseconds spent on encoding and writing
+    int getErrorCount() const;
+
+private:
+    struct Job
+    {
+        std::string path;
+        int width{};
+        int height{};
+        std::vector<uint8_t> rgba;
+    };
+    void process();
+
+    int m_max_queue;
+    std::vector<Job> m_queue;
+    int m_busy = 0;
+    bool m_stop = false;
+    double m_encode_time = 0.0;
+    int m_errors = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+} // namespace wabc
+#endif // wabcWithHeadless
@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "MeshCluster.h"
+
+namespace wabc {
+
+using sfbx::RawVector;
+
+// spreads the lower 10 bits of v to every 3rd bit
+static inline uint32_t SpreadBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+void BuildMeshClusters(span<float3> points, span<int> counts, span<int> indices, int max_triangles,
+    RawVector<MeshCluster>& clusters, RawVector<int>& vertex_map, RawVector<uint16_t>& local_indices)
+{
+    clusters.clear();
+    vertex_map.clear();
+    local_indices.clear();
+
+    size_t num_points = points.size();
+    if (num_points == 0)
+        return;
+    // 3 vertices per triangle at most. keeps local indices in 16 bit.
+    max_triangles = clamp(max_triangles, 1, 0xffff / 3);
+
+    // triangulate in the same way as the full resolution mesh
+    RawVector<int> triangles;
+    {
+        const int* src_indices = indices.data();
+        for (int c : counts) {
+            for (int fi = 0; fi < c - 2; ++fi) {
+                triangles.push_back(src_indices[0]);
+                triangles.push_back(src_indices[1 + fi]);
+                triangles.push_back(src_indices[2 + fi]);
+            }
+            src_indices += c;
+        }
+    }
+    int num_triangles = (int)triangles.size() / 3;
+    if (num_triangles == 0)
+        return;
+
+    float3 bmin = points[0];
+    float3 bmax = points[0];
+    for (auto& p : points) {
+        bmin = min(bmin, p);
+        bmax = max(bmax, p);
+    }
+    float3 scale = float3{ 1023.0f, 1023.0f, 1023.0f } / max(bmax - bmin, float3{ 1e-6f, 1e-6f, 1e-6f });
+
+    std::vector<std::pair<uint32_t, int>> order(num_triangles);
+    for (int ti = 0; ti < num_triangles; ++ti) {
+        const int* tri = &triangles[ti * 3];
+        float3 center = (points[tri[0]] + points[tri[1]] + points[tri[2]]) / 3.0f;
+        float3 q = (center - bmin) * scale;
+        uint32_t code = SpreadBits((uint32_t)q.x) | (SpreadBits((uint32_t)q.y) << 1) | (SpreadBits((uint32_t)q.z) << 2);
+        order[ti] = { code, ti };
+    }
+    std::sort(order.begin(), order.end());
+
+    // local_of[v] is the local index of v in the cluster stamped in owner[v]
+    RawVector<int> owner;
+    RawVector<int> local_of;
+    owner.resize(num_points);
+    local_of.resize(num_points);
+    std::fill(owner.begin(), owner.end(), -1);
+
+    MeshCluster cluster;
+    int cluster_id = 0;
+    int cluster_triangles = 0;
+    auto flush = [&]() {
+        if (cluster_triangles == 0)
+            return;
+        cluster.vertex_count = (int)vertex_map.size() - cluster.vertex_offset;
+        cluster.index_count = (int)local_indices.size() - cluster.index_offset;
+        clusters.push_back(cluster);
+
+        cluster = {};
+        cluster.vertex_offset = (int)vertex_map.size();
+        cluster.index_offset = (int)local_indices.size();
+        cluster_triangles = 0;
+        ++cluster_id;
+    };
+
+    for (auto& o : order) {
+        if (cluster_triangles == max_triangles)
+            flush();
+
+        const int* tri = &triangles[o.second * 3];
+        for (int i = 0; i < 3; ++i) {
+            int vi = tri[i];
+            if (owner[vi] != cluster_id) {
+                owner[vi] = cluster_id;
+                local_of[vi] = (int)vertex_map.size() - cluster.vertex_offset;
+                vertex_map.push_back(vi);
+            }
+            local_indices.push_back((uint16_t)local_of[vi]);
+        }
+        ++cluster_triangles;
+    }
+    flush();
+}
+
+} // namespace wabc
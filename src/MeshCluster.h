@@ -0,0 +1,14 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+namespace wabc {
+
+// splits the triangles of a mesh into clusters of up to max_triangles triangles.
+// triangles are ordered by the Morton code of their centroids, so clusters are spatially compact and cull well.
+// offsets in clusters are relative to vertex_map and local_indices. vertex_map maps cluster vertices to vertices of the mesh,
+// and local_indices index the cluster's vertices. bounds of clusters are left empty.
+// points, counts and indices are the same as IMesh's. the layout stays valid as long as the topology doesn't change.
+void BuildMeshClusters(span<float3> points, span<int> counts, span<int> indices, int max_triangles,
+    sfbx::RawVector<MeshCluster>& clusters, sfbx::RawVector<int>& vertex_map, sfbx::RawVector<uint16_t>& local_indices);
+
+} // namespace wabc
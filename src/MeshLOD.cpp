@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "MeshLOD.h"
+
+namespace wabc {
+
+using sfbx::RawVector;
+
+void BuildMeshLODs(span<float3> points, span<int> counts, span<int> indices, int max_levels, std::vector<MeshLODLevel>& dst)
+{
+    dst.clear();
+    size_t num_points = points.size();
+    if (num_points == 0 || max_levels <= 0)
+        return;
+
+    float3 bmin = points[0];
+    float3 bmax = points[0];
+    for (auto& p : points) {
+        bmin = min(bmin, p);
+        bmax = max(bmax, p);
+    }
+    float3 extent = bmax - bmin;
+    float extent_max = std::max(extent.x, std::max(extent.y, extent.z));
+    if (extent_max <= 0.0f)
+        return;
+
+    // triangulate in the same way as the full resolution mesh
+    RawVector<int> triangles;
+    {
+        const int* src_indices = indices.data();
+        for (int c : counts) {
+            for (int fi = 0; fi < c - 2; ++fi) {
+                triangles.push_back(src_indices[0]);
+                triangles.push_back(src_indices[1 + fi]);
+                triangles.push_back(src_indices[2 + fi]);
+            }
+            src_indices += c;
+        }
+    }
+    size_t num_triangles = triangles.size() / 3;
+    if (num_triangles == 0)
+        return;
+
+    // vertices of a surface are spaced about extent / sqrt(num_points) apart. cells twice as large merge ~4 vertices each.
+    float cell_size = extent_max / std::sqrt((float)num_points) * 2.0f;
+
+    RawVector<int> cluster_of;
+    RawVector<float3> sums;
+    RawVector<int> nums;
+    RawVector<int> reps;
+    RawVector<float> rep_dists;
+    std::unordered_map<uint64_t, int> cells;
+    cluster_of.resize(num_points);
+
+    size_t prev_triangles = num_triangles;
+    // a level that doesn't reduce enough is skipped in favor of coarser cells
+    for (int attempt = 0; attempt < max_levels * 4 && (int)dst.size() < max_levels; ++attempt, cell_size *= 1.5f) {
+        float rcp_cell = 1.0f / cell_size;
+        cells.clear();
+        sums.clear();
+        nums.clear();
+        for (size_t vi = 0; vi < num_points; ++vi) {
+            float3 c = floor((points[vi] - bmin) * rcp_cell);
+            uint64_t key = (uint64_t)c.x | ((uint64_t)c.y << 21) | ((uint64_t)c.z << 42);
+            auto it = cells.find(key);
+            int ci;
+            if (it == cells.end()) {
+                ci = (int)sums.size();
+                cells[key] = ci;
+                sums.push_back(float3::zero());
+                nums.push_back(0);
+            }
+            else {
+                ci = it->second;
+            }
+            cluster_of[vi] = ci;
+            sums[ci] += points[vi];
+            nums[ci] += 1;
+        }
+
+        // the representative of a cluster is the vertex closest to the cluster's mean.
+        // it has to be one of the original vertices to follow the animation.
+        size_t num_clusters = sums.size();
+        reps.resize(num_clusters);
+        rep_dists.resize(num_clusters);
+        std::fill(reps.begin(), reps.end(), -1);
+        for (size_t vi = 0; vi < num_points; ++vi) {
+            int ci = cluster_of[vi];
+            float d = length_sq(points[vi] - sums[ci] / (float)nums[ci]);
+            if (reps[ci] < 0 || d < rep_dists[ci]) {
+                reps[ci] = (int)vi;
+                rep_dists[ci] = d;
+            }
+        }
+
+        // triangles that collapse into fewer than 3 clusters are dropped
+        MeshLODLevel level;
+        level.cell_size = cell_size;
+        for (size_t ti = 0; ti < num_triangles; ++ti) {
+            int c0 = cluster_of[triangles[ti * 3 + 0]];
+            int c1 = cluster_of[triangles[ti * 3 + 1]];
+            int c2 = cluster_of[triangles[ti * 3 + 2]];
+            if (c0 == c1 || c1 == c2 || c2 == c0)
+                continue;
+            level.indices.push_back(reps[c0]);
+            level.indices.push_back(reps[c1]);
+            level.indices.push_back(reps[c2]);
+        }
+        level.num_triangle_indices = level.indices.size();
+
+        size_t level_triangles = level.num_triangle_indices / 3;
+        if (level_triangles == 0)
+            break;
+        if (level_triangles > prev_triangles / 2)
+            continue;
+
+        // 3 lines per triangle
+        level.indices.resize(level.num_triangle_indices * 3);
+        const int* tri = level.indices.data();
+        int* lines = level.indices.data() + level.num_triangle_indices;
+        for (size_t ti = 0; ti < level_triangles; ++ti, tri += 3) {
+            *lines++ = tri[0]; *lines++ = tri[1];
+            *lines++ = tri[1]; *lines++ = tri[2];
+            *lines++ = tri[2]; *lines++ = tri[0];
+        }
+        prev_triangles = level_triangles;
+        dst.push_back(std::move(level));
+    }
+}
+
+} // namespace wabc
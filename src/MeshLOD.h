@@ -0,0 +1,19 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+namespace wabc {
+
+// simplified version of a mesh. indices refer to the vertices of the original mesh,
+// so a level can be drawn with the positions of any sample of a mesh with constant topology.
+struct MeshLODLevel
+{
+    sfbx::RawVector<int> indices; // triangles followed by wireframe lines
+    size_t num_triangle_indices{};
+    float cell_size{}; // clustering grid spacing in the mesh's space. approximate geometric error of the level.
+};
+
+// vertex clustering simplification. each level has coarser cells than the previous one and at most half of its triangles.
+// points, counts and indices are the same as IMesh's. up to max_levels are built into dst.
+void BuildMeshLODs(span<float3> points, span<int> counts, span<int> indices, int max_levels, std::vector<MeshLODLevel>& dst);
+
+} // namespace wabc
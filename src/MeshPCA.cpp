@@ -0,0 +1,151 @@
+#include "pch.h"
+#include "MeshPCA.h"
+#include "Parallel.h"
+#ifdef wabcWithEigen
+    #include <Eigen/Dense>
+#endif
+
+namespace wabc {
+
+bool MeshPCA::build(const float3* frames, size_t num_frames, size_t num_points, int max_components)
+{
+    clear();
+    if (!frames || num_frames == 0 || num_points == 0)
+        return false;
+#ifdef wabcWithEigen
+    using MatrixF = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    const int F = (int)num_frames;
+    const size_t D = num_points * 3;
+    const float* X = (const float*)frames;
+
+    // everything is processed in blocks of dimensions. blocks are independent, and a block of 64 frames is 4 MB.
+    const size_t grain = 16384;
+    const int num_blocks = (int)((D + grain - 1) / grain);
+
+    m_mean.resize(num_points);
+    float* mean = (float*)m_mean.data();
+    parallel_for(0, num_blocks, [&](int bi) {
+        size_t d0 = bi * grain;
+        size_t n = std::min(grain, D - d0);
+        std::vector<double> sums(n);
+        for (int f = 0; f < F; ++f) {
+            const float* x = X + f * D + d0;
+            for (size_t i = 0; i < n; ++i)
+                sums[i] += x[i];
+        }
+        for (size_t i = 0; i < n; ++i)
+            mean[d0 + i] = (float)(sums[i] / F);
+    });
+
+    // rows [first, first + rows) of the centered frames, dimensions [d0, d0 + n)
+    auto get_centered = [&](int first, int rows, size_t d0, size_t n, MatrixF& dst) {
+        dst.resize(rows, (Eigen::Index)n);
+        for (int r = 0; r < rows; ++r) {
+            const float* x = X + (first + r) * D + d0;
+            for (size_t i = 0; i < n; ++i)
+                dst(r, i) = x[i] - mean[d0 + i];
+        }
+    };
+
+    // gram matrix in tiles of frames. tiles are written by one task each. products of blocks are summed in double.
+    const int tile = 64;
+    const int num_tiles = (F + tile - 1) / tile;
+    std::vector<std::pair<int, int>> tile_pairs;
+    for (int ti = 0; ti < num_tiles; ++ti)
+        for (int tj = ti; tj < num_tiles; ++tj)
+            tile_pairs.push_back({ ti, tj });
+    Eigen::MatrixXd G(F, F);
+    parallel_for(0, (int)tile_pairs.size(), [&](int pi) {
+        int i0 = tile_pairs[pi].first * tile, j0 = tile_pairs[pi].second * tile;
+        int ni = std::min(tile, F - i0), nj = std::min(tile, F - j0);
+        Eigen::MatrixXd sum = Eigen::MatrixXd::Zero(ni, nj);
+        MatrixF a, b;
+        for (size_t d0 = 0; d0 < D; d0 += grain) {
+            size_t n = std::min(grain, D - d0);
+            get_centered(i0, ni, d0, n, a);
+            if (j0 != i0)
+                get_centered(j0, nj, d0, n, b);
+            MatrixF prod = a * (j0 != i0 ? b : a).transpose();
+            sum += prod.cast<double>();
+        }
+        G.block(i0, j0, ni, nj) = sum;
+        G.block(j0, i0, nj, ni) = sum.transpose();
+    });
+
+    // eigenvalues are in ascending order. each is the squared error that its component removes.
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(G);
+    if (es.info() != Eigen::Success)
+        return false;
+    const auto& values = es.eigenvalues();
+    const auto& vectors = es.eigenvectors();
+    double total = std::max(G.trace(), 0.0);
+    double kept = 0.0;
+    int K = 0;
+    while (K < std::min(max_components, F) && values[F - 1 - K] > total * 1e-12) {
+        kept += values[F - 1 - K];
+        ++K;
+    }
+    m_error = (float)std::sqrt(std::max(total - kept, 0.0) / ((double)F * num_points));
+
+    // basis k = centered frames^T * eigenvector k / sqrt(eigenvalue k), which is unit length.
+    // the coefficients are the projections of the centered frames on it: eigenvector k * sqrt(eigenvalue k).
+    MatrixF W(K, F);
+    m_coefficients.resize(num_frames * K);
+    for (int k = 0; k < K; ++k) {
+        double s = std::sqrt(values[F - 1 - k]);
+        for (int f = 0; f < F; ++f) {
+            W(k, f) = (float)(vectors(f, F - 1 - k) / s);
+            m_coefficients[f * K + k] = (float)(vectors(f, F - 1 - k) * s);
+        }
+    }
+    m_basis.resize(K);
+    for (auto& b : m_basis)
+        b.m_delta_points.resize(num_points);
+    parallel_for(0, num_blocks, [&](int bi) {
+        size_t d0 = bi * grain;
+        size_t n = std::min(grain, D - d0);
+        MatrixF a;
+        get_centered(0, F, d0, n, a);
+        MatrixF basis = W * a;
+        for (int k = 0; k < K; ++k)
+            std::copy(basis.row(k).data(), basis.row(k).data() + n, (float*)m_basis[k].m_delta_points.data() + d0);
+    });
+    return true;
+#else
+    printf("MeshPCA::build(): Eigen is not available\n");
+    return false;
+#endif
+}
+
+void MeshPCA::setup(const float3* mean, const float3* basis, size_t num_points, int num_components)
+{
+    clear();
+    m_mean.assign(mean, mean + num_points);
+    m_basis.resize(num_components);
+    for (int k = 0; k < num_components; ++k) {
+        const float3* src = basis + k * num_points;
+        m_basis[k].m_delta_points.assign(src, src + num_points);
+    }
+}
+
+void MeshPCA::clear()
+{
+    m_mean.clear();
+    m_basis.clear();
+    m_coefficients.clear();
+    m_error = 0.0f;
+}
+
+void MeshPCA::reconstruct(const float* coefficients, span<float3> dst) const
+{
+    // the first component copies the mean
+    if (m_basis.empty()) {
+        std::copy(m_mean.data(), m_mean.data() + m_mean.size(), dst.data());
+        return;
+    }
+    m_basis[0].deformPoints(dst, getMean(), coefficients[0]);
+    for (size_t k = 1; k < m_basis.size(); ++k)
+        m_basis[k].deformPoints(dst, dst, coefficients[k]);
+}
+
+} // namespace wabc
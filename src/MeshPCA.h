@@ -0,0 +1,40 @@
+#pragma once
+#include "SceneGraph.h"
+
+namespace wabc {
+
+// low rank approximation of frames with the same number of points: frame f = mean + sum of coefficient(f, k) * basis k.
+// the basis shapes are the principal components of the frames. they are dense blend shapes,
+// so a frame is reconstructed with one weighted add over the points per component.
+class MeshPCA
+{
+public:
+    // frames: num_frames arrays of num_points points, frame major. keeps up to max_components components.
+    // components come from the eigenvectors of the num_frames x num_frames gram matrix of the centered frames,
+    // so it takes O(num_frames^2 * num_points) time and O(num_frames^2) memory besides the frames.
+    // false if there is nothing to build or Eigen is not available.
+    bool build(const float3* frames, size_t num_frames, size_t num_points, int max_components);
+    // restores a built basis. basis: num_components arrays of num_points points.
+    void setup(const float3* mean, const float3* basis, size_t num_points, int num_components);
+    void clear();
+
+    size_t getPointCount() const { return m_mean.size(); }
+    int getComponentCount() const { return (int)m_basis.size(); }
+    span<float3> getMean() const { return make_span(m_mean); }
+    const BlendShape& getBasis(int k) const { return m_basis[k]; }
+    // num_frames x num_components, frame major. only after build()
+    span<float> getCoefficients() const { return make_span(m_coefficients); }
+    // rms distance between the points of the frames and their reconstruction. only after build()
+    float getError() const { return m_error; }
+
+    // dst = mean + sum of coefficients[k] * basis k. dst must have getPointCount() points.
+    void reconstruct(const float* coefficients, span<float3> dst) const;
+
+private:
+    RawVector<float3> m_mean;
+    std::vector<BlendShape> m_basis;
+    RawVector<float> m_coefficients;
+    float m_error{};
+};
+
+} // namespace wabc
@@ -0,0 +1,352 @@
+// built on its own (the wabcParallel library) without the viewer's pch, so that libSSDS can link it
+#include "Parallel.h"
+#include <exception>
+#include <memory>
+#include <vector>
+#ifdef wabcWithThreads
+    #include <mutex>
+    #include <shared_mutex>
+    #include <condition_variable>
+    #include <thread>
+#endif
+
+namespace wabc {
+
+#ifdef wabcWithThreads
+
+// index of the calling thread's queue in WorkerPool::m_queues. -1: the thread is not running tasks
+static thread_local int g_queue_index = -1;
+// invoke() calls of a thread that is not a worker. only the outermost one takes WorkerPool::m_config_mutex.
+static thread_local int g_invoke_depth = 0;
+
+// work-stealing scheduler. every thread that runs tasks owns a deque of task ranges.
+// a range is split in halves until it fits its job's grain. the upper halves are pushed to the owner's deque,
+// where idle threads steal them from the other end. stolen ranges are the largest ones, so a thief takes
+// a big share of the work in one steal and splits it further on its own deque.
+class WorkerPool
+{
+public:
+    static WorkerPool& getInstance();
+
+    WorkerPool();
+    ~WorkerPool();
+    void setWorkerCount(int v);
+    int getWorkerCount();
+    void invoke(int num_tasks, const std::function<void(int)>& task);
+
+private:
+    void invokeImpl(int num_tasks, const std::function<void(int)>& task);
+    struct Job
+    {
+        const std::function<void(int)>* task{};
+        int grain = 1; // ranges up to this size are run without splitting
+        std::atomic<int> remaining{ 0 }; // tasks not completed yet
+        // the first exception thrown by a task. the owner rethrows it when the job is done. tasks not started yet are skipped.
+        std::atomic<bool> failed{ false };
+        std::exception_ptr error;
+    };
+
+    struct Range
+    {
+        Job* job{};
+        int begin{};
+        int end{};
+    };
+
+    // the owner pushes and pops at the back. thieves take from the front.
+    // a vector rather than a deque, as it keeps its capacity and queues are short (log2 of the tasks per job).
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::vector<Range> ranges;
+        std::atomic<bool> in_use{ false }; // queues of external threads are taken for the duration of invoke()
+    };
+
+    // threads that are not workers (the render thread, the load job, etc.) get one of these while they invoke
+    static const int NumExternalQueues = 8;
+
+    void startThreads(int n);
+    void stopThreads();
+    void process(int qi);
+    void push(int qi, const Range& r);
+    // job: take only ranges of job. null: any range
+    bool pop(int qi, const Job* job, Range& dst);
+    bool steal(int qi, const Job* job, Range& dst);
+    // splits r to the grain, pushing the upper halves to queue qi, and runs what is left
+    void run(int qi, Range r);
+    int acquireExternalQueue();
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues; // worker threads' ones followed by external ones
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex; // only for sleeping. the queues have their own locks
+    std::condition_variable m_cond;
+    std::atomic<int> m_queued{ 0 };   // ranges in all queues
+    std::atomic<int> m_sleepers{ 0 }; // workers waiting on m_cond
+    std::atomic<int> m_worker_count{ 0 };
+    // shared by external threads while they invoke, exclusive while the threads and queues are replaced
+    std::shared_mutex m_config_mutex;
+    bool m_stop = false; // guarded by m_mutex
+};
+
+WorkerPool& WorkerPool::getInstance()
+{
+    static WorkerPool s_instance;
+    return s_instance;
+}
+
+WorkerPool::WorkerPool()
+{
+    setWorkerCount(0);
+}
+
+WorkerPool::~WorkerPool()
+{
+    stopThreads();
+}
+
+void WorkerPool::setWorkerCount(int v)
+{
+    if (v <= 0)
+        v = std::max((int)std::thread::hardware_concurrency(), 1);
+    // waits for the jobs in flight. invoke() of other threads waits until the new threads are up.
+    std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+    if (v == m_worker_count && (int)m_threads.size() == v - 1)
+        return;
+    stopThreads();
+    m_worker_count = v;
+    // the calling thread is counted as a worker
+    startThreads(v - 1);
+}
+
+int WorkerPool::getWorkerCount()
+{
+    return m_worker_count;
+}
+
+void WorkerPool::startThreads(int n)
+{
+    m_stop = false;
+    m_queued = 0;
+    m_queues.clear();
+    for (int i = 0; i < n + NumExternalQueues; ++i) {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+        // enough for a few levels of nesting. keeps invoke() from allocating.
+        m_queues.back()->ranges.reserve(256);
+    }
+    for (int i = 0; i < n; ++i)
+        m_threads.emplace_back([this, i]() { process(i); });
+}
+
+void WorkerPool::stopThreads()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+    m_threads.clear();
+}
+
+void WorkerPool::process(int qi)
+{
+    g_queue_index = qi;
+    Range r;
+    for (;;) {
+        if (pop(qi, nullptr, r) || steal(qi, nullptr, r)) {
+            run(qi, r);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_sleepers;
+        m_cond.wait(lock, [this]() { return m_stop || m_queued > 0; });
+        --m_sleepers;
+        if (m_stop)
+            break;
+    }
+}
+
+void WorkerPool::push(int qi, const Range& r)
+{
+    {
+        auto& q = *m_queues[qi];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        q.ranges.push_back(r);
+    }
+    ++m_queued;
+    if (m_sleepers > 0) {
+        // the lock orders this against a worker that is about to sleep
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+bool WorkerPool::pop(int qi, const Job* job, Range& dst)
+{
+    auto& q = *m_queues[qi];
+    std::unique_lock<std::mutex> lock(q.mutex);
+    if (q.ranges.empty() || (job && q.ranges.back().job != job))
+        return false;
+    dst = q.ranges.back();
+    q.ranges.pop_back();
+    --m_queued;
+    return true;
+}
+
+bool WorkerPool::steal(int qi, const Job* job, Range& dst)
+{
+    if (m_queued == 0)
+        return false;
+    int num_queues = (int)m_queues.size();
+    for (int i = 1; i < num_queues; ++i) {
+        auto& q = *m_queues[(qi + i) % num_queues];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        auto it = q.ranges.begin();
+        if (job)
+            it = std::find_if(q.ranges.begin(), q.ranges.end(), [job](const Range& r) { return r.job == job; });
+        if (it == q.ranges.end())
+            continue;
+        dst = *it;
+        q.ranges.erase(it);
+        --m_queued;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::run(int qi, Range r)
+{
+    Job* job = r.job;
+    while (r.end - r.begin > job->grain) {
+        int mid = r.begin + (r.end - r.begin) / 2;
+        push(qi, { job, mid, r.end });
+        r.end = mid;
+    }
+    // an exception must not leave a worker thread or skip the count below, as the job lives on the owner's stack
+    if (!job->failed) {
+        try {
+            for (int i = r.begin; i < r.end; ++i)
+                (*job->task)(i);
+        }
+        catch (...) {
+            if (!job->failed.exchange(true))
+                job->error = std::current_exception();
+        }
+    }
+    // the owner of the job may return as soon as this reaches 0. job must not be touched after this.
+    job->remaining -= r.end - r.begin;
+}
+
+int WorkerPool::acquireExternalQueue()
+{
+    for (int qi = (int)m_threads.size(); qi < (int)m_queues.size(); ++qi) {
+        bool expected = false;
+        if (m_queues[qi]->in_use.compare_exchange_strong(expected, true))
+            return qi;
+    }
+    return -1;
+}
+
+void WorkerPool::invoke(int num_tasks, const std::function<void(int)>& task)
+{
+    if (num_tasks <= 0)
+        return;
+    // workers and nested calls run inside an outer call that holds the lock
+    if (g_queue_index >= 0 || g_invoke_depth > 0) {
+        invokeImpl(num_tasks, task);
+        return;
+    }
+    std::shared_lock<std::shared_mutex> lock(m_config_mutex);
+    // restored even if a task throws
+    struct DepthGuard
+    {
+        DepthGuard() { ++g_invoke_depth; }
+        ~DepthGuard() { --g_invoke_depth; }
+    } depth;
+    invokeImpl(num_tasks, task);
+}
+
+void WorkerPool::invokeImpl(int num_tasks, const std::function<void(int)>& task)
+{
+    int qi = g_queue_index;
+    bool external = qi < 0;
+    if (external && num_tasks > 1 && getWorkerCount() > 1)
+        qi = acquireExternalQueue();
+    if (num_tasks == 1 || qi < 0) {
+        // nothing to share, no worker threads or all the external queues are in use
+        for (int i = 0; i < num_tasks; ++i)
+            task(i);
+        return;
+    }
+    g_queue_index = qi;
+    // an external queue is released even if a task throws
+    struct QueueGuard
+    {
+        WorkQueue* queue;
+        ~QueueGuard()
+        {
+            if (queue) {
+                g_queue_index = -1;
+                queue->in_use = false;
+            }
+        }
+    } queue_guard{ external ? m_queues[qi].get() : nullptr };
+
+    // leaves small enough to balance across the threads, large enough to amortize the queue operations
+    Job job;
+    job.task = &task;
+    job.grain = std::max(num_tasks / (getWorkerCount() * 8), 1);
+    job.remaining = num_tasks;
+    run(qi, { &job, 0, num_tasks });
+
+    // help with this job until all of its tasks are done. nested calls from a task are run in parallel too.
+    // ranges of other jobs are left to the workers, so that the caller doesn't get stuck in unrelated work.
+    Range r;
+    while (job.remaining > 0) {
+        if (pop(qi, &job, r) || steal(qi, &job, r))
+            run(qi, r);
+        else
+            std::this_thread::yield();
+    }
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+
+void SetWorkerCount(int v)
+{
+    WorkerPool::getInstance().setWorkerCount(v);
+}
+
+int GetWorkerCount()
+{
+    return WorkerPool::getInstance().getWorkerCount();
+}
+
+void ParallelInvoke(int num_tasks, const std::function<void(int)>& task)
+{
+    WorkerPool::getInstance().invoke(num_tasks, task);
+}
+
+#else // wabcWithThreads
+
+void SetWorkerCount(int v)
+{
+}
+
+int GetWorkerCount()
+{
+    return 1;
+}
+
+void ParallelInvoke(int num_tasks, const std::function<void(int)>& task)
+{
+    for (int i = 0; i < num_tasks; ++i)
+        task(i);
+}
+
+#endif // wabcWithThreads
+
+} // namespace wabc
@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+// task scheduler shared by the scenes and libSSDS. without threads (emscripten without pthreads) everything runs on the calling thread.
+
+// same as pch.h. Parallel.cpp and libSSDS don't include it.
+#if !defined(wabcWithThreads) && (!defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__))
+    #define wabcWithThreads
+#endif
+
+namespace wabc {
+
+// 0: use hardware concurrency. 1: no worker threads (everything runs on the calling thread).
+// can be called from any thread but not from a task. it waits for the ParallelInvoke() calls in flight to finish.
+void SetWorkerCount(int v);
+int GetWorkerCount();
+
+// calls task(i) for each i in [0, num_tasks) on the worker threads and blocks until all of them are done.
+// tasks are distributed by work stealing. the calling thread also processes tasks, and nested calls from a task
+// are run in parallel as well. any thread can call this, and calls from different threads run concurrently.
+// if tasks throw, the first exception is rethrown to the caller after the other tasks have finished or been skipped.
+void ParallelInvoke(int num_tasks, const std::function<void(int)>& task);
+
+// body: [](int i) -> void
+template<class Body>
+inline void parallel_for(int begin, int end, const Body& body)
+{
+    if (end <= begin)
+        return;
+    // std::function holds a reference wrapper without allocating
+    auto task = [&](int i) { body(begin + i); };
+    ParallelInvoke(end - begin, std::ref(task));
+}
+
+// body: [](int first, int last) -> void
+template<class Body>
+inline void parallel_for_blocked(int begin, int end, int grain, const Body& body)
+{
+    if (end <= begin)
+        return;
+    grain = std::max(grain, 1);
+    int num_blocks = (end - begin + grain - 1) / grain;
+    auto task = [&](int bi) {
+        int first = begin + bi * grain;
+        body(first, std::min(first + grain, end));
+    };
+    ParallelInvoke(num_blocks, std::ref(task));
+}
+
+
+// lock-free handoff of the latest value from one producer thread to one consumer thread.
+// the producer writes back() and publish()es it. the consumer fetch()es the latest published value into front().
+// values published before the consumer fetches are overwritten, so the consumer always gets the newest one and neither side waits.
+template<class T>
+class TripleBuffer
+{
+public:
+    // producer
+    T& back() { return m_slots[m_back]; }
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // consumer. returns true if a newly published value is taken into front().
+    bool fetch()
+    {
+        if (!hasFresh())
+            return false;
+        // only the consumer clears the fresh bit, so it can't be lost between the test and the exchange
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+    T& front() { return m_slots[m_front]; }
+    const T& front() const { return m_slots[m_front]; }
+
+    bool hasFresh() const { return (m_middle.load(std::memory_order_acquire) & FreshBit) != 0; }
+
+    // direct access to the slots. only safe while the producer is not running.
+    T& at(int i) { return m_slots[i]; }
+
+private:
+    static const int IndexMask = 3;
+    static const int FreshBit = 4;
+
+    T m_slots[3];
+    int m_back = 0;
+    std::atomic<int> m_middle{ 1 };
+    int m_front = 2;
+};
+
+} // namespace wabc
@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "SceneGraph.h"
+#include "PointsLOD.h"
+#include "Parallel.h"
+
+namespace wabc {
+
+static const int kCodeDepth = 10; // 30 bit Morton codes
+static const int kCellDepth = 4;  // up to 4096 cells
+
+// spreads the lower 10 bits of v to every 3rd bit
+static inline uint32_t SpreadBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+static inline uint32_t ReverseBits(uint32_t v, int bits)
+{
+    uint32_t r = 0;
+    for (int i = 0; i < bits; ++i) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+void PointsLOD::build(RawVector<float3>& points)
+{
+    m_cells.clear();
+    int n = (int)points.size();
+    if (n == 0)
+        return;
+
+    // bounds
+    const float inf = std::numeric_limits<float>::infinity();
+    float3 bmin{ inf, inf, inf };
+    float3 bmax{ -inf, -inf, -inf };
+    {
+        std::mutex mutex;
+        parallel_for_blocked(0, n, 1 << 16, [&](int first, int last) {
+            float3 lmin = points[first];
+            float3 lmax = points[first];
+            for (int i = first + 1; i < last; ++i) {
+                lmin = min(lmin, points[i]);
+                lmax = max(lmax, points[i]);
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            bmin = min(bmin, lmin);
+            bmax = max(bmax, lmax);
+        });
+    }
+    float3 extent = max(bmax - bmin, float3{ 1e-6f, 1e-6f, 1e-6f });
+    float3 scale = float3{ 1023.0f, 1023.0f, 1023.0f } / extent;
+
+    m_codes.resize(n);
+    m_order.resize(n);
+    parallel_for_blocked(0, n, 1 << 14, [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            float3 q = (points[i] - bmin) * scale;
+            m_codes[i] = SpreadBits((uint32_t)q.x) | (SpreadBits((uint32_t)q.y) << 1) | (SpreadBits((uint32_t)q.z) << 2);
+            m_order[i] = i;
+        }
+    });
+
+    // LSD radix sort with 8 bit digits. stable, so points in the same fine cell keep their order.
+    m_codes_tmp.resize(n);
+    m_order_tmp.resize(n);
+    for (int shift = 0; shift < kCodeDepth * 3; shift += 8) {
+        int hist[256]{};
+        for (int i = 0; i < n; ++i)
+            ++hist[(m_codes[i] >> shift) & 0xff];
+        int pos = 0;
+        for (int& h : hist) {
+            int c = h;
+            h = pos;
+            pos += c;
+        }
+        for (int i = 0; i < n; ++i) {
+            int d = hist[(m_codes[i] >> shift) & 0xff]++;
+            m_codes_tmp[d] = m_codes[i];
+            m_order_tmp[d] = m_order[i];
+        }
+        m_codes.swap(m_codes_tmp);
+        m_order.swap(m_order_tmp);
+    }
+
+    // cells are runs of the same code prefix
+    int cell_shift = 3 * (kCodeDepth - kCellDepth);
+    for (int i = 0; i < n; ) {
+        uint32_t c = m_codes[i] >> cell_shift;
+        int j = i + 1;
+        while (j < n && (m_codes[j] >> cell_shift) == c)
+            ++j;
+        Cell cell;
+        cell.offset = i;
+        cell.count = j - i;
+        m_cells.push_back(cell);
+        i = j;
+    }
+
+    // within a cell, points are sorted by the fine code. taking them in bit reversed index order
+    // makes every prefix a stratified subsample of the cell.
+    m_points_tmp.resize(n);
+    parallel_for(0, (int)m_cells.size(), [&](int ci) {
+        auto& cell = m_cells[ci];
+        int bits = 0;
+        while ((1 << bits) < cell.count)
+            ++bits;
+
+        float3 cmin{ inf, inf, inf };
+        float3 cmax{ -inf, -inf, -inf };
+        float3* dst = m_points_tmp.data() + cell.offset;
+        const int* order = m_order.data() + cell.offset;
+        for (uint32_t k = 0; k < (1u << bits); ++k) {
+            uint32_t r = ReverseBits(k, bits);
+            if ((int)r >= cell.count)
+                continue;
+            float3 p = points[order[r]];
+            *dst++ = p;
+            cmin = min(cmin, p);
+            cmax = max(cmax, p);
+        }
+        cell.bmin = cmin;
+        cell.bmax = cmax;
+    });
+    points.swap(m_points_tmp);
+}
+
+void PointsLOD::clear()
+{
+    m_cells.clear();
+}
+
+bool PointsLOD::empty() const
+{
+    return m_cells.empty();
+}
+
+void PointsLOD::select(const float4x4& view_proj, float2 screen_size, int budget, float density, RawVector<DrawRange>& dst) const
+{
+    dst.clear();
+    size_t num_cells = m_cells.size();
+    std::vector<float> wants(num_cells);
+    double total = 0.0;
+    for (size_t ci = 0; ci < num_cells; ++ci) {
+        auto& cell = m_cells[ci];
+        float want = 0.0f;
+        if (IsInFrustum(view_proj, cell.bmin, cell.bmax)) {
+            // projected area in pixels
+            const float inf = std::numeric_limits<float>::infinity();
+            float2 smin{ inf, inf };
+            float2 smax{ -inf, -inf };
+            bool crosses = false;
+            for (int i = 0; i < 8; ++i) {
+                float3 p{
+                    (i & 1) ? cell.bmax.x : cell.bmin.x,
+                    (i & 2) ? cell.bmax.y : cell.bmin.y,
+                    (i & 4) ? cell.bmax.z : cell.bmin.z,
+                };
+                float4 c = mul4(view_proj, p);
+                if (c.w <= 0.0f) {
+                    crosses = true;
+                    break;
+                }
+                float2 s{ c.x / c.w, c.y / c.w };
+                smin = min(smin, s);
+                smax = max(smax, s);
+            }
+            if (crosses) {
+                want = (float)cell.count;
+            }
+            else {
+                smin = max(smin, float2{ -1.0f, -1.0f });
+                smax = min(smax, float2{ 1.0f, 1.0f });
+                float2 pixels = max(smax - smin, float2::zero()) * 0.5f * screen_size;
+                want = std::min((float)cell.count, std::max(pixels.x * pixels.y * density, 1.0f));
+            }
+        }
+        wants[ci] = want;
+        total += want;
+    }
+
+    float scale = budget > 0 && total > budget ? float(budget / total) : 1.0f;
+    for (size_t ci = 0; ci < num_cells; ++ci) {
+        if (wants[ci] <= 0.0f)
+            continue;
+        DrawRange r;
+        r.points_offset = m_cells[ci].offset;
+        r.points_count = std::max((int)(wants[ci] * scale), 1);
+        dst.push_back(r);
+    }
+}
+
+span<PointsLOD::Cell> PointsLOD::getCells() const
+{
+    return make_span(m_cells);
+}
+
+} // namespace wabc
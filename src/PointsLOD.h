@@ -0,0 +1,42 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+namespace wabc {
+
+// spatial index of a point cloud for drawing a budgeted number of points.
+// points are sorted by Morton code and grouped into cells of a fixed depth octree. points in a cell are ordered
+// so that any prefix of the cell is spread over the whole cell, so drawing the first n points of a cell is a uniform subsample.
+class PointsLOD
+{
+public:
+    struct Cell
+    {
+        int offset{};
+        int count{};
+        float3 bmin{};
+        float3 bmax{};
+    };
+
+    // reorders points. rebuilt every time the points change. it is linear in the number of points.
+    void build(sfbx::RawVector<float3>& points);
+    void clear();
+    bool empty() const;
+
+    // writes ranges of the points to draw into dst. cells outside the frustum are skipped.
+    // each cell gets density points per pixel of its projected area, scaled down to fit budget in total.
+    void select(const float4x4& view_proj, float2 screen_size, int budget, float density, sfbx::RawVector<DrawRange>& dst) const;
+
+    span<Cell> getCells() const;
+
+private:
+    sfbx::RawVector<Cell> m_cells;
+
+    // scratch
+    sfbx::RawVector<uint32_t> m_codes;
+    sfbx::RawVector<uint32_t> m_codes_tmp;
+    sfbx::RawVector<int> m_order;
+    sfbx::RawVector<int> m_order_tmp;
+    sfbx::RawVector<float3> m_points_tmp;
+};
+
+} // namespace wabc
@@ -0,0 +1,241 @@
+#include "pch.h"
+#include "PositionCodec.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define wabcWithSSE2
+#endif
+
+namespace wabc {
+
+// an encoded frame is 2 bit width codes of all groups packed 4 per byte, followed by the values of each group.
+// values are little endian.
+static const int g_group_size = 16;
+static const int g_code_widths[4] = { 0, 1, 2, 4 };
+// quantized values are clamped to this, so that the differences of two fit in int32.
+// 2^30 - 64 is exact in float, and twice it is below 2^31.
+static const float g_max_quantized = 1073741760.0f;
+
+static size_t GetValueCount(size_t num_points)
+{
+    // padded to whole groups. the padding stays 0.
+    return (num_points * 3 + g_group_size - 1) / g_group_size * g_group_size;
+}
+
+static int GetWidthCode(const int32_t* values)
+{
+    int32_t lo = 0, hi = 0;
+    for (int i = 0; i < g_group_size; ++i) {
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+    }
+    if (lo == 0 && hi == 0)
+        return 0;
+    else if (lo >= INT8_MIN && hi <= INT8_MAX)
+        return 1;
+    else if (lo >= INT16_MIN && hi <= INT16_MAX)
+        return 2;
+    else
+        return 3;
+}
+
+#ifdef wabcWithSSE2
+static inline void AddTo(int32_t* dst, __m128i v)
+{
+    _mm_storeu_si128((__m128i*)dst, _mm_add_epi32(_mm_loadu_si128((const __m128i*)dst), v));
+}
+
+// sign extension by unpacking each value with itself and shifting back
+static inline void AddInt16x8(int32_t* dst, __m128i v)
+{
+    AddTo(dst + 0, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    AddTo(dst + 4, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+#endif
+
+// adds the differences in src to q. false if src is broken.
+static bool AddDifferences(const PositionBlock& src, int32_t* q, size_t count)
+{
+    size_t num_groups = count / g_group_size;
+    size_t code_bytes = (num_groups + 3) / 4;
+    if (!src.data || src.size < code_bytes)
+        return false;
+
+    // validate the size first, so that the groups can be read without checks
+    const uint8_t* codes = src.data;
+    auto get_code = [codes](size_t g) { return (codes[g >> 2] >> ((g & 3) * 2)) & 3; };
+    size_t data_size = 0;
+    for (size_t g = 0; g < num_groups; ++g)
+        data_size += g_group_size * g_code_widths[get_code(g)];
+    if (src.size != code_bytes + data_size)
+        return false;
+
+    const uint8_t* data = codes + code_bytes;
+    for (size_t g = 0; g < num_groups; ++g) {
+        int32_t* dst = q + g * g_group_size;
+        switch (get_code(g)) {
+        case 0:
+            break;
+        case 1:
+        {
+#ifdef wabcWithSSE2
+            __m128i v = _mm_loadu_si128((const __m128i*)data);
+            AddInt16x8(dst + 0, _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8));
+            AddInt16x8(dst + 8, _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8));
+#else
+            for (int i = 0; i < g_group_size; ++i)
+                dst[i] += (int8_t)data[i];
+#endif
+            data += g_group_size;
+            break;
+        }
+        case 2:
+        {
+#ifdef wabcWithSSE2
+            AddInt16x8(dst + 0, _mm_loadu_si128((const __m128i*)data));
+            AddInt16x8(dst + 8, _mm_loadu_si128((const __m128i*)(data + 16)));
+#else
+            for (int i = 0; i < g_group_size; ++i) {
+                int16_t v;
+                std::memcpy(&v, data + i * 2, 2);
+                dst[i] += v;
+            }
+#endif
+            data += g_group_size * 2;
+            break;
+        }
+        default:
+        {
+#ifdef wabcWithSSE2
+            for (int i = 0; i < g_group_size; i += 4)
+                AddTo(dst + i, _mm_loadu_si128((const __m128i*)(data + i * 4)));
+#else
+            for (int i = 0; i < g_group_size; ++i) {
+                int32_t v;
+                std::memcpy(&v, data + i * 4, 4);
+                dst[i] += v;
+            }
+#endif
+            data += g_group_size * 4;
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+static void Dequantize(const int32_t* q, size_t num_points, float3 origin, float step, float3* dst)
+{
+    size_t i = 0;
+#ifdef wabcWithSSE2
+    // 4 points are 3 registers of interleaved xyz. rotated origins line up with them. (same as QuantizePoints())
+    const __m128 s = _mm_set1_ps(step);
+    const __m128 o0 = _mm_setr_ps(origin.x, origin.y, origin.z, origin.x);
+    const __m128 o1 = _mm_setr_ps(origin.y, origin.z, origin.x, origin.y);
+    const __m128 o2 = _mm_setr_ps(origin.z, origin.x, origin.y, origin.z);
+    float* fdst = (float*)dst;
+    for (; i + 4 <= num_points; i += 4) {
+        const int32_t* p = q + i * 3;
+        float* d = fdst + i * 3;
+        _mm_storeu_ps(d + 0, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(p + 0))), s), o0));
+        _mm_storeu_ps(d + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(p + 4))), s), o1));
+        _mm_storeu_ps(d + 8, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(p + 8))), s), o2));
+    }
+#endif
+    for (; i < num_points; ++i) {
+        const int32_t* p = q + i * 3;
+        dst[i] = float3{ (float)p[0], (float)p[1], (float)p[2] } * step + origin;
+    }
+}
+
+
+void PositionEncoder::setup(const PositionCodecParams& params)
+{
+    m_params = params;
+    m_params.keyframe_interval = std::max(m_params.keyframe_interval, 1);
+    m_frame = 0;
+    m_prev.resize_zeroclear(GetValueCount(params.num_points));
+    m_q.resize_zeroclear(GetValueCount(params.num_points));
+}
+
+void PositionEncoder::encode(const float3* points, std::vector<uint8_t>& dst)
+{
+    float inv_step = 1.0f / m_params.step;
+    size_t num_values = m_params.num_points * 3;
+    const float* src = (const float*)points;
+    const float* origin = (const float*)&m_params.origin;
+    for (size_t i = 0; i < num_values; ++i) {
+        float v = (src[i] - origin[i % 3]) * inv_step;
+        // non-finite points are encoded as the origin
+        m_q[i] = std::isfinite(v) ? (int32_t)std::lrint(clamp(v, -g_max_quantized, g_max_quantized)) : 0;
+    }
+
+    // the prediction is the quantized previous frame, so errors don't accumulate over frames
+    bool keyframe = m_frame % m_params.keyframe_interval == 0;
+    size_t count = m_q.size();
+    size_t num_groups = count / g_group_size;
+    size_t pos = dst.size();
+    dst.resize(pos + (num_groups + 3) / 4);
+    int32_t diff[g_group_size];
+    for (size_t g = 0; g < num_groups; ++g) {
+        const int32_t* q = m_q.data() + g * g_group_size;
+        const int32_t* prev = m_prev.data() + g * g_group_size;
+        for (int i = 0; i < g_group_size; ++i)
+            diff[i] = keyframe ? q[i] : q[i] - prev[i];
+
+        int code = GetWidthCode(diff);
+        dst[pos + g / 4] |= (uint8_t)(code << ((g & 3) * 2));
+        if (code == 0)
+            continue;
+        int width = g_code_widths[code];
+        size_t at = dst.size();
+        dst.resize(at + g_group_size * width);
+        uint8_t* d = dst.data() + at;
+        for (int i = 0; i < g_group_size; ++i) {
+            if (width == 1) {
+                d[i] = (uint8_t)(int8_t)diff[i];
+            }
+            else if (width == 2) {
+                int16_t v = (int16_t)diff[i];
+                std::memcpy(d + i * 2, &v, 2);
+            }
+            else {
+                std::memcpy(d + i * 4, &diff[i], 4);
+            }
+        }
+    }
+    m_prev.swap(m_q);
+    ++m_frame;
+}
+
+
+void PositionDecoder::setup(const PositionCodecParams& params)
+{
+    m_params = params;
+    m_params.keyframe_interval = std::max(m_params.keyframe_interval, 1);
+    m_frame = ~size_t(0);
+    m_q.resize_zeroclear(GetValueCount(params.num_points));
+}
+
+bool PositionDecoder::decode(const PositionBlock* frames, size_t frame, float3* dst)
+{
+    // sequential playback decodes only one frame of differences
+    size_t keyframe = frame - frame % m_params.keyframe_interval;
+    size_t first = keyframe;
+    if (m_frame != ~size_t(0) && m_frame >= keyframe && m_frame <= frame)
+        first = m_frame + 1;
+
+    for (size_t f = first; f <= frame; ++f) {
+        if (f == keyframe)
+            m_q.zeroclear();
+        if (!AddDifferences(frames[f], m_q.data(), m_q.size())) {
+            m_frame = ~size_t(0);
+            return false;
+        }
+    }
+    m_frame = frame;
+    Dequantize(m_q.data(), m_params.num_points, m_params.origin, m_params.step, dst);
+    return true;
+}
+
+} // namespace wabc
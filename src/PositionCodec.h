@@ -0,0 +1,54 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+namespace wabc {
+
+// lossy compression of position streams: sequences of frames with the same number of points.
+// positions are quantized to a grid of step around origin, and each frame is stored as the difference from the previous one.
+// the differences are packed in groups of 16 values with the smallest byte width that holds all of them (0, 1, 2 or 4),
+// so static regions cost 2 bits per 16 values and slow motion about a byte per value.
+// every keyframe_interval-th frame is stored against zero, so decoding of any frame can start from the keyframe before it.
+struct PositionCodecParams
+{
+    size_t num_points{};
+    float3 origin{};
+    float step = 1e-4f;
+    int keyframe_interval = 32;
+};
+
+// encoded frame
+struct PositionBlock
+{
+    const uint8_t* data{};
+    size_t size{};
+};
+
+class PositionEncoder
+{
+public:
+    void setup(const PositionCodecParams& params);
+    // frames must be given in order. the encoded frame is appended to dst.
+    void encode(const float3* points, std::vector<uint8_t>& dst);
+
+private:
+    PositionCodecParams m_params;
+    size_t m_frame{};
+    sfbx::RawVector<int32_t> m_prev;  // quantized previous frame. the prediction of the next one
+    sfbx::RawVector<int32_t> m_q;
+};
+
+class PositionDecoder
+{
+public:
+    void setup(const PositionCodecParams& params);
+    // frames: encoded frames of the whole stream. continues from the last decoded frame if it is between the keyframe and frame.
+    // returns false if an encoded frame is broken.
+    bool decode(const PositionBlock* frames, size_t frame, float3* dst);
+
+private:
+    PositionCodecParams m_params;
+    size_t m_frame = ~size_t(0); // frame in m_q
+    sfbx::RawVector<int32_t> m_q;
+};
+
+} // namespace wabc
@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "Quantize.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define wabcWithSSE2
+#endif
+
+namespace wabc {
+
+void QuantizePoints(const float3* src, size_t n, float3 center, float3 half_extent, int16_t* dst)
+{
+    auto inv = [](float v) { return v > 0.0f ? 32767.0f / v : 0.0f; };
+    float3 scale{ inv(half_extent.x), inv(half_extent.y), inv(half_extent.z) };
+    float3 offset = -center * scale;
+
+    size_t i = 0;
+#ifdef wabcWithSSE2
+    // 4 points are 3 registers of interleaved xyz. rotated scale and offset line up with them,
+    // so no shuffles are needed. packs saturate to int16.
+    const __m128 s0 = _mm_setr_ps(scale.x, scale.y, scale.z, scale.x);
+    const __m128 s1 = _mm_setr_ps(scale.y, scale.z, scale.x, scale.y);
+    const __m128 s2 = _mm_setr_ps(scale.z, scale.x, scale.y, scale.z);
+    const __m128 o0 = _mm_setr_ps(offset.x, offset.y, offset.z, offset.x);
+    const __m128 o1 = _mm_setr_ps(offset.y, offset.z, offset.x, offset.y);
+    const __m128 o2 = _mm_setr_ps(offset.z, offset.x, offset.y, offset.z);
+    const float* fsrc = (const float*)src;
+    for (; i + 4 <= n; i += 4) {
+        const float* p = fsrc + i * 3;
+        __m128i q0 = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 0), s0), o0));
+        __m128i q1 = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 4), s1), o1));
+        __m128i q2 = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p + 8), s2), o2));
+        __m128i packed01 = _mm_packs_epi32(q0, q1);
+        __m128i packed2 = _mm_packs_epi32(q2, q2);
+        int16_t* d = dst + i * 3;
+        _mm_storeu_si128((__m128i*)d, packed01);
+        _mm_storel_epi64((__m128i*)(d + 8), packed2);
+    }
+#endif
+    for (; i < n; ++i) {
+        float3 q = src[i] * scale + offset;
+        dst[i * 3 + 0] = (int16_t)clamp((int)std::lrint(q.x), -32767, 32767);
+        dst[i * 3 + 1] = (int16_t)clamp((int)std::lrint(q.y), -32767, 32767);
+        dst[i * 3 + 2] = (int16_t)clamp((int)std::lrint(q.z), -32767, 32767);
+    }
+}
+
+} // namespace wabc
@@ -0,0 +1,11 @@
+#pragma once
+#include "WebAlembicViewer.h"
+
+namespace wabc {
+
+// quantizes points to 3 x snorm16 per point: dst = round((src - center) / half_extent * 32767).
+// decoded with a normalized GL_SHORT attribute as attribute * half_extent + center.
+// points outside the bounds are clamped. half_extent of 0 encodes 0.
+void QuantizePoints(const float3* src, size_t n, float3 center, float3 half_extent, int16_t* dst);
+
+} // namespace wabc
@@ -11,32 +11,72 @@ public:
     ~Renderer();
     void release() override;
     bool initialize(GLFWwindow* v) override;
+#ifdef wabcWithHeadless
+    bool initializeOffscreen(int width, int height) override;
+#endif
     void setCamera(float3 pos, float3 dir, float3 up, float fov, float znear, float zfar, float2 shift) override;
     void setCamera(ICamera* cam, SensorFitMode ft) override;
     void setDrawPoints(bool v) override { m_draw_points = v; }
     void setDrawWireframe(bool v) override { m_draw_wireframe = v; }
     void setDrawFaces(bool v) override { m_draw_faces = v; }
+    float4x4 getViewProjection() const override { return m_view_proj; }
+    float2 getScreenSize() const override;
 
     void beginDraw() override;
     void endDraw() override;
     void draw(IMesh* mesh) override;
     void draw(IPoints* points) override;
+    void draw(IVAT* vat, double time) override;
+
+#ifdef wabcWithHeadless
+    bool beginReadback() override;
+    bool endReadback(std::vector<uint8_t>& dst) override;
+#endif
 
     float getScreenAspectRatio();
 
 private:
+    void getFramebufferSize(int& w, int& h) const;
+
     GLFWwindow* m_window{};
 
+    // offscreen target. m_fbo stays 0 without headless rendering (e.g. WebGL, which has no pixel pack buffers)
+    int m_offscreen_width{};
+    int m_offscreen_height{};
+    GLuint m_fbo{};
+#ifdef wabcWithHeadless
+    static const int kNumReadbackBuffers = 2;
+    GLuint m_rb_color{};
+    GLuint m_rb_depth{};
+    GLuint m_readback_buffers[kNumReadbackBuffers]{};
+    int m_readback_head{}; // number of queued copies
+    int m_readback_tail{}; // number of taken copies
+#endif
+
     GLuint m_vs_fill{};
     GLuint m_fs_fill{};
     GLuint m_shader_fill{};
 
     GLuint m_u_mvp{};
+    GLuint m_u_point_scale{};
+    GLuint m_u_point_offset{};
     GLuint m_u_point_size{};
     GLuint m_u_color{};
     GLuint m_ia_point{};
     GLuint m_ia_normal{};
 
+    // vertex animation texture playback
+    GLuint m_vs_vat{};
+    GLuint m_fs_vat{};
+    GLuint m_shader_vat{};
+    GLuint m_vat_u_mvp{};
+    GLuint m_vat_u_point_size{};
+    GLuint m_vat_u_color{};
+    GLuint m_vat_u_points{};
+    GLuint m_vat_u_normals{};
+    GLuint m_vat_u_base{};
+    GLuint m_vat_u_blend{};
+
     float4x4 m_view_proj = float4x4::identity();
     float4 m_clear_color{ 0.2f, 0.2f, 0.2f, 0.0f };
     float4 m_face_color{ 0.5f, 0.5f, 0.5f, 1.0f };
@@ -53,6 +93,8 @@ private:
 
 static const char* g_vs_fill_src = R"(
 uniform mat4 u_mvp;
+uniform vec3 u_point_scale;
+uniform vec3 u_point_offset;
 uniform float u_point_size;
 attribute vec3 ia_point;
 attribute vec3 ia_normal;
@@ -60,7 +102,8 @@ varying vec3 vs_normal;
 
 void main()
 {
-    gl_Position = u_mvp * vec4(ia_point, 1.0);
+    // u_point_scale and u_point_offset decode quantized points. (1, 1, 1) and (0, 0, 0) otherwise.
+    gl_Position = u_mvp * vec4(ia_point * u_point_scale + u_point_offset, 1.0);
     vs_normal = ia_normal;
     gl_PointSize = u_point_size;
 }
@@ -78,6 +121,50 @@ void main()
 )";
 
 
+// positions are fetched by gl_VertexID, which is the index value of indexed draws.
+// u_vat_base is the first texel of the two frames to blend, so seeking only changes it and u_vat_blend.
+static const char* g_vs_vat_src = R"(#version 300 es
+uniform mat4 u_mvp;
+uniform float u_point_size;
+uniform highp sampler2DArray u_vat_points;
+uniform highp sampler2DArray u_vat_normals;
+uniform ivec2 u_vat_base;
+uniform float u_vat_blend;
+out vec3 vs_normal;
+
+vec3 fetch(highp sampler2DArray tex, int i)
+{
+    // texels are in row major order over the layers
+    ivec3 size = textureSize(tex, 0);
+    int layer_size = size.x * size.y;
+    int layer = i / layer_size;
+    int j = i - layer * layer_size;
+    return texelFetch(tex, ivec3(j % size.x, j / size.x, layer), 0).xyz;
+}
+
+void main()
+{
+    vec3 p0 = fetch(u_vat_points, u_vat_base.x + gl_VertexID);
+    vec3 p1 = fetch(u_vat_points, u_vat_base.y + gl_VertexID);
+    gl_Position = u_mvp * vec4(mix(p0, p1, u_vat_blend), 1.0);
+    vs_normal = fetch(u_vat_normals, u_vat_base.x + gl_VertexID);
+    gl_PointSize = u_point_size;
+}
+)";
+
+static const char* g_fs_vat_src = R"(#version 300 es
+precision mediump float;
+uniform vec4 u_color;
+in vec3 vs_normal;
+out vec4 fs_color;
+
+void main()
+{
+    fs_color = u_color;
+}
+)";
+
+
 static void CheckError(GLuint shader)
 {
     GLint result;
@@ -104,6 +191,17 @@ Renderer::~Renderer()
     glDeleteShader(m_vs_fill);
     glDeleteShader(m_fs_fill);
     glDeleteProgram(m_shader_fill);
+    glDeleteShader(m_vs_vat);
+    glDeleteShader(m_fs_vat);
+    glDeleteProgram(m_shader_vat);
+#ifdef wabcWithHeadless
+    if (m_fbo) {
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteRenderbuffers(1, &m_rb_color);
+        glDeleteRenderbuffers(1, &m_rb_depth);
+        glDeleteBuffers(kNumReadbackBuffers, m_readback_buffers);
+    }
+#endif
 }
 
 bool Renderer::initialize(GLFWwindow* v)
@@ -126,6 +224,8 @@ bool Renderer::initialize(GLFWwindow* v)
     glLinkProgram(m_shader_fill);
 
     m_u_mvp         = glGetUniformLocation(m_shader_fill, "u_mvp");
+    m_u_point_scale = glGetUniformLocation(m_shader_fill, "u_point_scale");
+    m_u_point_offset= glGetUniformLocation(m_shader_fill, "u_point_offset");
     m_u_point_size  = glGetUniformLocation(m_shader_fill, "u_point_size");
     m_u_color       = glGetUniformLocation(m_shader_fill, "u_color");
     m_ia_point      = glGetAttribLocation(m_shader_fill, "ia_point");
@@ -134,6 +234,35 @@ bool Renderer::initialize(GLFWwindow* v)
     glEnableVertexAttribArray(m_ia_point);
     glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
 
+    m_vs_vat = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(m_vs_vat, 1, &g_vs_vat_src, nullptr);
+    glCompileShader(m_vs_vat);
+    CheckError(m_vs_vat);
+
+    m_fs_vat = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(m_fs_vat, 1, &g_fs_vat_src, nullptr);
+    glCompileShader(m_fs_vat);
+    CheckError(m_fs_vat);
+
+    m_shader_vat = glCreateProgram();
+    glAttachShader(m_shader_vat, m_vs_vat);
+    glAttachShader(m_shader_vat, m_fs_vat);
+    glLinkProgram(m_shader_vat);
+
+    m_vat_u_mvp         = glGetUniformLocation(m_shader_vat, "u_mvp");
+    m_vat_u_point_size  = glGetUniformLocation(m_shader_vat, "u_point_size");
+    m_vat_u_color       = glGetUniformLocation(m_shader_vat, "u_color");
+    m_vat_u_points      = glGetUniformLocation(m_shader_vat, "u_vat_points");
+    m_vat_u_normals     = glGetUniformLocation(m_shader_vat, "u_vat_normals");
+    m_vat_u_base        = glGetUniformLocation(m_shader_vat, "u_vat_base");
+    m_vat_u_blend       = glGetUniformLocation(m_shader_vat, "u_vat_blend");
+
+    // texture units are fixed
+    glUseProgram(m_shader_vat);
+    glUniform1i(m_vat_u_points, 0);
+    glUniform1i(m_vat_u_normals, 1);
+    glUseProgram(0);
+
     m_view_proj = transpose(orthographic(-100.0f, 100.0f, -100.0f, 100.0f, 0.0f, 100.0f));
 
     return true;
@@ -144,24 +273,84 @@ void Renderer::release()
     delete this;
 }
 
+#ifdef wabcWithHeadless
+bool Renderer::initializeOffscreen(int width, int height)
+{
+    if (width <= 0 || height <= 0 || !initialize(nullptr))
+        return false;
+
+    m_offscreen_width = width;
+    m_offscreen_height = height;
+
+    glGenRenderbuffers(1, &m_rb_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_rb_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &m_rb_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_rb_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_rb_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_rb_depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Renderer::initializeOffscreen(): framebuffer is incomplete (0x%x)\n", status);
+        return false;
+    }
+
+    glGenBuffers(kNumReadbackBuffers, m_readback_buffers);
+    for (GLuint buf : m_readback_buffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buf);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+#endif // wabcWithHeadless
+
+void Renderer::getFramebufferSize(int& w, int& h) const
+{
+    if (m_fbo) {
+        w = m_offscreen_width;
+        h = m_offscreen_height;
+    }
+    else {
+        glfwGetFramebufferSize(m_window, &w, &h);
+    }
+}
+
 float Renderer::getScreenAspectRatio()
 {
     int w, h;
-    glfwGetFramebufferSize(m_window, &w, &h);
+    getFramebufferSize(w, h);
     return (float)w / (float)h;
 }
 
+float2 Renderer::getScreenSize() const
+{
+    int w, h;
+    getFramebufferSize(w, h);
+    return float2{ (float)w, (float)h };
+}
+
 void Renderer::beginDraw()
 {
     int sw, sh;
-    glfwGetFramebufferSize(m_window, &sw, &sh);
+    getFramebufferSize(sw, sh);
 
+    if (m_fbo)
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
     glViewport(0, 0, sw, sh);
     glClearColor(m_clear_color.x, m_clear_color.y, m_clear_color.z, m_clear_color.w);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glUseProgram(m_shader_fill);
     glUniformMatrix4fv(m_u_mvp, 1, GL_FALSE, (const GLfloat*)&m_view_proj);
+    glUniform3f(m_u_point_scale, 1.0f, 1.0f, 1.0f);
+    glUniform3f(m_u_point_offset, 0.0f, 0.0f, 0.0f);
     glUniform1fv(m_u_point_size, 1, (const GLfloat*)&m_point_size);
     glUniform4fv(m_u_color, 1, (const GLfloat*)&m_fill_color);
 
@@ -174,8 +363,44 @@ void Renderer::endDraw()
     glDisable(GL_DEPTH_TEST);
 
     glFlush();
-    glfwSwapBuffers(m_window);
+    if (!m_fbo)
+        glfwSwapBuffers(m_window);
+}
+
+#ifdef wabcWithHeadless
+bool Renderer::beginReadback()
+{
+    if (!m_fbo || m_readback_head - m_readback_tail >= kNumReadbackBuffers)
+        return false;
+
+    // with a pixel pack buffer bound, glReadPixels() returns without waiting for the transfer
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readback_buffers[m_readback_head % kNumReadbackBuffers]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_offscreen_width, m_offscreen_height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ++m_readback_head;
+    return true;
+}
+
+bool Renderer::endReadback(std::vector<uint8_t>& dst)
+{
+    if (m_readback_tail == m_readback_head)
+        return false;
+
+    size_t size = (size_t)m_offscreen_width * m_offscreen_height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readback_buffers[m_readback_tail % kNumReadbackBuffers]);
+    auto* src = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    bool ret = src != nullptr;
+    if (ret) {
+        dst.assign(src, src + size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ++m_readback_tail;
+    return ret;
 }
+#endif // wabcWithHeadless
 
 void Renderer::setCamera(float3 pos, float3 dir, float3 up, float fov, float znear, float zfar, float2 shift)
 {
@@ -251,6 +476,21 @@ void Renderer::draw(IMesh* v)
     auto points_ex = v->getPointsEx();
     auto wireframe_indices = v->getWireframeIndices();
 
+    // instanced meshes are in local space and drawn once per instance matrix
+    auto instance_matrices = v->getInstanceMatrices();
+    size_t num_instances = instance_matrices.empty() ? 1 : instance_matrices.size();
+    // culled objects are excluded from the draw ranges
+    bool has_ranges = v->hasDrawRanges();
+    auto ranges = v->getDrawRanges();
+    bool has_lod = has_ranges && std::any_of(ranges.begin(), ranges.end(), [](const DrawRange& r) { return r.lod_count > 0; });
+
+    auto set_instance = [&](size_t i) {
+        if (!instance_matrices.empty()) {
+            float4x4 mvp = instance_matrices[i] * m_view_proj;
+            glUniformMatrix4fv(m_u_mvp, 1, GL_FALSE, (const GLfloat*)&mvp);
+        }
+    };
+
     // faces
     if (m_draw_faces) {
         glEnable(GL_POLYGON_OFFSET_FILL);
@@ -263,7 +503,66 @@ void Renderer::draw(IMesh* v)
         glEnableVertexAttribArray(m_ia_point);
         glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
 
-        glDrawArrays(GL_TRIANGLES, 0, points_ex.size());
+        for (size_t i = 0; i < num_instances; ++i) {
+            set_instance(i);
+            if (!has_ranges) {
+                glDrawArrays(GL_TRIANGLES, 0, points_ex.size());
+            }
+            else {
+                for (auto& r : ranges)
+                    glDrawArrays(GL_TRIANGLES, r.points_ex_offset, r.points_ex_count);
+            }
+        }
+
+        // simplified objects are drawn as indexed triangles
+        if (has_lod) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v->getLODIndicesBuffer());
+            glBindBuffer(GL_ARRAY_BUFFER, v->getPointsBuffer());
+            glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
+            for (auto& r : ranges) {
+                if (r.lod_count > 0)
+                    glDrawElements(GL_TRIANGLES, r.lod_count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * r.lod_offset));
+            }
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
+
+        // clustered objects are drawn per cluster with 16 bit indices. the attribute offset works as the base vertex.
+        // quantized points are decoded with the cluster's bounds.
+        auto clusters = v->getClusters();
+        if (!clusters.empty()) {
+            bool quantized = !v->getClusterPointsQuantized().empty();
+            auto draw_cluster = [&](const MeshCluster& c) {
+                if (quantized) {
+                    float3 scale = (c.bmax - c.bmin) * 0.5f;
+                    float3 offset = (c.bmax + c.bmin) * 0.5f;
+                    glUniform3fv(m_u_point_scale, 1, (const GLfloat*)&scale);
+                    glUniform3fv(m_u_point_offset, 1, (const GLfloat*)&offset);
+                    glVertexAttribPointer(m_ia_point, 3, GL_SHORT, GL_TRUE, sizeof(int16_t) * 3, (const void*)(sizeof(int16_t) * 3 * c.vertex_offset));
+                }
+                else {
+                    glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), (const void*)(sizeof(float3) * c.vertex_offset));
+                }
+                glDrawElements(GL_TRIANGLES, c.index_count, GL_UNSIGNED_SHORT, (const void*)(sizeof(uint16_t) * c.index_offset));
+            };
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v->getClusterIndicesBuffer());
+            glBindBuffer(GL_ARRAY_BUFFER, v->getClusterPointsBuffer());
+            for (size_t i = 0; i < num_instances; ++i) {
+                set_instance(i);
+                if (!has_ranges) {
+                    for (auto& c : clusters)
+                        draw_cluster(c);
+                }
+                else {
+                    for (int ci : v->getVisibleClusters())
+                        draw_cluster(clusters[ci]);
+                }
+            }
+            if (quantized) {
+                glUniform3f(m_u_point_scale, 1.0f, 1.0f, 1.0f);
+                glUniform3f(m_u_point_offset, 0.0f, 0.0f, 0.0f);
+            }
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        }
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
@@ -282,7 +581,24 @@ void Renderer::draw(IMesh* v)
         glEnableVertexAttribArray(m_ia_point);
         glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
 
-        glDrawElements(GL_LINES, wireframe_indices.size(), GL_UNSIGNED_INT, 0);
+        for (size_t i = 0; i < num_instances; ++i) {
+            set_instance(i);
+            if (!has_ranges) {
+                glDrawElements(GL_LINES, wireframe_indices.size(), GL_UNSIGNED_INT, 0);
+            }
+            else {
+                for (auto& r : ranges)
+                    glDrawElements(GL_LINES, r.wireframe_count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * r.wireframe_offset));
+            }
+        }
+
+        if (has_lod) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v->getLODIndicesBuffer());
+            for (auto& r : ranges) {
+                if (r.lod_wireframe_count > 0)
+                    glDrawElements(GL_LINES, r.lod_wireframe_count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * r.lod_wireframe_offset));
+            }
+        }
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -301,12 +617,24 @@ void Renderer::draw(IMesh* v)
         glEnableVertexAttribArray(m_ia_point);
         glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
 
-        glDrawArrays(GL_POINTS, 0, points.size());
+        for (size_t i = 0; i < num_instances; ++i) {
+            set_instance(i);
+            if (!has_ranges) {
+                glDrawArrays(GL_POINTS, 0, points.size());
+            }
+            else {
+                for (auto& r : ranges)
+                    glDrawArrays(GL_POINTS, r.points_offset, r.points_count);
+            }
+        }
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         glDepthMask(GL_TRUE);
     }
+
+    if (!instance_matrices.empty())
+        glUniformMatrix4fv(m_u_mvp, 1, GL_FALSE, (const GLfloat*)&m_view_proj);
 }
 
 void Renderer::draw(IPoints* v)
@@ -328,13 +656,87 @@ void Renderer::draw(IPoints* v)
         glEnableVertexAttribArray(m_ia_point);
         glVertexAttribPointer(m_ia_point, 3, GL_FLOAT, GL_FALSE, sizeof(float3), nullptr);
 
-        glDrawArrays(GL_POINTS, 0, points.size());
+        if (!v->hasDrawRanges()) {
+            glDrawArrays(GL_POINTS, 0, points.size());
+        }
+        else {
+            for (auto& r : v->getDrawRanges())
+                glDrawArrays(GL_POINTS, r.points_offset, r.points_count);
+        }
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         glDepthMask(GL_TRUE);
     }
 }
+
+void Renderer::draw(IVAT* v, double time)
+{
+    if (!v || !v->getPointsTexture())
+        return;
+
+    int num_frames = v->getFrameCount();
+    double f = clamp((time - v->getStartTime()) * v->getFrameRate(), 0.0, (double)(num_frames - 1));
+    int f0 = (int)f;
+    int f1 = std::min(f0 + 1, num_frames - 1);
+    int num_points = v->getPointCount();
+    auto objects = v->getObjects();
+
+    glUseProgram(m_shader_vat);
+    glUniformMatrix4fv(m_vat_u_mvp, 1, GL_FALSE, (const GLfloat*)&m_view_proj);
+    glUniform1fv(m_vat_u_point_size, 1, (const GLfloat*)&m_point_size);
+    glUniform2i(m_vat_u_base, f0 * num_points, f1 * num_points);
+    glUniform1f(m_vat_u_blend, (float)(f - f0));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, v->getPointsTexture());
+    glActiveTexture(GL_TEXTURE1);
+    // without normals the sampler still needs a complete texture. the result is unused.
+    glBindTexture(GL_TEXTURE_2D_ARRAY, v->getNormalsTexture() ? v->getNormalsTexture() : v->getPointsTexture());
+    glActiveTexture(GL_TEXTURE0);
+
+    // no vertex attributes. the enabled array of the fill shader would refer to whatever buffer was bound last.
+    glDisableVertexAttribArray(m_ia_point);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v->getIndicesBuffer());
+
+    // faces
+    if (m_draw_faces) {
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.0f, 1.0f);
+        glUniform4fv(m_vat_u_color, 1, (const GLfloat*)&m_face_color);
+        for (auto& obj : objects) {
+            if (obj.triangles_count > 0)
+                glDrawElements(GL_TRIANGLES, obj.triangles_count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * obj.triangles_offset));
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+
+    glDepthMask(GL_FALSE);
+    glUniform4fv(m_vat_u_color, 1, (const GLfloat*)&m_fill_color);
+
+    // wire frame
+    if (m_draw_wireframe) {
+        for (auto& obj : objects) {
+            if (obj.edges_count > 0)
+                glDrawElements(GL_LINES, obj.edges_count, GL_UNSIGNED_INT, (const void*)(sizeof(int) * obj.edges_offset));
+        }
+    }
+
+    // points
+    for (auto& obj : objects) {
+        bool is_points = obj.triangles_count == 0 && obj.edges_count == 0;
+        if (obj.points_count > 0 && (m_draw_points || is_points))
+            glDrawArrays(GL_POINTS, obj.points_offset, obj.points_count);
+    }
+
+    glDepthMask(GL_TRUE);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glEnableVertexAttribArray(m_ia_point);
+    glUseProgram(m_shader_fill);
+}
 #endif
 
 IRenderer* CreateRenderer_()
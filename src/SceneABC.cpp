@@ -1,50 +1,367 @@
 #include "pch.h"
 #include "SceneGraph.h"
+#include "Parallel.h"
+#include "MeshLOD.h"
+#include "PointsLOD.h"
+#include "MeshCluster.h"
+#include "Quantize.h"
 
 namespace wabc {
 
 class SceneABC : public IScene
 {
 public:
-    struct ImportContext
+    enum class NodeType
+    {
+        Unknown,
+        Xform,
+        Camera,
+        PolyMesh,
+        Points,
+    };
+
+    // flattened hierarchy. nodes are sorted by depth, so parents always precede their children.
+    struct Node
     {
         Abc::IObject obj;
-        double time = 0.0;
-        float4x4 local_matrix = float4x4::identity();
-        float4x4 global_matrix = float4x4::identity();
+        NodeType type = NodeType::Unknown;
+        int parent = -1;
+        AbcGeom::IXformSchema xform;
+        AbcGeom::ICameraSchema camera;
+        AbcGeom::IPolyMeshSchema polymesh;
+        AbcGeom::IPointsSchema points;
+        AbcGeom::IBox3dProperty self_bounds;
+        AbcGeom::IVisibilityProperty visibility;
+        int8_t visibility_value = AbcGeom::kVisibilityDeferred; // used if visibility is constant or invalid
+        Camera* dst_camera{};
+    };
+
+    // transforms of an evaluation. the node tables are only read while evaluating, so evaluations at different times
+    // can run concurrently as long as each has its own EvalState.
+    struct EvalState
+    {
+        RawVector<float4x4> local_matrices;
+        RawVector<float4x4> global_matrices;
+        RawVector<bool> inherits_xforms;
+        RawVector<int8_t> visibility; // AbcGeom::ObjectVisibility. deferred is resolved with the parent's one
+        RawVector<bool> xform_cached; // the transform is constant and has been read into local_matrices
+
+        // per geometry scratch of evaluateRange()
+        std::vector<Abc::P3fArraySamplePtr> positions;
+        RawVector<size_t> offsets;
+
+        void resize(size_t num_nodes);
+    };
+
+    // sizes of / positions in the arrays of Mesh and Points
+    struct GeomSize
+    {
+        size_t points{};
+        size_t points_ex{};
+        size_t counts{};
+        size_t face_indices{};
+        size_t wireframe_indices{};
+        size_t lod_indices{};
+        size_t cluster_points{};
+        size_t cluster_indices{};
+        size_t clusters{};
+        size_t particles{};
+
+        GeomSize& operator+=(const GeomSize& v);
+    };
+
+    // state of a geometry as of a geometry evaluation. frames keep a copy of it, so that the render thread can cull
+    // and build draw lists of a frame while the next one is being evaluated.
+    struct GeomState
+    {
+        int node = -1;            // index to m_nodes
+        int instance = -1;        // index to m_instances. instanced geometry is not written to the monolithic mesh.
+        bool active = false;      // selected and not hidden
+        bool has_bounds = false;
+        bool in_frustum = true;
+        bool decoded = false;     // written to the monolithic mesh
+        bool constant_points = false; // positions of the clusters are constant
+        float3 bounds_min{};      // self bounds in local space
+        float3 bounds_max{};
+        float4x4 matrix = float4x4::identity(); // global matrix
+        GeomSize size;
+        GeomSize offset;
     };
 
+    // geometry of a node decoded for the current time. each one is written to its own region of the monolithic mesh.
+    struct GeomData : GeomState
+    {
+        AbcGeom::IPolyMeshSchema::Sample mesh_sample;
+        AbcGeom::IPointsSchema::Sample points_sample;
+
+        // SceneSettings::interpolate_samples. samples around the last time, and positions of the time if interpolated is true.
+        struct CachedSample
+        {
+            Abc::index_t index = -1;
+            AbcGeom::IPolyMeshSchema::Sample mesh;
+            AbcGeom::IPointsSchema::Sample points;
+        };
+        CachedSample sample_cache[2];
+        bool interpolated = false;
+        RawVector<float3> interpolated_points;
+
+        // simplified levels. built from the first sample read if the topology is constant.
+        bool lod_built = false;
+        std::vector<MeshLODLevel> lods;
+
+        // clusters. built from the first sample read if the topology is constant. offsets are local to this object.
+        bool cluster_built = false;
+        RawVector<MeshCluster> clusters;
+        RawVector<int> cluster_vertex_map; // cluster vertex -> index to positions
+        RawVector<uint16_t> cluster_indices;
+    };
+
+    // meshes that share geometry. decoded once in the local space of the first one and drawn with each member's global matrix.
+    struct Instance
+    {
+        std::vector<int> geom; // indices to m_geom
+        bool constant = false; // decoded only once
+        bool decoded = false;
+        bool dirty = false;    // needs upload
+        GeomData data;
+        MeshPtr mesh;          // created on the render thread
+    };
+
+    // parameters of a camera evaluated for a frame. copied to dst on the render thread.
+    struct CameraState
+    {
+        Camera* dst{};
+        float3 position{};
+        float3 direction{};
+        float3 up{};
+        float focal_length{};
+        float2 aperture{};
+        float2 lens_shift{};
+        float near_plane{};
+        float far_plane{};
+    };
+
+    // camera given by cull()
+    struct View
+    {
+        float4x4 view_proj = float4x4::identity();
+        float2 screen_size{};
+        bool has_view = false;    // cull() has been called
+        bool has_frustum = false; // has_view and culling is enabled
+    };
+
+    // the part of a MeshLODLevel that draw lists need
+    struct LODState
+    {
+        size_t num_indices{};
+        size_t num_triangle_indices{};
+        float cell_size{};
+    };
+
+    // result of an evaluation. the render thread draws one frame while the pipeline worker writes another.
+    // each frame has its own mesh and points, so their GPU buffers are never written while being drawn.
+    struct Frame
+    {
+        double time = -1.0;
+        EvalMask eval_done = EvalMask::None;
+        MeshPtr mesh;         // monolithic mesh. created on the render thread
+        PointsPtr points;     // monolithic points. created on the render thread
+        PointsLOD points_lod; // spatial hierarchy of points
+        std::vector<GeomState> geom; // state of m_geom
+        RawVector<LODState> lods;    // levels of m_geom in order
+        RawVector<int> lod_offsets;  // m_geom -> its first level in lods. one more than geom.
+        RawVector<float4x4> global_matrices;
+        RawVector<bool> node_needed;
+        std::vector<CameraState> cameras;
+
+        // clusters as of the last upload of mesh
+        std::vector<int> cluster_layout;      // m_geom that had clusters
+        bool cluster_quantized = false;       // format
+        RawVector<float4x4> cluster_matrices; // matrices of m_geom
+        std::vector<int> cluster_layout_tmp;  // scratch. keeps its capacity across uploads
+    };
+
+    // frame requested by seekAsync()
+    struct Request
+    {
+        double time{};
+        View view;
+        uint32_t serial{};
+    };
+
+    // result of the hierarchy scan. per-thread results are merged in the hierarchy order.
+    struct ScanResult
+    {
+        std::map<void*, size_t> sample_counts;
+        std::vector<std::string> camera_paths;
+
+        void merge(const ScanResult& v);
+    };
+
+    ~SceneABC() override;
     void release() override;
 
+    void setSettings(const SceneSettings& v) override { stopPipeline(); m_settings = v; }
+    const SceneSettings& getSettings() const override { return m_settings; }
+
     bool load(const char* path) override;
     bool loadAdditive(const char* path) override;
     void unload() override;
 
-    std::tuple<double, double> getTimeRange() const override;
-    void seek(double time) override;
+    bool loadAsync(const char* path) override;
+    void cancelLoad() override;
+    LoadProgress getLoadProgress() const override;
+    void update() override;
 
-    double getTime() const override { return m_time; }
-    IMesh* getMesh() override { return m_mono_mesh.get(); }
-    IPoints* getPoints() override { return m_mono_points.get(); }
-    span<ICamera*> getCameras() override { return make_span(m_cameras); }
+    std::tuple<double, double> getTimeRange() const override;
+    void seek(double time, EvalMask mask = EvalMask::All) override;
+    void seekAsync(double time) override;
+    bool hasPendingFrame() const override;
+    bool evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback) override;
+    void setEvalPaths(const std::vector<std::string>& paths) override;
+    bool getGlobalMatrix(const std::string& path, float4x4& dst) const override;
+    void cull(const float4x4& view_proj, float2 screen_size) override;
+
+    double getTime() const override { return m_frames.front().time; }
+    IMesh* getMesh() override { return m_frames.front().mesh.get(); }
+    IPoints* getPoints() override { return m_frames.front().points.get(); }
+    span<IMesh*> getInstancedMeshes() override { return m_loading ? span<IMesh*>{} : make_span(m_instance_meshes); }
+    // cameras are being added by the load job while loading
+    span<ICamera*> getCameras() override { return m_loading ? span<ICamera*>{} : make_span(m_cameras); }
 
 private:
-    // ctx is not a reference. that is intended.
-    void scanNodes(ImportContext ctx);
-    void seekImpl(ImportContext ctx);
+    enum class LoadPhase
+    {
+        Scan,
+        Bake,
+        Done,
+    };
 
-    std::shared_ptr<std::fstream> m_stream;
+    bool openArchive(const char* path);
+    bool loadStep();
+    void scanParallel();
+    void applyScanResult();
+    void setupTimeRange();
+    void scanNode(Abc::IObject obj, ScanResult& dst);
+    uint64_t getBytesRead() const;
+
+    void buildNodeTable();
+    // groups m_geom by shared geometry into m_instances
+    void setupInstances();
+    void createInstanceMeshes();
+    // updates m_node_selected and m_node_needed
+    void updateEvalNodes(EvalMask mask);
+    // updates the global matrices of needed nodes in state. cameras are written to dst_cameras if it is not null.
+    void evaluateTransforms(EvalState& state, double time, std::vector<CameraState>* dst_cameras) const;
+    void applyCameras(const Frame& frame);
+    // writes world space positions of the geometry that seek() would write to the monolithic mesh and points, without culling
+    void evaluatePositions(EvalState& state, double time, FrameData& dst) const;
+    // updates active, matrix and self bounds of m_geom
+    void updateBounds(double time);
+    // updates in_frustum of geom. State: GeomData or GeomState
+    template<class State> void cullObjects(std::vector<State>& geom, const View& view);
+    // culls m_geom with view, decodes them into dst's mesh and points and copies their state to dst
+    void evaluateGeometry(double time, const View& view, Frame& dst);
+    // copies the state of m_geom and its LOD levels to dst. the render thread reads them from there instead of m_geom.
+    void copyGeomState(Frame& dst) const;
+    // copies the time and the transforms of the last evaluation to dst
+    void commitFrame(Frame& dst);
+    // updates draw ranges and instance matrices from the culling result
+    void updateDrawLists(Frame& frame);
+    // 0: full resolution. n: lods[n - 1]
+    int selectLOD(span<LODState> lods, const GeomState& state) const;
+    // uploads the monolithic mesh and points of frame
+    void uploadFrame(Frame& frame);
+    // false if not selected, hidden, instanced or culled with SceneSettings::cull_decode
+    bool isMonoGeometry(const GeomState& state) const;
+    void readGeometry(GeomData& dst, double time);
+    // reads the sample at or before time through dst.sample_cache and interpolates positions for time if possible
+    void readInterpolated(GeomData& dst, double time);
+    void writeMesh(const GeomData& src, const float4x4& matrix, Mesh& dst);
+    void writePoints(const GeomData& src, const float4x4& matrix, Points& dst);
+    // appends geometry of m_geom[begin, end) to dst_mesh and dst_points
+    void decodeGeometry(size_t begin, size_t end, double time, Mesh& dst_mesh, Points& dst_points);
+    // decodes shared geometry if it is not constant
+    void decodeInstances(const Frame& frame);
+
+    // frame pipeline. seekAsync() requests are evaluated on m_pipeline_thread into m_frames.back().
+    // m_geom, the transforms and the other evaluation state belong to the worker while it is running.
+    bool isPipelineRunning() const;
+    void startPipeline();
+    // waits for the frame being evaluated and shows it
+    void stopPipeline();
+    void requestFrame(double time);
+    void processPipeline();
+    // uploads and shows the frame fetched into m_frames.front()
+    void applyFrame();
+
+    SceneSettings m_settings;
+    std::vector<FileStreamPtr> m_streams; // one per worker thread
     Abc::IArchive m_archive;
 
     std::map<void*, size_t> m_sample_counts;
     std::tuple<double, double> m_time_range;
 
-    double m_time = -1.0;
-    MeshPtr m_mono_mesh;
-    PointsPtr m_mono_points;
+    double m_time = -1.0; // time of the last evaluation
+    EvalMask m_eval_done = EvalMask::None; // parts evaluated at m_time
 
     std::map<std::string, CameraPtr> m_camera_table;
     std::vector<ICamera*> m_cameras;
+
+    std::vector<Node> m_nodes;
+    std::vector<size_t> m_levels; // m_nodes[m_levels[d], m_levels[d + 1]) are nodes at depth d
+    EvalState m_eval; // transforms of seek() and the frame pipeline
+    std::vector<GeomData> m_geom;
+    std::map<std::string, int> m_node_table; // path -> index to m_nodes
+    std::vector<Instance> m_instances;
+    std::vector<IMesh*> m_instance_meshes;
+
+    // culling. render thread only
+    View m_view;
+
+    // clusters
+    RawVector<int> m_cluster_geom; // cluster -> index to m_geom
+
+    // scratch of decodeGeometry(). reset at every call, so its memory is reused by the next evaluation.
+    FrameArena m_arena;
+
+    // frame pipeline
+    TripleBuffer<Frame> m_frames;     // front() is the frame being drawn
+    TripleBuffer<Request> m_requests; // render thread -> pipeline worker
+#ifdef wabcWithThreads
+    std::thread m_pipeline_thread;
+#endif
+    std::mutex m_pipeline_mutex;      // only for sleeping. the buffers are lock-free
+    std::condition_variable m_pipeline_cond;
+    bool m_pipeline_stop = false;     // guarded by m_pipeline_mutex
+    uint32_t m_request_serial = 0;    // render thread only
+    double m_request_time = -1.0;     // render thread only
+    std::atomic<uint32_t> m_done_serial{ 0 }; // serial of the last request evaluated
+
+    // partial evaluation
+    std::vector<std::string> m_eval_paths;
+    RawVector<bool> m_node_selected; // at or under m_eval_paths
+    RawVector<bool> m_node_needed;   // required by the selected nodes for m_needed_mask
+    EvalMask m_needed_mask = EvalMask::None;
+    bool m_needed_valid = false;
+
+    // async load
+    LoadTask m_load_task;
+    LoadPhase m_load_phase = LoadPhase::Done;
+    bool m_load_progressive = false;
+    std::vector<Abc::IObject> m_load_stack;
+    ScanResult m_load_scan;
+    size_t m_load_geom_pos = 0;
+    std::mutex m_load_mutex;
+    MeshPtr m_load_mesh;
+    PointsPtr m_load_points;
+    bool m_load_dirty = false;
+    std::chrono::steady_clock::time_point m_load_last_sync;
+
+    bool m_loading = false; // render thread only
+    bool m_seek_requested = false;
+    double m_seek_request{};
+    EvalMask m_seek_request_mask = EvalMask::All;
 };
 
 
@@ -67,6 +384,11 @@ template<class Cont> inline auto expand(Cont& v, size_t n)
 }
 
 
+SceneABC::~SceneABC()
+{
+    unload();
+}
+
 void SceneABC::release()
 {
     delete this;
@@ -74,42 +396,76 @@ void SceneABC::release()
 
 void SceneABC::unload()
 {
+    stopPipeline();
+    m_load_task.cancel();
+    m_load_phase = LoadPhase::Done;
+    m_load_stack = {};
+    m_load_scan = {};
+    m_load_geom_pos = 0;
+    m_load_mesh = {};
+    m_load_points = {};
+    m_load_dirty = false;
+    m_loading = false;
+    m_seek_requested = false;
+
     m_archive = {};
-    m_stream = {};
+    m_streams = {};
 
     m_sample_counts = {};
     m_time_range = {};
 
     m_time = -1.0;
-    m_mono_mesh = {};
-    m_mono_points = {};
+    m_eval_done = EvalMask::None;
+    for (int i = 0; i < 3; ++i)
+        m_frames.at(i) = {};
+    m_request_time = -1.0;
 
     m_cameras = {};
     m_camera_table = {};
+
+    m_nodes = {};
+    m_levels = {};
+    m_eval = {};
+    m_geom = {};
+    m_node_table = {};
+    m_instances = {};
+    m_instance_meshes = {};
+    m_view = {};
+    m_cluster_geom = {};
+
+    // m_eval_paths is kept as a setting
+    m_node_selected = {};
+    m_node_needed = {};
+    m_needed_mask = EvalMask::None;
+    m_needed_valid = false;
 }
 
-bool SceneABC::load(const char* path)
+bool SceneABC::openArchive(const char* path)
 {
-    unload();
-
     try
     {
         // Abc::IArchive doesn't accept wide string path. so create file stream with wide string path and pass it.
         // (VisualC++'s std::ifstream accepts wide string)
-        m_stream.reset(new std::fstream());
-        m_stream->open(path, std::ios::in | std::ios::binary);
-        if (!m_stream->is_open()) {
-            unload();
-            return false;
+        // Ogawa locks a stream while reading from it. give one to each worker so that the parallel scan doesn't serialize on it.
+        std::vector<std::istream*> streams;
+        int num_streams = GetWorkerCount();
+        for (int i = 0; i < num_streams; ++i) {
+            auto stream = std::make_shared<FileStream>();
+            if (!stream->open(path)) {
+                m_streams = {};
+                return false;
+            }
+            m_streams.push_back(stream);
+            streams.push_back(stream.get());
         }
 
-        std::vector<std::istream*> streams{ m_stream.get() };
         Alembic::AbcCoreOgawa::ReadArchive archive_reader(streams);
         m_archive = Abc::IArchive(archive_reader(path), Abc::kWrapExisting, Abc::ErrorHandler::kThrowPolicy);
     }
     catch (Alembic::Util::Exception e)
     {
-        unload();
+        m_archive = {};
+        m_streams = {};
 
 #ifdef wabcEnableHDF5
         try
@@ -118,7 +474,7 @@ bool SceneABC::load(const char* path)
         }
         catch (Alembic::Util::Exception e2)
         {
-            unload();
+            m_archive = {};
             //sgDbgPrint(
             //    "failed to open %s\n"
             //    "it may not an alembic file"
@@ -132,62 +488,319 @@ bool SceneABC::load(const char* path)
         //    , path);
 #endif
     }
+    return m_archive.valid();
+}
 
-    if (m_archive) {
-        m_mono_mesh = std::make_shared<Mesh>();
-        m_mono_points = std::make_shared<Points>();
-
-        ImportContext ctx;
-        ctx.obj = m_archive.getTop();
-        scanNodes(ctx);
-
-        // setup time range
-        m_time_range = { 0.0, 0.0 };
-        uint32_t nt = m_archive.getNumTimeSamplings();
-        for (uint32_t ti = 1; ti < nt; ++ti) {
-            double time_start = 0.0, time_end = 0.0;
-
-            auto ts = m_archive.getTimeSampling(ti);
-            auto tst = ts->getTimeSamplingType();
-            if (tst.isUniform() || tst.isCyclic()) {
-                auto start = ts->getStoredTimes()[0];
-                uint32_t num_samples = (uint32_t)m_sample_counts[ts.get()];
-                uint32_t samples_per_cycle = tst.getNumSamplesPerCycle();
-                double time_per_cycle = tst.getTimePerCycle();
-                uint32_t num_cycles = num_samples / samples_per_cycle;
-
-                if (tst.isUniform()) {
-                    time_start = start;
-                    time_end = num_cycles > 0 ? start + (time_per_cycle * (num_cycles - 1)) : start;
-                }
-                else if (tst.isCyclic()) {
-                    auto& times = ts->getStoredTimes();
-                    if (!times.empty()) {
-                        size_t ntimes = times.size();
-                        time_start = start + (times.front() - time_per_cycle);
-                        time_end = start + (times.back() - time_per_cycle) + (time_per_cycle * num_cycles);
-                    }
-                }
+bool SceneABC::load(const char* path)
+{
+    unload();
+    if (!openArchive(path)) {
+        unload();
+        return false;
+    }
+
+    auto& frame = m_frames.front();
+    frame.mesh = std::make_shared<Mesh>();
+    frame.points = std::make_shared<Points>();
+
+    m_load_stack.push_back(m_archive.getTop());
+    m_load_phase = LoadPhase::Scan;
+    m_load_progressive = false;
+    while (loadStep()) {}
+    createInstanceMeshes();
+
+    return m_archive.valid();
+}
+
+bool SceneABC::loadAsync(const char* path)
+{
+    unload();
+    if (!openArchive(path)) {
+        unload();
+        return false;
+    }
+
+    // GL resources must be created on the render thread
+    auto& frame = m_frames.front();
+    frame.mesh = std::make_shared<Mesh>();
+    frame.points = std::make_shared<Points>();
+    m_load_mesh = std::make_shared<Mesh>();
+    m_load_points = std::make_shared<Points>();
+
+    m_load_stack.push_back(m_archive.getTop());
+    m_load_phase = LoadPhase::Scan;
+    m_load_progressive = true;
+    m_loading = true;
+    m_load_task.start([this]() { return loadStep(); }, m_streams.empty() ? 0 : m_streams.front()->getSize());
+    return true;
+}
+
+void SceneABC::cancelLoad()
+{
+    if (m_loading)
+        unload();
+}
+
+LoadProgress SceneABC::getLoadProgress() const
+{
+    return m_load_task.getProgress();
+}
+
+bool SceneABC::loadStep()
+{
+    switch (m_load_phase) {
+    case LoadPhase::Scan:
+        if (GetWorkerCount() > 1) {
+            // scans the whole hierarchy in one step. cancel requests are checked inside.
+            scanParallel();
+        }
+        for (int i = 0; i < 256 && !m_load_stack.empty(); ++i) {
+            auto obj = m_load_stack.back();
+            m_load_stack.pop_back();
+            scanNode(obj, m_load_scan);
+            ++m_load_task.m_nodes_scanned;
+
+            // push in reverse order to visit children in the same order as the recursive walk
+            for (size_t ci = obj.getNumChildren(); ci-- > 0; )
+                m_load_stack.push_back(obj.getChild(ci));
+        }
+        if (m_load_stack.empty()) {
+            applyScanResult();
+            setupTimeRange();
+            buildNodeTable();
+            if (m_load_progressive) {
+                // bake the first frame. objects become visible as they are added.
+                // cameras are applied when the load is completed. the render thread doesn't touch them until then.
+                updateEvalNodes(EvalMask::All);
+                evaluateTransforms(m_eval, std::get<0>(m_time_range), &m_frames.front().cameras);
+                updateBounds(std::get<0>(m_time_range));
+                m_load_geom_pos = 0;
+                m_load_phase = LoadPhase::Bake;
             }
-            else if (tst.isAcyclic()) {
-                auto& s = ts->getStoredTimes();
-                if (!s.empty()) {
-                    time_start = s.front();
-                    time_end = s.back();
-                }
+            else {
+                m_load_phase = LoadPhase::Done;
             }
+        }
+        break;
+
+    case LoadPhase::Bake:
+    {
+        size_t begin = m_load_geom_pos;
+        size_t end = std::min(begin + (size_t)GetWorkerCount() * 16, m_geom.size());
+        if (begin < end) {
+            std::unique_lock<std::mutex> lock(m_load_mutex);
+            decodeGeometry(begin, end, std::get<0>(m_time_range), *m_load_mesh, *m_load_points);
+            m_load_task.m_objects_baked += uint32_t(end - begin);
+            m_load_dirty = true;
+        }
+        m_load_geom_pos = end;
+        if (m_load_geom_pos == m_geom.size()) {
+            m_time = std::get<0>(m_time_range);
+            m_eval_done = EvalMask::All;
+            m_load_phase = LoadPhase::Done;
+        }
+        break;
+    }
 
-            if (ti == 1) {
-                m_time_range = { time_start, time_end };
+    default:
+        break;
+    }
+
+    m_load_task.m_bytes_read = getBytesRead();
+    return m_load_phase != LoadPhase::Done;
+}
+
+void SceneABC::scanParallel()
+{
+    struct Entry
+    {
+        Abc::IObject obj;
+        bool subtree; // false: scan the node only. its children have their own entries.
+    };
+
+    std::vector<Entry> entries;
+    for (auto& obj : m_load_stack)
+        entries.push_back({ obj, true });
+    m_load_stack.clear();
+
+    // split the hierarchy into enough subtrees to keep the workers busy.
+    // an expanded node is replaced by itself (node only) followed by its children, so the entries stay in the serial walk order.
+    size_t num_subtrees_needed = (size_t)GetWorkerCount() * 8;
+    for (int depth = 0; depth < 16; ++depth) {
+        size_t num_subtrees = std::count_if(entries.begin(), entries.end(), [](const Entry& e) { return e.subtree; });
+        if (num_subtrees >= num_subtrees_needed)
+            break;
+
+        std::vector<Entry> next;
+        bool expanded = false;
+        for (auto& e : entries) {
+            size_t n = e.subtree ? e.obj.getNumChildren() : 0;
+            if (n == 0) {
+                next.push_back(e);
+                continue;
             }
-            else {
-                std::get<0>(m_time_range) = std::min(std::get<0>(m_time_range), time_start);
-                std::get<1>(m_time_range) = std::max(std::get<1>(m_time_range), time_end);
+            next.push_back({ e.obj, false });
+            for (size_t ci = 0; ci < n; ++ci)
+                next.push_back({ e.obj.getChild(ci), true });
+            expanded = true;
+        }
+        entries.swap(next);
+        if (!expanded)
+            break;
+    }
+
+    std::vector<ScanResult> results(entries.size());
+    parallel_for(0, (int)entries.size(), [&](int ei) {
+        auto& entry = entries[ei];
+        auto& dst = results[ei];
+
+        std::vector<Abc::IObject> stack{ entry.obj };
+        while (!stack.empty() && !m_load_task.isCanceled()) {
+            auto obj = stack.back();
+            stack.pop_back();
+            scanNode(obj, dst);
+            ++m_load_task.m_nodes_scanned;
+
+            if (entry.subtree) {
+                for (size_t ci = obj.getNumChildren(); ci-- > 0; )
+                    stack.push_back(obj.getChild(ci));
             }
         }
+    });
+
+    // merge in the entry order so that the result doesn't depend on scheduling
+    for (auto& r : results)
+        m_load_scan.merge(r);
+}
+
+void SceneABC::ScanResult::merge(const ScanResult& v)
+{
+    for (auto& kvp : v.sample_counts) {
+        auto& n = sample_counts[kvp.first];
+        n = std::max(n, kvp.second);
     }
+    camera_paths.insert(camera_paths.end(), v.camera_paths.begin(), v.camera_paths.end());
+}
 
-    return m_archive.valid();
+void SceneABC::applyScanResult()
+{
+    m_sample_counts = std::move(m_load_scan.sample_counts);
+    for (auto& path : m_load_scan.camera_paths) {
+        auto cam = std::make_shared<Camera>();
+        cam->m_path = path;
+        m_camera_table[cam->m_path] = cam;
+        m_cameras.push_back(cam.get());
+    }
+    m_load_scan = {};
+}
+
+uint64_t SceneABC::getBytesRead() const
+{
+    uint64_t ret = 0;
+    for (auto& stream : m_streams)
+        ret += stream->getBytesRead();
+    return ret;
+}
+
+void SceneABC::update()
+{
+    if (isPipelineRunning() && m_frames.fetch())
+        applyFrame();
+    if (!m_loading)
+        return;
+
+    bool running = m_load_task.update();
+    {
+        // copying is throttled as the staging data grows every step
+        auto now = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(m_load_mutex);
+        if (m_load_dirty && (!running || now - m_load_last_sync > std::chrono::milliseconds(100))) {
+            auto& frame = m_frames.front();
+            frame.mesh->assign(*m_load_mesh);
+            frame.points->assign(*m_load_points);
+            frame.mesh->upload();
+            frame.points->upload();
+            m_load_dirty = false;
+            m_load_last_sync = now;
+        }
+    }
+
+    if (!running) {
+        m_load_task.wait();
+        m_loading = false;
+        m_load_mesh = {};
+        m_load_points = {};
+
+        if (m_load_task.getProgress().state != LoadState::Completed) {
+            unload();
+            return;
+        }
+
+        // instanced geometry was skipped by the load job. the first frame's transforms are still valid.
+        createInstanceMeshes();
+        auto& frame = m_frames.front();
+        copyGeomState(frame);
+        commitFrame(frame);
+        applyCameras(frame);
+        if (m_settings.points_budget > 0) {
+            // sorting changes the order of points. per object ranges of points are not valid after this.
+            frame.points_lod.build(frame.points->m_points);
+            uploadFrame(frame);
+        }
+        decodeInstances(frame);
+        updateDrawLists(frame);
+        if (m_seek_requested) {
+            m_seek_requested = false;
+            seek(m_seek_request, m_seek_request_mask);
+        }
+    }
+}
+
+void SceneABC::setupTimeRange()
+{
+    m_time_range = { 0.0, 0.0 };
+    uint32_t nt = m_archive.getNumTimeSamplings();
+    for (uint32_t ti = 1; ti < nt; ++ti) {
+        double time_start = 0.0, time_end = 0.0;
+
+        auto ts = m_archive.getTimeSampling(ti);
+        auto tst = ts->getTimeSamplingType();
+        if (tst.isUniform() || tst.isCyclic()) {
+            auto start = ts->getStoredTimes()[0];
+            uint32_t num_samples = (uint32_t)m_sample_counts[ts.get()];
+            uint32_t samples_per_cycle = tst.getNumSamplesPerCycle();
+            double time_per_cycle = tst.getTimePerCycle();
+            uint32_t num_cycles = num_samples / samples_per_cycle;
+
+            if (tst.isUniform()) {
+                time_start = start;
+                time_end = num_cycles > 0 ? start + (time_per_cycle * (num_cycles - 1)) : start;
+            }
+            else if (tst.isCyclic()) {
+                auto& times = ts->getStoredTimes();
+                if (!times.empty()) {
+                    size_t ntimes = times.size();
+                    time_start = start + (times.front() - time_per_cycle);
+                    time_end = start + (times.back() - time_per_cycle) + (time_per_cycle * num_cycles);
+                }
+            }
+        }
+        else if (tst.isAcyclic()) {
+            auto& s = ts->getStoredTimes();
+            if (!s.empty()) {
+                time_start = s.front();
+                time_end = s.back();
+            }
+        }
+
+        if (ti == 1) {
+            m_time_range = { time_start, time_end };
+        }
+        else {
+            std::get<0>(m_time_range) = std::min(std::get<0>(m_time_range), time_start);
+            std::get<1>(m_time_range) = std::max(std::get<1>(m_time_range), time_end);
+        }
+    }
 }
 
 bool SceneABC::loadAdditive(const char* path)
@@ -197,18 +810,20 @@ bool SceneABC::loadAdditive(const char* path)
 
 std::tuple<double, double> SceneABC::getTimeRange() const
 {
+    // m_time_range is being written by the load job while loading
+    if (m_loading)
+        return {};
     return m_time_range;
 }
 
-void SceneABC::scanNodes(ImportContext ctx)
+void SceneABC::scanNode(Abc::IObject obj, ScanResult& dst)
 {
-    auto update_sample_count = [this](auto& schema) {
+    auto update_sample_count = [&dst](auto& schema) {
         auto ts = schema.getTimeSampling();
-        auto& n = m_sample_counts[ts.get()];
+        auto& n = dst.sample_counts[ts.get()];
         n = std::max(n, schema.getNumSamples());
     };
 
-    auto obj = ctx.obj;
     const auto& metadata = obj.getMetaData();
     if (AbcGeom::IXformSchema::matches(metadata)) {
         auto schema = AbcGeom::IXform(obj).getSchema();
@@ -217,11 +832,7 @@ void SceneABC::scanNodes(ImportContext ctx)
     else if (AbcGeom::ICameraSchema::matches(metadata)) {
         auto schema = AbcGeom::ICamera(obj).getSchema();
         update_sample_count(schema);
-
-        auto cam = std::make_shared<Camera>();
-        cam->m_path = obj.getFullName();
-        m_camera_table[cam->m_path] = cam;
-        m_cameras.push_back(cam.get());
+        dst.camera_paths.push_back(obj.getFullName());
     }
     else if (AbcGeom::IPolyMeshSchema::matches(metadata)) {
         auto schema = AbcGeom::IPolyMesh(obj).getSchema();
@@ -233,99 +844,928 @@ void SceneABC::scanNodes(ImportContext ctx)
     }
     else {
     }
+}
 
-    size_t n = obj.getNumChildren();
-    for (size_t ci = 0; ci < n; ++ci) {
-        ctx.obj = obj.getChild(ci);
-        scanNodes(ctx);
+void SceneABC::seek(double time, EvalMask mask)
+{
+    if (m_loading) {
+        // seek after the load job is completed
+        m_seek_requested = true;
+        m_seek_request = time;
+        m_seek_request_mask = mask;
+        return;
+    }
+    if (!m_archive)
+        return;
+    stopPipeline();
+    if (time == m_time && (m_eval_done & mask) == mask)
+        return;
+
+    if (time != m_time)
+        m_eval_done = EvalMask::None;
+    m_time = time;
+
+    // cameras and geometry depend on transforms
+    if (mask != EvalMask::None)
+        mask = mask | EvalMask::Transforms;
+    updateEvalNodes(mask);
+
+    auto& frame = m_frames.front();
+    bool cameras = has_flag(mask, EvalMask::Cameras);
+    evaluateTransforms(m_eval, time, cameras ? &frame.cameras : nullptr);
+    if (has_flag(mask, EvalMask::Geometry)) {
+        updateBounds(time);
+        evaluateGeometry(time, m_view, frame);
+        uploadFrame(frame);
+    }
+    m_eval_done = m_eval_done | mask;
+    commitFrame(frame);
+    if (cameras)
+        applyCameras(frame);
+    if (has_flag(mask, EvalMask::Geometry)) {
+        decodeInstances(frame);
+        updateDrawLists(frame);
     }
 }
 
-void SceneABC::seek(double time)
+void SceneABC::seekAsync(double time)
 {
-    if (!m_archive || time == m_time)
+#ifdef wabcWithThreads
+    if (m_loading || !m_archive) {
+        seek(time);
         return;
+    }
+    if (isPipelineRunning() ? time == m_request_time : (time == m_time && m_eval_done == EvalMask::All))
+        return;
+    requestFrame(time);
+#else
+    seek(time);
+#endif
+}
 
-    m_time = time;
-    m_mono_mesh->clear();
-    m_mono_points->clear();
+bool SceneABC::hasPendingFrame() const
+{
+    return isPipelineRunning() && (m_request_serial != m_done_serial || m_frames.hasFresh());
+}
 
-    ImportContext ctx;
-    ctx.obj = m_archive.getTop();
-    ctx.time = time;
-    seekImpl(ctx);
+bool SceneABC::evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback)
+{
+    if (m_loading || !m_archive || dst.size() < times.size())
+        return false;
+    // the worker reads the node tables and m_node_needed
+    stopPipeline();
+    updateEvalNodes(EvalMask::Transforms | EvalMask::Geometry);
+
+    // frames are the unit of parallelism. each task owns an EvalState and takes frames until none is left,
+    // so constant transforms are read once per task and its scratch is reused across frames.
+    size_t num_frames = times.size();
+    size_t num_states = std::min((size_t)std::max(GetWorkerCount(), 1), num_frames);
+    std::vector<EvalState> states(num_states);
+    std::atomic<size_t> next{ 0 };
+    parallel_for(0, (int)num_states, [&](int si) {
+        auto& state = states[si];
+        state.resize(m_nodes.size());
+        for (size_t fi; (fi = next++) < num_frames; ) {
+            evaluateTransforms(state, times[fi], nullptr);
+            evaluatePositions(state, times[fi], dst[fi]);
+            if (callback)
+                callback(fi);
+        }
+    });
+    return true;
+}
 
-    m_mono_mesh->upload();
-    m_mono_points->upload();
+void SceneABC::setEvalPaths(const std::vector<std::string>& paths)
+{
+    stopPipeline();
+    m_eval_paths = paths;
+    m_node_selected = {};
+    m_needed_valid = false;
+    m_eval_done = EvalMask::None;
 }
 
-void SceneABC::seekImpl(ImportContext ctx)
+bool SceneABC::getGlobalMatrix(const std::string& path, float4x4& dst) const
 {
-    auto obj = ctx.obj;
-    auto ss = Abc::ISampleSelector(ctx.time);
+    if (m_loading)
+        return false;
+    // the state of the frame being drawn. the worker may be evaluating the next one.
+    auto& frame = m_frames.front();
+    auto it = m_node_table.find(path);
+    if (it == m_node_table.end() || !has_flag(frame.eval_done, EvalMask::Transforms) || !frame.node_needed[it->second])
+        return false;
+    dst = frame.global_matrices[it->second];
+    return true;
+}
 
-    const auto& metadata = obj.getMetaData();
-    if (AbcGeom::IXformSchema::matches(metadata)) {
-        auto schema = AbcGeom::IXform(obj).getSchema();
+void SceneABC::cull(const float4x4& view_proj, float2 screen_size)
+{
+    if (m_loading || !m_archive)
+        return;
 
-        AbcGeom::XformSample sample;
-        schema.get(sample, ss);
-        auto m = sample.getMatrix();
-        ctx.local_matrix.assign((double4x4&)m);
-        ctx.global_matrix = ctx.local_matrix * ctx.global_matrix;
+    m_view.view_proj = view_proj;
+    m_view.screen_size = screen_size;
+    m_view.has_view = true;
+    m_view.has_frustum = m_settings.frustum_culling;
+    auto& frame = m_frames.front();
+    cullObjects(frame.geom, m_view);
+
+    if (has_flag(frame.eval_done, EvalMask::Geometry)) {
+        // objects that came into view with SceneSettings::cull_decode (or after it is turned off) are not decoded yet
+        bool missing = false;
+        for (size_t gi = 0; gi < frame.geom.size() && !missing; ++gi)
+            missing = isMonoGeometry(frame.geom[gi]) && !frame.geom[gi].decoded;
+        if (missing && isPipelineRunning()) {
+            // the worker decodes them with this view
+            if (frame.time != m_request_time || !hasPendingFrame())
+                requestFrame(frame.time);
+        }
+        else if (missing) {
+            evaluateGeometry(m_time, m_view, frame);
+            uploadFrame(frame);
+        }
     }
-    else if (AbcGeom::ICameraSchema::matches(metadata)) {
-        auto schema = AbcGeom::ICamera(obj).getSchema();
+    updateDrawLists(frame);
+}
 
-        AbcGeom::CameraSample sample;
-        schema.get(sample, ss);
-
-        auto& dst = m_camera_table[obj.getFullName()];
-        if (dst) {
-            float3 pos = extract_position(ctx.global_matrix);
-            float3 dir = normalize(mul_v(ctx.global_matrix, float3{ 0.0f, 0.0f, -1.0f }));
-            float3 up = normalize(mul_v(ctx.global_matrix, float3{ 0.0f, 1.0f, 0.0f }));
-
-            dst->m_position = pos;
-            dst->m_direction = dir;
-            dst->m_up = up;
-
-            dst->m_focal_length = (float)sample.getFocalLength();
-            dst->m_aperture = float2{
-                (float)sample.getHorizontalAperture(),
-                (float)sample.getVerticalAperture()
-            } *10.0f; // cm to mm
-            dst->m_lens_shift = float2{
-                (float)(sample.getHorizontalFilmOffset() / sample.getHorizontalAperture()),
-                (float)(sample.getVerticalFilmOffset() / sample.getVerticalAperture())
-            };
-
-            dst->m_near = std::max((float)sample.getNearClippingPlane(), 0.01f);
-            dst->m_far = std::max((float)sample.getFarClippingPlane(), dst->m_near);
+bool SceneABC::isPipelineRunning() const
+{
+#ifdef wabcWithThreads
+    return m_pipeline_thread.joinable();
+#else
+    return false;
+#endif
+}
+
+void SceneABC::startPipeline()
+{
+#ifdef wabcWithThreads
+    if (m_pipeline_thread.joinable())
+        return;
+
+    // GL resources must be created on the render thread
+    for (int i = 0; i < 3; ++i) {
+        auto& frame = m_frames.at(i);
+        if (!frame.mesh)
+            frame.mesh = std::make_shared<Mesh>();
+        if (!frame.points)
+            frame.points = std::make_shared<Points>();
+    }
+    m_pipeline_stop = false;
+    m_pipeline_thread = std::thread([this]() { processPipeline(); });
+#endif
+}
+
+void SceneABC::stopPipeline()
+{
+#ifdef wabcWithThreads
+    if (!m_pipeline_thread.joinable())
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(m_pipeline_mutex);
+        m_pipeline_stop = true;
+    }
+    m_pipeline_cond.notify_one();
+    m_pipeline_thread.join();
+
+    // a request not taken by the worker is dropped. the last evaluated frame is shown, so that m_geom and
+    // the other evaluation state match the front frame again.
+    m_requests.fetch();
+    m_done_serial = m_request_serial;
+    m_request_time = -1.0;
+    if (m_frames.fetch())
+        applyFrame();
+#endif
+}
+
+void SceneABC::requestFrame(double time)
+{
+    startPipeline();
+
+    auto& req = m_requests.back();
+    req.time = time;
+    req.view = m_view;
+    req.serial = ++m_request_serial;
+    m_requests.publish();
+    m_request_time = time;
+
+    // the lock orders the publish before the worker's wait
+    {
+        std::unique_lock<std::mutex> lock(m_pipeline_mutex);
+    }
+    m_pipeline_cond.notify_one();
+}
+
+void SceneABC::processPipeline()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_pipeline_mutex);
+            m_pipeline_cond.wait(lock, [this]() { return m_pipeline_stop || m_requests.hasFresh(); });
+            if (m_pipeline_stop)
+                break;
+        }
+        m_requests.fetch();
+        const auto& req = m_requests.front();
+
+        // same as seek(req.time). instanced geometry is decoded on the render thread when the frame is shown.
+        auto& frame = m_frames.back();
+        m_time = req.time;
+        updateEvalNodes(EvalMask::All);
+        evaluateTransforms(m_eval, req.time, &frame.cameras);
+        updateBounds(req.time);
+        evaluateGeometry(req.time, req.view, frame);
+        m_eval_done = EvalMask::All;
+        commitFrame(frame);
+
+        m_frames.publish();
+        m_done_serial = req.serial;
+    }
+}
+
+void SceneABC::applyFrame()
+{
+    auto& frame = m_frames.front();
+    uploadFrame(frame);
+    applyCameras(frame);
+    // the worker culled with the view of the request. the camera may have moved since.
+    cullObjects(frame.geom, m_view);
+    decodeInstances(frame);
+    updateDrawLists(frame);
+}
+
+void SceneABC::updateEvalNodes(EvalMask mask)
+{
+    size_t num_nodes = m_nodes.size();
+    if (m_node_selected.size() != num_nodes) {
+        m_node_selected.resize(num_nodes);
+        parallel_for_blocked(0, (int)num_nodes, 256, [this](int first, int last) {
+            for (int ni = first; ni < last; ++ni)
+                m_node_selected[ni] = IsPathSelected(m_nodes[ni].obj.getFullName(), m_eval_paths);
+        });
+        m_needed_valid = false;
+    }
+    if (m_needed_valid && m_needed_mask == mask)
+        return;
+
+    m_node_needed.resize(num_nodes);
+    for (size_t ni = 0; ni < num_nodes; ++ni) {
+        bool needed = false;
+        if (m_node_selected[ni]) {
+            switch (m_nodes[ni].type) {
+            case NodeType::Camera:
+                needed = has_flag(mask, EvalMask::Cameras);
+                break;
+            case NodeType::PolyMesh:
+            case NodeType::Points:
+                needed = has_flag(mask, EvalMask::Geometry);
+                break;
+            default:
+                needed = has_flag(mask, EvalMask::Transforms);
+                break;
+            }
+        }
+        m_node_needed[ni] = needed;
+    }
+    // ancestors of needed nodes are needed. children always come after their parents.
+    for (size_t ni = num_nodes; ni-- > 0; ) {
+        int parent = m_nodes[ni].parent;
+        if (m_node_needed[ni] && parent >= 0)
+            m_node_needed[parent] = true;
+    }
+    m_needed_mask = mask;
+    m_needed_valid = true;
+}
+
+void SceneABC::buildNodeTable()
+{
+    m_nodes.clear();
+    m_levels.clear();
+    m_geom.clear();
+
+    // breadth first walk. this makes nodes sorted by depth.
+    Node top;
+    top.obj = m_archive.getTop();
+    m_nodes.push_back(top);
+    size_t level_begin = 0;
+    while (level_begin < m_nodes.size()) {
+        m_levels.push_back(level_begin);
+        size_t level_end = m_nodes.size();
+        for (size_t ni = level_begin; ni < level_end; ++ni) {
+            auto obj = m_nodes[ni].obj;
+            size_t num_children = obj.getNumChildren();
+            for (size_t ci = 0; ci < num_children; ++ci) {
+                Node child;
+                child.obj = obj.getChild(ci);
+                child.parent = (int)ni;
+                // excluded objects are skipped with their descendants
+                if (!m_settings.exclude_patterns.empty() && !IsPathIncluded(child.obj.getFullName(), m_settings, false))
+                    continue;
+                m_nodes.push_back(child);
+            }
+        }
+        level_begin = level_end;
+    }
+    m_levels.push_back(m_nodes.size());
+
+    // setup schemas
+    parallel_for_blocked(0, (int)m_nodes.size(), 256, [this](int first, int last) {
+        for (int ni = first; ni < last; ++ni) {
+            auto& node = m_nodes[ni];
+            if (m_settings.skip_invisible) {
+                node.visibility = AbcGeom::GetVisibilityProperty(node.obj);
+                if (node.visibility.valid() && node.visibility.isConstant()) {
+                    node.visibility_value = node.visibility.getValue();
+                    node.visibility = {};
+                }
+            }
+
+            const auto& metadata = node.obj.getMetaData();
+            if (AbcGeom::IXformSchema::matches(metadata)) {
+                node.type = NodeType::Xform;
+                node.xform = AbcGeom::IXform(node.obj).getSchema();
+            }
+            else if (AbcGeom::ICameraSchema::matches(metadata)) {
+                node.type = NodeType::Camera;
+                node.camera = AbcGeom::ICamera(node.obj).getSchema();
+            }
+            else if (AbcGeom::IPolyMeshSchema::matches(metadata)) {
+                node.type = NodeType::PolyMesh;
+                node.polymesh = AbcGeom::IPolyMesh(node.obj).getSchema();
+                node.self_bounds = node.polymesh.getSelfBoundsProperty();
+            }
+            else if (AbcGeom::IPointsSchema::matches(metadata)) {
+                node.type = NodeType::Points;
+                node.points = AbcGeom::IPoints(node.obj).getSchema();
+                node.self_bounds = node.points.getSelfBoundsProperty();
+            }
+        }
+    });
+
+    int num_nodes = (int)m_nodes.size();
+    for (int ni = 0; ni < num_nodes; ++ni) {
+        auto& node = m_nodes[ni];
+        m_node_table[node.obj.getFullName()] = ni;
+        if (node.type == NodeType::Camera) {
+            auto it = m_camera_table.find(node.obj.getFullName());
+            if (it != m_camera_table.end())
+                node.dst_camera = it->second.get();
+        }
+        else if (node.type == NodeType::PolyMesh || node.type == NodeType::Points) {
+            if (!m_settings.include_patterns.empty() && !IsPathIncluded(node.obj.getFullName(), m_settings, true))
+                continue;
+            GeomData geom;
+            geom.node = ni;
+            m_geom.push_back(geom);
+        }
+    }
+
+    m_eval.resize(num_nodes);
+    m_node_selected = {};
+    m_needed_valid = false;
+
+    setupInstances();
+}
+
+void SceneABC::setupInstances()
+{
+    m_instances.clear();
+    if (!m_settings.instancing)
+        return;
+
+    // objects under an instance root are proxies of the objects at the same relative paths under the instance source.
+    // meshes are grouped by the path of the object they actually read.
+    std::vector<std::vector<int>> groups;
+    std::map<std::string, int> source_groups; // source path -> index to groups
+    int num_geom = (int)m_geom.size();
+    for (int gi = 0; gi < num_geom; ++gi) {
+        int ni = m_geom[gi].node;
+        if (m_nodes[ni].type != NodeType::PolyMesh)
+            continue;
+
+        std::string path = m_nodes[ni].obj.getFullName();
+        for (int pi = ni; pi >= 0; pi = m_nodes[pi].parent) {
+            auto& root = m_nodes[pi].obj;
+            if (root.isInstanceRoot()) {
+                path = root.instanceSourcePath() + path.substr(root.getFullName().size());
+                break;
+            }
+        }
+
+        auto it = source_groups.find(path);
+        if (it == source_groups.end()) {
+            source_groups[path] = (int)groups.size();
+            groups.push_back({ gi });
         }
         else {
-            // should not be here
+            groups[it->second].push_back(gi);
         }
     }
-    else if (AbcGeom::IPolyMeshSchema::matches(metadata)) {
-        auto schema = AbcGeom::IPolyMesh(obj).getSchema();
 
-        AbcGeom::IPolyMeshSchema::Sample sample;
-        schema.get(sample, ss);
-        auto counts = make_span(sample.getFaceCounts());
-        auto indices = make_span(sample.getFaceIndices());
-        auto points = make_span(sample.getPositions());
-
-        // make points in global space
-        int num_faces = (int)counts.size();
-        int num_indices = (int)indices.size();
-        int num_points = (int)points.size();
-        int index_offset = (int)m_mono_mesh->m_points.size();
-        float3* dst_points = expand(m_mono_mesh->m_points, num_points);
-        for (int i = 0; i < num_points; ++i)
-            dst_points[i] = mul_p(ctx.global_matrix, (float3&)points[i]);
-
-        // count primitives and allocate space
+    // meshes that are written as copies of the same data share array samples. the keys are digests of the sample data,
+    // so they can be compared without reading the data. only constant meshes are merged as samples are compared once here.
+    using ContentKey = std::array<AbcA::ArraySampleKey, 3>;
+    std::map<ContentKey, int> content_groups; // -> index to groups
+    std::vector<bool> constant(groups.size());
+    for (size_t gri = 0; gri < groups.size(); ++gri) {
+        auto& schema = m_nodes[m_geom[groups[gri].front()].node].polymesh;
+        auto positions = schema.getPositionsProperty();
+        auto indices = schema.getFaceIndicesProperty();
+        auto counts = schema.getFaceCountsProperty();
+        constant[gri] = positions.isConstant() && indices.isConstant() && counts.isConstant();
+        if (!constant[gri])
+            continue;
+
+        auto ss = Abc::ISampleSelector((Abc::index_t)0);
+        ContentKey key;
+        if (!positions.getKey(key[0], ss) || !indices.getKey(key[1], ss) || !counts.getKey(key[2], ss))
+            continue;
+
+        auto it = content_groups.find(key);
+        if (it == content_groups.end()) {
+            content_groups[key] = (int)gri;
+        }
+        else {
+            auto& dst = groups[it->second];
+            dst.insert(dst.end(), groups[gri].begin(), groups[gri].end());
+            groups[gri].clear();
+        }
+    }
+
+    for (size_t gri = 0; gri < groups.size(); ++gri) {
+        auto& group = groups[gri];
+        if (group.size() < 2)
+            continue;
+
+        int ii = (int)m_instances.size();
+        Instance inst;
+        inst.geom = group;
+        inst.constant = constant[gri];
+        inst.data.node = m_geom[group.front()].node;
+        inst.data.instance = ii;
+        for (int gi : group)
+            m_geom[gi].instance = ii;
+        m_instances.push_back(std::move(inst));
+    }
+}
+
+void SceneABC::createInstanceMeshes()
+{
+    m_instance_meshes.clear();
+    for (auto& inst : m_instances) {
+        if (!inst.mesh)
+            inst.mesh = std::make_shared<Mesh>();
+        m_instance_meshes.push_back(inst.mesh.get());
+    }
+}
+
+void SceneABC::EvalState::resize(size_t num_nodes)
+{
+    local_matrices.resize(num_nodes);
+    global_matrices.resize(num_nodes);
+    inherits_xforms.resize(num_nodes);
+    visibility.resize(num_nodes);
+    // node indices change when the table is rebuilt
+    xform_cached.resize_zeroclear(num_nodes);
+}
+
+void SceneABC::evaluateTransforms(EvalState& state, double time, std::vector<CameraState>* dst_cameras) const
+{
+    auto ss = Abc::ISampleSelector(time);
+
+    // local matrices. each node is independent.
+    parallel_for_blocked(0, (int)m_nodes.size(), 256, [&](int first, int last) {
+        for (int ni = first; ni < last; ++ni) {
+            auto& node = m_nodes[ni];
+            if (!m_node_needed[ni])
+                continue;
+
+            state.visibility[ni] = node.visibility.valid() ? node.visibility.getValue(ss) : node.visibility_value;
+            if (node.type == NodeType::Xform) {
+                // samples allocate their ops. constant ones are read only once.
+                if (state.xform_cached[ni])
+                    continue;
+                AbcGeom::XformSample sample;
+                node.xform.get(sample, ss);
+                auto m = sample.getMatrix();
+                state.local_matrices[ni].assign((double4x4&)m);
+                state.inherits_xforms[ni] = sample.getInheritsXforms();
+                state.xform_cached[ni] = node.xform.isConstant();
+            }
+            else {
+                state.local_matrices[ni] = float4x4::identity();
+                state.inherits_xforms[ni] = true;
+            }
+        }
+    });
+
+    // global matrices. parents are in the previous levels, so each level can be processed in parallel.
+    size_t num_levels = m_levels.size() - 1;
+    for (size_t li = 0; li < num_levels; ++li) {
+        parallel_for_blocked((int)m_levels[li], (int)m_levels[li + 1], 1024, [&](int first, int last) {
+            for (int ni = first; ni < last; ++ni) {
+                if (!m_node_needed[ni])
+                    continue;
+                int parent = m_nodes[ni].parent;
+                if (parent < 0 || !state.inherits_xforms[ni])
+                    state.global_matrices[ni] = state.local_matrices[ni];
+                else
+                    state.global_matrices[ni] = state.local_matrices[ni] * state.global_matrices[parent];
+
+                if (state.visibility[ni] == AbcGeom::kVisibilityDeferred)
+                    state.visibility[ni] = parent < 0 ? (int8_t)AbcGeom::kVisibilityVisible : state.visibility[parent];
+            }
+        });
+    }
+
+    if (!dst_cameras)
+        return;
+
+    // cameras
+    dst_cameras->clear();
+    size_t num_nodes = m_nodes.size();
+    for (size_t ni = 0; ni < num_nodes; ++ni) {
+        auto& node = m_nodes[ni];
+        if (node.type != NodeType::Camera || !node.dst_camera || !m_node_needed[ni])
+            continue;
+
+        AbcGeom::CameraSample sample;
+        node.camera.get(sample, ss);
+
+        CameraState dst;
+        dst.dst = node.dst_camera;
+        const auto& global_matrix = state.global_matrices[ni];
+        dst.position = extract_position(global_matrix);
+        dst.direction = normalize(mul_v(global_matrix, float3{ 0.0f, 0.0f, -1.0f }));
+        dst.up = normalize(mul_v(global_matrix, float3{ 0.0f, 1.0f, 0.0f }));
+
+        dst.focal_length = (float)sample.getFocalLength();
+        dst.aperture = float2{
+            (float)sample.getHorizontalAperture(),
+            (float)sample.getVerticalAperture()
+        } *10.0f; // cm to mm
+        dst.lens_shift = float2{
+            (float)(sample.getHorizontalFilmOffset() / sample.getHorizontalAperture()),
+            (float)(sample.getVerticalFilmOffset() / sample.getVerticalAperture())
+        };
+
+        dst.near_plane = std::max((float)sample.getNearClippingPlane(), 0.01f);
+        dst.far_plane = std::max((float)sample.getFarClippingPlane(), dst.near_plane);
+        dst_cameras->push_back(dst);
+    }
+}
+
+void SceneABC::applyCameras(const Frame& frame)
+{
+    for (auto& src : frame.cameras) {
+        auto& dst = *src.dst;
+        dst.m_position = src.position;
+        dst.m_direction = src.direction;
+        dst.m_up = src.up;
+        dst.m_focal_length = src.focal_length;
+        dst.m_aperture = src.aperture;
+        dst.m_lens_shift = src.lens_shift;
+        dst.m_near = src.near_plane;
+        dst.m_far = src.far_plane;
+    }
+}
+
+void SceneABC::evaluatePositions(EvalState& state, double time, FrameData& dst) const
+{
+    auto ss = Abc::ISampleSelector(time);
+    size_t num_geom = m_geom.size();
+    state.positions.resize(num_geom);
+    state.offsets.resize(num_geom);
+
+    // only positions are read. topology and the other attributes are left to seek().
+    parallel_for_blocked(0, (int)num_geom, 64, [&](int first, int last) {
+        for (int gi = first; gi < last; ++gi) {
+            auto& geom = m_geom[gi];
+            auto& node = m_nodes[geom.node];
+            auto& positions = state.positions[gi];
+            positions.reset();
+            if (geom.instance >= 0 || !m_node_needed[geom.node] || state.visibility[geom.node] == AbcGeom::kVisibilityHidden)
+                continue;
+            if (node.type == NodeType::PolyMesh)
+                node.polymesh.getPositionsProperty().get(positions, ss);
+            else
+                node.points.getPositionsProperty().get(positions, ss);
+        }
+    });
+
+    // same order as decodeGeometry()
+    size_t num_points = 0;
+    size_t num_particles = 0;
+    for (size_t gi = 0; gi < num_geom; ++gi) {
+        auto& positions = state.positions[gi];
+        size_t n = positions ? positions->size() : 0;
+        auto& total = m_nodes[m_geom[gi].node].type == NodeType::PolyMesh ? num_points : num_particles;
+        state.offsets[gi] = total;
+        total += n;
+    }
+
+    dst.time = time;
+    dst.points.resize(num_points);
+    dst.particles.resize(num_particles);
+    parallel_for_blocked(0, (int)num_geom, 16, [&](int first, int last) {
+        for (int gi = first; gi < last; ++gi) {
+            auto src = make_span(state.positions[gi]);
+            if (src.empty())
+                continue;
+            int ni = m_geom[gi].node;
+            auto& matrix = state.global_matrices[ni];
+            auto& points = m_nodes[ni].type == NodeType::PolyMesh ? dst.points : dst.particles;
+            float3* dst_points = points.data() + state.offsets[gi];
+            for (size_t i = 0; i < src.size(); ++i)
+                dst_points[i] = mul_p(matrix, (float3&)src[i]);
+        }
+    });
+}
+
+SceneABC::GeomSize& SceneABC::GeomSize::operator+=(const GeomSize& v)
+{
+    points += v.points;
+    points_ex += v.points_ex;
+    counts += v.counts;
+    face_indices += v.face_indices;
+    wireframe_indices += v.wireframe_indices;
+    lod_indices += v.lod_indices;
+    cluster_points += v.cluster_points;
+    cluster_indices += v.cluster_indices;
+    clusters += v.clusters;
+    particles += v.particles;
+    return *this;
+}
+
+void SceneABC::updateBounds(double time)
+{
+    // self bounds are a single small sample per object. much cheaper to read than positions.
+    auto ss = Abc::ISampleSelector(time);
+    parallel_for_blocked(0, (int)m_geom.size(), 256, [&](int first, int last) {
+        for (int gi = first; gi < last; ++gi) {
+            auto& geom = m_geom[gi];
+            int ni = geom.node;
+            geom.active = m_node_needed[ni] && m_eval.visibility[ni] != AbcGeom::kVisibilityHidden;
+            geom.has_bounds = false;
+            if (!geom.active)
+                continue;
+
+            geom.matrix = m_eval.global_matrices[ni];
+            auto& prop = m_nodes[ni].self_bounds;
+            if (prop.valid()) {
+                auto box = prop.getValue(ss);
+                if (!box.isEmpty()) {
+                    geom.bounds_min = float3{ (float)box.min.x, (float)box.min.y, (float)box.min.z };
+                    geom.bounds_max = float3{ (float)box.max.x, (float)box.max.y, (float)box.max.z };
+                    geom.has_bounds = true;
+                }
+            }
+        }
+    });
+}
+
+template<class State>
+void SceneABC::cullObjects(std::vector<State>& geom, const View& view)
+{
+    parallel_for_blocked(0, (int)geom.size(), 256, [&](int first, int last) {
+        for (int gi = first; gi < last; ++gi) {
+            auto& g = geom[gi];
+            // objects without bounds are never culled
+            g.in_frustum = !view.has_frustum || !g.active || !g.has_bounds ||
+                IsInFrustum(g.matrix * view.view_proj, g.bounds_min, g.bounds_max);
+        }
+    });
+}
+
+void SceneABC::evaluateGeometry(double time, const View& view, Frame& dst)
+{
+    cullObjects(m_geom, view);
+    dst.mesh->clear();
+    dst.points->clear();
+    decodeGeometry(0, m_geom.size(), time, *dst.mesh, *dst.points);
+
+    // sorting changes the order of points. per object ranges of points are not valid after this.
+    if (m_settings.points_budget > 0)
+        dst.points_lod.build(dst.points->m_points);
+    else
+        dst.points_lod.clear();
+    copyGeomState(dst);
+}
+
+void SceneABC::copyGeomState(Frame& dst) const
+{
+    size_t num_geom = m_geom.size();
+    dst.geom.assign(m_geom.begin(), m_geom.end());
+    dst.lods.clear();
+    dst.lod_offsets.resize(num_geom + 1);
+    for (size_t gi = 0; gi < num_geom; ++gi) {
+        dst.lod_offsets[gi] = (int)dst.lods.size();
+        for (auto& level : m_geom[gi].lods)
+            dst.lods.push_back({ level.indices.size(), level.num_triangle_indices, level.cell_size });
+    }
+    dst.lod_offsets[num_geom] = (int)dst.lods.size();
+}
+
+void SceneABC::commitFrame(Frame& dst)
+{
+    dst.time = m_time;
+    dst.eval_done = m_eval_done;
+    dst.global_matrices = m_eval.global_matrices;
+    dst.node_needed = m_node_needed;
+}
+
+void SceneABC::updateDrawLists(Frame& frame)
+{
+    auto& mesh = *frame.mesh;
+    auto& points = *frame.points;
+    mesh.m_draw_ranges.clear();
+    mesh.m_visible_clusters.clear();
+    points.m_draw_ranges.clear();
+    // sorted points are drawn by the ranges of the hierarchy instead of per object ones
+    bool points_lod = !frame.points_lod.empty();
+    mesh.m_has_draw_ranges = m_view.has_frustum || m_settings.lod_levels > 0;
+    points.m_has_draw_ranges = m_view.has_frustum || (points_lod && m_view.has_view);
+
+    if (mesh.m_has_draw_ranges || points.m_has_draw_ranges) {
+        for (size_t gi = 0; gi < frame.geom.size(); ++gi) {
+            auto& state = frame.geom[gi];
+            if (!state.decoded || !state.in_frustum)
+                continue;
+
+            bool is_mesh = m_nodes[state.node].type == NodeType::PolyMesh;
+            if (!is_mesh && points_lod)
+                continue;
+            DrawRange r;
+            r.points_ex_offset = (int)state.offset.points_ex;
+            r.points_ex_count = (int)state.size.points_ex;
+            r.wireframe_offset = (int)state.offset.wireframe_indices;
+            r.wireframe_count = (int)state.size.wireframe_indices;
+            r.points_offset = (int)(is_mesh ? state.offset.points : state.offset.particles);
+            r.points_count = (int)(is_mesh ? state.size.points : state.size.particles);
+            r.lod_offset = r.lod_wireframe_offset = (int)state.offset.lod_indices;
+
+            span<LODState> lods{ frame.lods.data() + frame.lod_offsets[gi], (size_t)(frame.lod_offsets[gi + 1] - frame.lod_offsets[gi]) };
+            int lod = is_mesh ? selectLOD(lods, state) : 0;
+            if (lod > 0) {
+                for (int li = 0; li < lod - 1; ++li)
+                    r.lod_offset += (int)lods[li].num_indices;
+                auto& level = lods[lod - 1];
+                r.lod_count = (int)level.num_triangle_indices;
+                r.lod_wireframe_offset = r.lod_offset + r.lod_count;
+                r.lod_wireframe_count = (int)(level.num_indices - level.num_triangle_indices);
+                r.points_ex_count = 0;
+                r.wireframe_count = 0;
+            }
+            else if (state.size.clusters > 0) {
+                int first = (int)state.offset.clusters;
+                int last = first + (int)state.size.clusters;
+                for (int ci = first; ci < last; ++ci) {
+                    auto& cluster = mesh.m_clusters[ci];
+                    if (!m_view.has_frustum || IsInFrustum(m_view.view_proj, cluster.bmin, cluster.bmax))
+                        mesh.m_visible_clusters.push_back(ci);
+                }
+            }
+
+            // objects are laid out in order. merge with the previous range if nothing is culled between them.
+            auto& dst = is_mesh ? mesh.m_draw_ranges : points.m_draw_ranges;
+            if (!dst.empty()) {
+                auto& last = dst.back();
+                if (last.points_ex_offset + last.points_ex_count == r.points_ex_offset &&
+                    last.wireframe_offset + last.wireframe_count == r.wireframe_offset &&
+                    last.points_offset + last.points_count == r.points_offset &&
+                    last.lod_offset + last.lod_count == r.lod_offset &&
+                    last.lod_wireframe_offset + last.lod_wireframe_count == r.lod_wireframe_offset)
+                {
+                    last.points_ex_count += r.points_ex_count;
+                    last.wireframe_count += r.wireframe_count;
+                    last.points_count += r.points_count;
+                    last.lod_count += r.lod_count;
+                    last.lod_wireframe_count += r.lod_wireframe_count;
+                    continue;
+                }
+            }
+            dst.push_back(r);
+        }
+    }
+
+    if (points_lod && m_view.has_view)
+        frame.points_lod.select(m_view.view_proj, m_view.screen_size, m_settings.points_budget, m_settings.points_density, points.m_draw_ranges);
+
+    if (frame.geom.size() != m_geom.size())
+        return; // geometry is not evaluated yet
+    for (auto& inst : m_instances) {
+        if (!inst.mesh)
+            continue;
+        auto& matrices = inst.mesh->m_instance_matrices;
+        matrices.clear();
+        for (int gi : inst.geom) {
+            auto& state = frame.geom[gi];
+            if (state.active && state.in_frustum)
+                matrices.push_back(state.matrix);
+        }
+    }
+}
+
+int SceneABC::selectLOD(span<LODState> lods, const GeomState& state) const
+{
+    if (lods.empty() || !m_view.has_view || !state.has_bounds)
+        return 0;
+
+    // projected size of the bounds in pixels
+    float4x4 mvp = state.matrix * m_view.view_proj;
+    const float inf = std::numeric_limits<float>::infinity();
+    float2 smin{ inf, inf };
+    float2 smax{ -inf, -inf };
+    for (int i = 0; i < 8; ++i) {
+        float3 p{
+            (i & 1) ? state.bounds_max.x : state.bounds_min.x,
+            (i & 2) ? state.bounds_max.y : state.bounds_min.y,
+            (i & 4) ? state.bounds_max.z : state.bounds_min.z,
+        };
+        float4 c = mul4(mvp, p);
+        if (c.w <= 0.0f)
+            return 0; // crosses the camera plane
+        float2 s{ c.x / c.w, c.y / c.w };
+        smin = min(smin, s);
+        smax = max(smax, s);
+    }
+    float2 pixels = (smax - smin) * 0.5f * m_view.screen_size;
+    float3 extent = state.bounds_max - state.bounds_min;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    if (size <= 0.0f)
+        return 0;
+
+    // coarsest level whose cells are smaller than lod_pixel_error on screen
+    float pixels_per_unit = std::max(pixels.x, pixels.y) / size;
+    int ret = 0;
+    for (size_t li = 0; li < lods.size(); ++li) {
+        if (lods[li].cell_size * pixels_per_unit <= m_settings.lod_pixel_error)
+            ret = (int)li + 1;
+    }
+    return ret;
+}
+
+void SceneABC::uploadFrame(Frame& frame)
+{
+    // if clusters are laid out as in the last upload of this frame's mesh, only objects whose points may have changed are uploaded
+    auto& mesh = *frame.mesh;
+    auto& layout = frame.cluster_layout_tmp;
+    layout.clear();
+    for (int gi = 0; gi < (int)frame.geom.size(); ++gi) {
+        if (frame.geom[gi].decoded && frame.geom[gi].size.clusters > 0)
+            layout.push_back(gi);
+    }
+    mesh.m_cluster_dirty_ranges.clear();
+    bool quantized = !mesh.m_cluster_points_q.empty();
+    mesh.m_cluster_layout_dirty = layout != frame.cluster_layout || quantized != frame.cluster_quantized;
+    frame.cluster_matrices.resize(frame.geom.size());
+    for (int gi : layout) {
+        auto& state = frame.geom[gi];
+        auto& last_matrix = frame.cluster_matrices[gi];
+        if (!mesh.m_cluster_layout_dirty && state.constant_points && state.matrix == last_matrix)
+            continue;
+        last_matrix = state.matrix;
+
+        int2 r{ (int)state.offset.cluster_points, (int)state.size.cluster_points };
+        auto& dirty = mesh.m_cluster_dirty_ranges;
+        if (!dirty.empty() && dirty.back().x + dirty.back().y == r.x)
+            dirty.back().y += r.y;
+        else
+            dirty.push_back(r);
+    }
+    frame.cluster_layout.swap(layout);
+    frame.cluster_quantized = quantized;
+
+    frame.mesh->upload();
+    frame.points->upload();
+}
+
+bool SceneABC::isMonoGeometry(const GeomState& state) const
+{
+    return state.instance < 0 && state.active && (!m_settings.cull_decode || state.in_frustum);
+}
+
+void SceneABC::readGeometry(GeomData& dst, double time)
+{
+    auto& node = m_nodes[dst.node];
+    auto ss = Abc::ISampleSelector(time);
+
+    dst.size = {};
+    dst.interpolated = false;
+    if (m_settings.interpolate_samples) {
+        readInterpolated(dst, time);
+    }
+    else if (dst.sample_cache[0].index >= 0 || dst.sample_cache[1].index >= 0) {
+        dst.sample_cache[0] = {};
+        dst.sample_cache[1] = {};
+    }
+
+    if (node.type == NodeType::PolyMesh) {
+        if (!m_settings.interpolate_samples)
+            node.polymesh.get(dst.mesh_sample, ss);
+        auto counts = make_span(dst.mesh_sample.getFaceCounts());
+
+        // count primitives
         int num_lines = 0;
         int num_triangles = 0;
         for (int c : counts) {
@@ -338,67 +1778,336 @@ void SceneABC::seekImpl(ImportContext ctx)
             }
         }
 
+        dst.size.points = make_span(dst.mesh_sample.getPositions()).size();
+        dst.size.points_ex = num_triangles * 3;
+        dst.size.counts = counts.size();
+        dst.size.face_indices = make_span(dst.mesh_sample.getFaceIndices()).size();
+        dst.size.wireframe_indices = num_lines * 2;
+
+        if (!dst.lod_built && dst.instance < 0 && m_settings.lod_levels > 0) {
+            // build once. the levels stay valid as long as the topology doesn't change.
+            dst.lod_built = true;
+            if (num_triangles >= m_settings.lod_min_triangles && node.polymesh.getTopologyVariance() != AbcGeom::kHeterogenousTopology) {
+                auto points = make_span(dst.mesh_sample.getPositions());
+                BuildMeshLODs({ (float3*)points.data(), points.size() }, counts, make_span(dst.mesh_sample.getFaceIndices()),
+                    m_settings.lod_levels, dst.lods);
+            }
+        }
+        for (auto& level : dst.lods)
+            dst.size.lod_indices += level.indices.size();
+
+        if (!dst.cluster_built && dst.instance < 0 && m_settings.mesh_clusters) {
+            dst.cluster_built = true;
+            if (node.polymesh.getTopologyVariance() != AbcGeom::kHeterogenousTopology) {
+                auto points = make_span(dst.mesh_sample.getPositions());
+                BuildMeshClusters({ (float3*)points.data(), points.size() }, counts, make_span(dst.mesh_sample.getFaceIndices()),
+                    m_settings.cluster_triangles, dst.clusters, dst.cluster_vertex_map, dst.cluster_indices);
+                dst.constant_points = node.polymesh.getPositionsProperty().isConstant();
+            }
+        }
+        if (m_settings.mesh_clusters && !dst.clusters.empty()) {
+            // faces are drawn from the clusters
+            dst.size.points_ex = 0;
+            dst.size.cluster_points = dst.cluster_vertex_map.size();
+            dst.size.cluster_indices = dst.cluster_indices.size();
+            dst.size.clusters = dst.clusters.size();
+        }
+    }
+    else if (node.type == NodeType::Points) {
+        if (!m_settings.interpolate_samples)
+            node.points.get(dst.points_sample, ss);
+        dst.size.particles = make_span(dst.points_sample.getPositions()).size();
+    }
+}
 
-        const float3* src_points = dst_points;
-        const int* src_indices = indices.data();
-        int* dst_counts = expand(m_mono_mesh->m_counts, num_faces);
-        int* dst_findices = expand(m_mono_mesh->m_face_indices, num_indices);
-        int* dst_windices = expand(m_mono_mesh->m_wireframe_indices, num_lines * 2);
-        float3* dst_points_ex = expand(m_mono_mesh->m_points_ex, num_triangles * 3);
+void SceneABC::readInterpolated(GeomData& dst, double time)
+{
+    auto& node = m_nodes[dst.node];
+    bool is_mesh = node.type == NodeType::PolyMesh;
+    auto ts = is_mesh ? node.polymesh.getTimeSampling() : node.points.getTimeSampling();
+    size_t num_samples = is_mesh ? node.polymesh.getNumSamples() : node.points.getNumSamples();
+    auto floor = ts->getFloorIndex(time, num_samples);
+    auto ceil = ts->getCeilIndex(time, num_samples);
+
+    // a sample is read into the slot that doesn't hold the other one needed
+    auto fetch = [&](Abc::index_t index, Abc::index_t keep) -> GeomData::CachedSample& {
+        for (auto& c : dst.sample_cache) {
+            if (c.index == index)
+                return c;
+        }
+        auto& c = dst.sample_cache[0].index != keep ? dst.sample_cache[0] : dst.sample_cache[1];
+        c.index = index;
+        auto ss = Abc::ISampleSelector(index);
+        if (is_mesh)
+            node.polymesh.get(c.mesh, ss);
+        else
+            node.points.get(c.points, ss);
+        return c;
+    };
+    auto& s0 = fetch(floor.first, ceil.first);
+    dst.mesh_sample = s0.mesh;
+    dst.points_sample = s0.points;
 
-        // setup indices & vertices
+    // at a sample, or outside of the sampled range
+    double dt = time - floor.second;
+    if (dt <= 0.0 || floor.first == ceil.first)
+        return;
 
-        for (int i = 0; i < num_faces; ++i)
-            dst_counts[i] = counts[i];
+    auto positions = make_span(is_mesh ? s0.mesh.getPositions() : s0.points.getPositions());
+    auto velocities = make_span(is_mesh ? s0.mesh.getVelocities() : s0.points.getVelocities());
+    auto& dst_points = dst.interpolated_points;
+    size_t num_points = positions.size();
+    if (!velocities.empty() && velocities.size() == num_points) {
+        // velocities are per second. one sample is enough and the topology may change.
+        float t = (float)dt;
+        dst_points.resize(num_points);
+        for (size_t i = 0; i < num_points; ++i)
+            dst_points[i] = (float3&)positions[i] + (float3&)velocities[i] * t;
+        dst.interpolated = true;
+    }
+    else if (is_mesh && node.polymesh.getTopologyVariance() != AbcGeom::kHeterogenousTopology) {
+        // points may be reordered between samples, so only meshes are blended
+        auto& s1 = fetch(ceil.first, floor.first);
+        auto next = make_span(s1.mesh.getPositions());
+        if (next.size() != num_points)
+            return;
+        float t = (float)(dt / (ceil.second - floor.second));
+        dst_points.resize(num_points);
+        for (size_t i = 0; i < num_points; ++i)
+            dst_points[i] = lerp((float3&)positions[i], (float3&)next[i], t);
+        dst.interpolated = true;
+    }
+}
 
-        for (int i = 0; i < num_indices; ++i)
-            dst_findices[i] = src_indices[i] + index_offset;
+void SceneABC::writeMesh(const GeomData& src, const float4x4& matrix, Mesh& dst_mesh)
+{
+    auto& ofs = src.offset;
+    auto counts = make_span(src.mesh_sample.getFaceCounts());
+    auto indices = make_span(src.mesh_sample.getFaceIndices());
+    auto positions = make_span(src.mesh_sample.getPositions());
+    const float3* points = src.interpolated ? src.interpolated_points.data() : (const float3*)positions.data();
+
+    // make points in the space of matrix
+    int num_faces = (int)counts.size();
+    int num_indices = (int)indices.size();
+    int num_points = (int)positions.size();
+    int index_offset = (int)ofs.points;
+    float3* dst_points = dst_mesh.m_points.data() + ofs.points;
+    for (int i = 0; i < num_points; ++i)
+        dst_points[i] = mul_p(matrix, points[i]);
+
+    const float3* src_points = dst_points;
+    const int* src_indices = indices.data();
+    int* dst_counts = dst_mesh.m_counts.data() + ofs.counts;
+    int* dst_findices = dst_mesh.m_face_indices.data() + ofs.face_indices;
+    int* dst_windices = dst_mesh.m_wireframe_indices.data() + ofs.wireframe_indices;
+    float3* dst_points_ex = dst_mesh.m_points_ex.data() + ofs.points_ex;
+    int* dst_lindices = dst_mesh.m_lod_indices.data() + ofs.lod_indices;
+
+    for (auto& level : src.lods) {
+        for (int i : level.indices)
+            *dst_lindices++ = i + index_offset;
+    }
 
-        for (int c : counts) {
-            if (c == 2) {
-                // add wire frame indices
-                *dst_windices++ = src_indices[0] + index_offset;
-                *dst_windices++ = src_indices[1] + index_offset;
-            }
-            else if (c > 2) {
-                // add wire frame indices
-                for (int fi = 0; fi < c; ++fi) {
-                    *dst_windices++ = src_indices[fi] + index_offset;
-                    *dst_windices++ = (fi == c - 1 ? src_indices[0] : src_indices[fi + 1]) + index_offset;
-                }
+    // cluster indices are local. cluster vertices are gathered by decodeGeometry().
+    bool clustered = src.size.clusters > 0;
+    if (clustered)
+        std::copy(src.cluster_indices.begin(), src.cluster_indices.end(), dst_mesh.m_cluster_indices.data() + ofs.cluster_indices);
 
-                // add triangle vertices
-                // todo: handle flip faces option
-                for (int fi = 0; fi < c - 2; ++fi) {
-                    int i0 = src_indices[0];
-                    int i1 = src_indices[1 + fi];
-                    int i2 = src_indices[2 + fi];
-                    *dst_points_ex++ = src_points[i0];
-                    *dst_points_ex++ = src_points[i1];
-                    *dst_points_ex++ = src_points[i2];
-                }
+    // setup indices & vertices
+
+    for (int i = 0; i < num_faces; ++i)
+        dst_counts[i] = counts[i];
+
+    for (int i = 0; i < num_indices; ++i)
+        dst_findices[i] = src_indices[i] + index_offset;
+
+    for (int c : counts) {
+        if (c == 2) {
+            // add wire frame indices
+            *dst_windices++ = src_indices[0] + index_offset;
+            *dst_windices++ = src_indices[1] + index_offset;
+        }
+        else if (c > 2) {
+            // add wire frame indices
+            for (int fi = 0; fi < c; ++fi) {
+                *dst_windices++ = src_indices[fi] + index_offset;
+                *dst_windices++ = (fi == c - 1 ? src_indices[0] : src_indices[fi + 1]) + index_offset;
+            }
+
+            // add triangle vertices
+            // todo: handle flip faces option
+            for (int fi = 0; fi < c - 2 && !clustered; ++fi) {
+                int i0 = src_indices[0];
+                int i1 = src_indices[1 + fi];
+                int i2 = src_indices[2 + fi];
+                *dst_points_ex++ = src_points[i0];
+                *dst_points_ex++ = src_points[i1];
+                *dst_points_ex++ = src_points[i2];
             }
-            src_indices += c;
         }
+        src_indices += c;
     }
-    else if (AbcGeom::IPointsSchema::matches(metadata)) {
-        auto schema = AbcGeom::IPoints(obj).getSchema();
+}
 
-        AbcGeom::IPointsSchema::Sample sample;
-        schema.get(sample, ss);
+void SceneABC::writePoints(const GeomData& src, const float4x4& matrix, Points& dst)
+{
+    auto positions = make_span(src.points_sample.getPositions());
+    const float3* points_orig = src.interpolated ? src.interpolated_points.data() : (const float3*)positions.data();
+    size_t num_points = positions.size();
 
-        auto points_orig = make_span(sample.getPositions());
-        size_t num_points = points_orig.size();
+    float3* points = dst.m_points.data() + src.offset.particles;
+    for (size_t i = 0; i < num_points; ++i)
+        points[i] = mul_p(matrix, points_orig[i]);
+}
 
-        float3* points = expand(m_mono_points->m_points, num_points);
-        for (size_t i = 0; i < num_points; ++i)
-            points[i] = mul_p(ctx.global_matrix, (float3&)points_orig[i]);
+void SceneABC::decodeGeometry(size_t begin, size_t end, double time, Mesh& dst_mesh, Points& dst_points)
+{
+    m_arena.reset();
+
+    // read samples in parallel. then allocate space for all of them and write in parallel.
+    parallel_for((int)begin, (int)end, [&](int gi) {
+        auto& geom = m_geom[gi];
+        geom.decoded = isMonoGeometry(geom);
+        if (geom.decoded)
+            readGeometry(geom, time);
+        else
+            geom.size = {};
+    });
+
+    GeomSize pos;
+    pos.points = dst_mesh.m_points.size();
+    pos.points_ex = dst_mesh.m_points_ex.size();
+    pos.counts = dst_mesh.m_counts.size();
+    pos.face_indices = dst_mesh.m_face_indices.size();
+    pos.wireframe_indices = dst_mesh.m_wireframe_indices.size();
+    pos.lod_indices = dst_mesh.m_lod_indices.size();
+    bool quantize = m_settings.quantize_points;
+    pos.cluster_points = quantize ? dst_mesh.m_cluster_points_q.size() / 3 : dst_mesh.m_cluster_points.size();
+    pos.cluster_indices = dst_mesh.m_cluster_indices.size();
+    pos.clusters = dst_mesh.m_clusters.size();
+    pos.particles = dst_points.m_points.size();
+    size_t first_cluster = pos.clusters;
+    for (size_t gi = begin; gi < end; ++gi) {
+        m_geom[gi].offset = pos;
+        pos += m_geom[gi].size;
     }
+    dst_mesh.m_points.resize(pos.points);
+    dst_mesh.m_points_ex.resize(pos.points_ex);
+    dst_mesh.m_counts.resize(pos.counts);
+    dst_mesh.m_face_indices.resize(pos.face_indices);
+    dst_mesh.m_wireframe_indices.resize(pos.wireframe_indices);
+    dst_mesh.m_lod_indices.resize(pos.lod_indices);
+    if (quantize)
+        dst_mesh.m_cluster_points_q.resize(pos.cluster_points * 3);
+    else
+        dst_mesh.m_cluster_points.resize(pos.cluster_points);
+    dst_mesh.m_cluster_indices.resize(pos.cluster_indices);
+    dst_mesh.m_clusters.resize(pos.clusters);
+    dst_points.m_points.resize(pos.particles);
+
+    m_cluster_geom.resize(pos.clusters);
+    for (size_t gi = begin; gi < end; ++gi) {
+        auto& geom = m_geom[gi];
+        std::fill_n(m_cluster_geom.data() + geom.offset.clusters, geom.size.clusters, (int)gi);
+    }
+
+    parallel_for((int)begin, (int)end, [&](int gi) {
+        auto& geom = m_geom[gi];
+        if (geom.decoded) {
+            if (m_nodes[geom.node].type == NodeType::PolyMesh)
+                writeMesh(geom, geom.matrix, dst_mesh);
+            else
+                writePoints(geom, geom.matrix, dst_points);
+        }
+        // release sample data
+        geom.mesh_sample = {};
+        geom.points_sample = {};
+    });
+
+    // gather cluster vertices from the points written above. clusters are finer work units than objects,
+    // so a single large mesh is spread over all threads.
+    // quantized points are gathered into a scratch buffer first, as they need the cluster's bounds.
+    parallel_for_blocked((int)first_cluster, (int)pos.clusters, 64, [&](int first, int last) {
+        const float inf = std::numeric_limits<float>::infinity();
+        float3* scratch = nullptr;
+        if (quantize) {
+            int max_vertices = 0;
+            for (int ci = first; ci < last; ++ci) {
+                auto& geom = m_geom[m_cluster_geom[ci]];
+                max_vertices = std::max(max_vertices, geom.clusters[ci - geom.offset.clusters].vertex_count);
+            }
+            scratch = m_arena.allocate<float3>(max_vertices);
+        }
+        for (int ci = first; ci < last; ++ci) {
+            auto& geom = m_geom[m_cluster_geom[ci]];
+            auto& src = geom.clusters[ci - geom.offset.clusters];
+            auto& dst = dst_mesh.m_clusters[ci];
+            dst.vertex_offset = (int)geom.offset.cluster_points + src.vertex_offset;
+            dst.vertex_count = src.vertex_count;
+            dst.index_offset = (int)geom.offset.cluster_indices + src.index_offset;
+            dst.index_count = src.index_count;
+
+            const float3* src_points = dst_mesh.m_points.data() + geom.offset.points;
+            const int* vertex_map = geom.cluster_vertex_map.data() + src.vertex_offset;
+            float3* dst_points = quantize ? scratch : dst_mesh.m_cluster_points.data() + dst.vertex_offset;
+            float3 bmin{ inf, inf, inf };
+            float3 bmax{ -inf, -inf, -inf };
+            for (int vi = 0; vi < src.vertex_count; ++vi) {
+                float3 p = src_points[vertex_map[vi]];
+                dst_points[vi] = p;
+                bmin = min(bmin, p);
+                bmax = max(bmax, p);
+            }
+            dst.bmin = bmin;
+            dst.bmax = bmax;
 
-    size_t n = obj.getNumChildren();
-    for (size_t ci = 0; ci < n; ++ci) {
-        ctx.obj = obj.getChild(ci);
-        seekImpl(ctx);
+            if (quantize) {
+                QuantizePoints(dst_points, src.vertex_count, (bmin + bmax) * 0.5f, (bmax - bmin) * 0.5f,
+                    dst_mesh.m_cluster_points_q.data() + (size_t)dst.vertex_offset * 3);
+            }
+        }
+    });
+}
+
+void SceneABC::decodeInstances(const Frame& frame)
+{
+    if (frame.geom.size() != m_geom.size())
+        return; // geometry is not evaluated yet
+
+    double time = frame.time;
+    parallel_for(0, (int)m_instances.size(), [&](int ii) {
+        auto& inst = m_instances[ii];
+        if (!inst.mesh)
+            return;
+
+        bool active = std::any_of(inst.geom.begin(), inst.geom.end(), [&](int gi) { return frame.geom[gi].active; });
+        if ((inst.constant && inst.decoded) || !active)
+            return;
+
+        auto& mesh = *inst.mesh;
+        auto& data = inst.data;
+        readGeometry(data, time);
+        mesh.clear();
+        mesh.m_points.resize(data.size.points);
+        mesh.m_points_ex.resize(data.size.points_ex);
+        mesh.m_counts.resize(data.size.counts);
+        mesh.m_face_indices.resize(data.size.face_indices);
+        mesh.m_wireframe_indices.resize(data.size.wireframe_indices);
+        mesh.m_lod_indices.resize(data.size.lod_indices);
+        data.offset = {};
+        writeMesh(data, float4x4::identity(), mesh);
+        data.mesh_sample = {};
+        inst.decoded = true;
+        inst.dirty = true;
+    });
+
+    // GL calls stay on this thread
+    for (auto& inst : m_instances) {
+        if (inst.dirty) {
+            inst.mesh->upload();
+            inst.dirty = false;
+        }
     }
 }
 
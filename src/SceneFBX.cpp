@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "SceneGraph.h"
 #include "SmallFBX.h"
+#include "Parallel.h"
 
 namespace wabc {
 
@@ -9,48 +10,162 @@ using sfbx::as;
 class SceneFBX : public IScene
 {
 public:
-    struct ImportContext
+    // positions in the arrays of Mesh
+    struct MeshOffsets
     {
-        sfbx::Object* obj;
-        double time = 0.0;
+        size_t points{};
+        size_t points_ex{};
+        size_t counts{};
+        size_t face_indices{};
+        size_t wireframe_indices{};
     };
 
     struct MeshData
     {
         sfbx::GeomMesh* mesh_fbx{};
+        float4x4 global_matrix = float4x4::identity();
         RawVector<int> indices_tri;
-        size_t points_offset{};
-        size_t pointsex_offset{};
+        MeshOffsets offsets;
+        int node = -1; // index to m_nodes
+        bool selected = true; // at or under the eval paths
+        bool visible = true;
+        bool blendshape = false;
+        bool skinned = false;
     };
     using MeshDataPtr = std::shared_ptr<MeshData>;
 
+    // flattened hierarchy for baked animation. parents always precede their children.
+    struct NodeData
+    {
+        sfbx::Model* model{};
+        int parent = -1;
+        int track = -1; // index to the baked track. -1 if not animated
+    };
+
+    struct TRS
+    {
+        float3 t;
+        quatf r;
+        float3 s;
+    };
+
+    ~SceneFBX() override;
     void release() override;
 
+    void setSettings(const SceneSettings& v) override { m_settings = v; }
+    const SceneSettings& getSettings() const override { return m_settings; }
+
     bool load(const char* path) override;
     bool loadAdditive(const char* path) override;
     void unload() override;
 
+    bool loadAsync(const char* path) override;
+    void cancelLoad() override;
+    LoadProgress getLoadProgress() const override;
+    void update() override;
+
     std::tuple<double, double> getTimeRange() const override;
-    void seek(double time) override;
+    void seek(double time, EvalMask mask = EvalMask::All) override;
+    // FBX scenes are evaluated on the render thread
+    void seekAsync(double time) override { seek(time); }
+    bool hasPendingFrame() const override { return false; }
+    bool evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback) override;
+    void setEvalPaths(const std::vector<std::string>& paths) override;
+    bool getGlobalMatrix(const std::string& path, float4x4& dst) const override;
+    void cull(const float4x4& view_proj, float2 screen_size) override {} // FBX has no stored bounds to cull with
 
     double getTime() const override { return m_time; }
     IMesh* getMesh() override { return m_mono_mesh.get(); }
     IPoints* getPoints() override { return nullptr; }
-    span<ICamera*> getCameras() override { return make_span(m_cameras); }
+    span<IMesh*> getInstancedMeshes() override { return {}; }
+    // cameras are being added by the load job while loading
+    span<ICamera*> getCameras() override { return m_loading ? span<ICamera*>{} : make_span(m_cameras); }
 
 private:
-    // ctx is not a reference. that is intended.
-    void scanObjects(ImportContext ctx);
-    void applyDeform();
+    enum class LoadPhase
+    {
+        Parse,
+        Collect,
+        Bake,
+        BakeAnimation,
+        Done,
+    };
 
+    bool loadStep();
+    // collects cameras and meshes, and allocates space for the mesh. geometry is filled by bakeMesh().
+    // returns false if obj is excluded. its children should be skipped in that case.
+    bool scanObject(sfbx::Object* obj);
+    // writes to the region allocated by scanObject(). can be called in parallel for different meshes.
+    void bakeMesh(MeshData& data, Mesh& dst_mesh);
+    void applyDeform();
+    void updateCamera(Camera& dst, const float4x4& global_matrix);
+    void updateSelection();
+    // updates MeshData::visible. regions of meshes that become hidden are collapsed.
+    void updateVisibility();
+
+    // returns false if there is nothing to bake
+    bool setupAnimationBake();
+    // returns true while there are remaining frames
+    bool bakeAnimationStep();
+    // values of the properties that are not baked: camera parameters, global matrices of cameras without a node and visibility
+    void getUnbakedValues(std::vector<float>& dst);
+    void seekBaked(double time, EvalMask mask);
+    void deformBaked(int f0, int f1, float w);
+
+    SceneSettings m_settings;
     sfbx::DocumentPtr m_document;
 
     double m_time = -1.0;
+    EvalMask m_eval_done = EvalMask::None; // parts evaluated at m_time
     MeshPtr m_mono_mesh;
     std::vector<MeshDataPtr> m_mesh_data;
+    std::map<std::string, sfbx::Model*> m_model_table;
+
+    // partial evaluation
+    std::vector<std::string> m_eval_paths;
+    std::vector<bool> m_camera_selected; // per m_cameras
+    bool m_selection_valid = false;
 
     std::map<std::string, CameraPtr> m_camera_table;
     std::vector<ICamera*> m_cameras;
+
+    // baked animation
+    std::vector<NodeData> m_nodes;
+    std::map<sfbx::Model*, int> m_node_indices;
+    std::vector<int> m_camera_nodes; // node index of each m_cameras
+    std::vector<sfbx::BlendShapeChannel*> m_channels;
+    RawVector<float4x4> m_node_locals;  // [node]. used by non-animated nodes
+    RawVector<float4x4> m_node_globals; // [node]
+    RawVector<TRS> m_anim_tracks;       // [frame][track]
+    RawVector<float> m_anim_weights;    // [frame][channel]
+    int m_anim_num_tracks = 0;
+    int m_anim_num_frames = 0;
+    double m_anim_start = 0.0;
+    bool m_anim_baked = false;
+    bool m_anim_has_skin = false;
+    bool m_anim_has_unbaked = false;     // properties that are not baked are animated. seeks apply the animation for them.
+    std::vector<float> m_anim_unbaked;   // getUnbakedValues() of frame 0
+    std::vector<float> m_anim_unbaked_tmp;
+    int m_bake_pass = 0;
+    int m_bake_frame = 0;
+
+    // async load
+    LoadTask m_load_task;
+    LoadPhase m_load_phase = LoadPhase::Done;
+    std::string m_load_path;
+    std::vector<sfbx::Object*> m_load_stack;
+    MeshOffsets m_load_total;
+    size_t m_load_baked = 0; // number of m_mesh_data elements baked
+    std::mutex m_load_mutex;
+    MeshPtr m_load_mesh;
+    MeshOffsets m_load_ready; // baked part of m_load_mesh. guarded by m_load_mutex
+    bool m_load_dirty = false;
+    std::chrono::steady_clock::time_point m_load_last_sync;
+
+    bool m_loading = false; // render thread only
+    bool m_seek_requested = false;
+    double m_seek_request{};
+    EvalMask m_seek_request_mask = EvalMask::All;
 };
 
 template<class Cont> inline auto expand(Cont& v, size_t n)
@@ -61,15 +176,23 @@ template<class Cont> inline auto expand(Cont& v, size_t n)
 }
 
 
+SceneFBX::~SceneFBX()
+{
+    unload();
+}
+
 void SceneFBX::release()
 {
     delete this;
 }
 
-void SceneFBX::scanObjects(ImportContext ctx)
+bool SceneFBX::scanObject(sfbx::Object* obj)
 {
-    auto obj = ctx.obj;
     if (auto model = as<sfbx::Model>(obj)) {
+        auto path = model->getPath();
+        if (!m_settings.exclude_patterns.empty() && !IsPathIncluded(path, m_settings, false))
+            return false;
+        m_model_table[path] = model;
 
         if (auto cam = as<sfbx::Camera>(model)) {
             auto tmp = std::make_shared<Camera>();
@@ -84,27 +207,18 @@ void SceneFBX::scanObjects(ImportContext ctx)
         }
     }
     else if (auto mesh = as<sfbx::GeomMesh>(obj)) {
+        if (!m_settings.include_patterns.empty() && !IsPathIncluded(mesh->getModel()->getPath(), m_settings, true))
+            return true;
+
         auto tmp = std::make_shared<MeshData>();
         tmp->mesh_fbx = mesh;
-        tmp->points_offset = m_mono_mesh->m_points.size();
-        tmp->pointsex_offset = m_mono_mesh->m_points_ex.size();
+        // global matrices are cached on demand by sfbx. resolve here as bakeMesh() runs in parallel.
+        tmp->global_matrix = to<float4x4>(mesh->getModel()->getGlobalMatrix());
+        tmp->offsets = m_load_total;
         m_mesh_data.push_back(tmp);
 
-        auto global_matrix = mesh->getModel()->getGlobalMatrix();
+        // count primitives
         auto counts = mesh->getCounts();
-        auto indices = mesh->getIndices();
-        auto points = mesh->getPoints();
-
-        // make points in global space
-        int num_faces = (int)counts.size();
-        int num_indices = (int)indices.size();
-        int num_points = (int)points.size();
-        int index_offset = (int)m_mono_mesh->m_points.size();
-        float3* dst_points = expand(m_mono_mesh->m_points, num_points);
-        for (int i = 0; i < num_points; ++i)
-            dst_points[i] = mul_p((const float4x4&)global_matrix, (float3&)points[i]);
-
-        // count primitives and allocate space
         int num_lines = 0;
         int num_triangles = 0;
         for (int c : counts) {
@@ -116,114 +230,363 @@ void SceneFBX::scanObjects(ImportContext ctx)
                 num_lines += c;
             }
         }
+        tmp->indices_tri.resize(num_triangles * 3);
 
+        m_load_total.points += mesh->getPoints().size();
+        m_load_total.points_ex += num_triangles * 3;
+        m_load_total.counts += counts.size();
+        m_load_total.face_indices += mesh->getIndices().size();
+        m_load_total.wireframe_indices += num_lines * 2;
+    }
+    return true;
+}
 
-        const float3* src_points = dst_points;
-        const int* src_indices = indices.data();
-        int* dst_counts = expand(m_mono_mesh->m_counts, num_faces);
-        int* dst_findices = expand(m_mono_mesh->m_face_indices, num_indices);
-        int* dst_windices = expand(m_mono_mesh->m_wireframe_indices, num_lines * 2);
-        float3* dst_points_ex = expand(m_mono_mesh->m_points_ex, num_triangles * 3);
-        int* dst_indicex_ex = expand(tmp->indices_tri, num_triangles * 3);
-
-        // setup indices & vertices
-
-        for (int i = 0; i < num_faces; ++i)
-            dst_counts[i] = counts[i];
-
-        for (int i = 0; i < num_indices; ++i)
-            dst_findices[i] = src_indices[i] + index_offset;
-
-        for (int c : counts) {
-            if (c == 2) {
-                // add wire frame indices
-                *dst_windices++ = src_indices[0] + index_offset;
-                *dst_windices++ = src_indices[1] + index_offset;
+void SceneFBX::bakeMesh(MeshData& data, Mesh& dst_mesh)
+{
+    auto mesh = data.mesh_fbx;
+    auto& ofs = data.offsets;
+    auto counts = mesh->getCounts();
+    auto indices = mesh->getIndices();
+    auto points = mesh->getPoints();
+
+    // make points in global space
+    int num_faces = (int)counts.size();
+    int num_indices = (int)indices.size();
+    int num_points = (int)points.size();
+    int index_offset = (int)ofs.points;
+    float3* dst_points = dst_mesh.m_points.data() + ofs.points;
+    for (int i = 0; i < num_points; ++i)
+        dst_points[i] = mul_p(data.global_matrix, (float3&)points[i]);
+
+    const float3* src_points = dst_points;
+    const int* src_indices = indices.data();
+    int* dst_counts = dst_mesh.m_counts.data() + ofs.counts;
+    int* dst_findices = dst_mesh.m_face_indices.data() + ofs.face_indices;
+    int* dst_windices = dst_mesh.m_wireframe_indices.data() + ofs.wireframe_indices;
+    float3* dst_points_ex = dst_mesh.m_points_ex.data() + ofs.points_ex;
+    int* dst_indicex_ex = data.indices_tri.data();
+
+    // setup indices & vertices
+
+    for (int i = 0; i < num_faces; ++i)
+        dst_counts[i] = counts[i];
+
+    for (int i = 0; i < num_indices; ++i)
+        dst_findices[i] = src_indices[i] + index_offset;
+
+    for (int c : counts) {
+        if (c == 2) {
+            // add wire frame indices
+            *dst_windices++ = src_indices[0] + index_offset;
+            *dst_windices++ = src_indices[1] + index_offset;
+        }
+        else if (c > 2) {
+            // add wire frame indices
+            for (int fi = 0; fi < c; ++fi) {
+                *dst_windices++ = src_indices[fi] + index_offset;
+                *dst_windices++ = (fi == c - 1 ? src_indices[0] : src_indices[fi + 1]) + index_offset;
             }
-            else if (c > 2) {
-                // add wire frame indices
-                for (int fi = 0; fi < c; ++fi) {
-                    *dst_windices++ = src_indices[fi] + index_offset;
-                    *dst_windices++ = (fi == c - 1 ? src_indices[0] : src_indices[fi + 1]) + index_offset;
-                }
-
-                // add triangle vertices
-                // todo: handle flip faces option
-                for (int fi = 0; fi < c - 2; ++fi) {
-                    int i0 = src_indices[0];
-                    int i1 = src_indices[1 + fi];
-                    int i2 = src_indices[2 + fi];
-                    *dst_indicex_ex++ = i0;
-                    *dst_indicex_ex++ = i1;
-                    *dst_indicex_ex++ = i2;
-                    *dst_points_ex++ = src_points[i0];
-                    *dst_points_ex++ = src_points[i1];
-                    *dst_points_ex++ = src_points[i2];
-                }
+
+            // add triangle vertices
+            // todo: handle flip faces option
+            for (int fi = 0; fi < c - 2; ++fi) {
+                int i0 = src_indices[0];
+                int i1 = src_indices[1 + fi];
+                int i2 = src_indices[2 + fi];
+                *dst_indicex_ex++ = i0;
+                *dst_indicex_ex++ = i1;
+                *dst_indicex_ex++ = i2;
+                *dst_points_ex++ = src_points[i0];
+                *dst_points_ex++ = src_points[i1];
+                *dst_points_ex++ = src_points[i2];
             }
-            src_indices += c;
         }
+        src_indices += c;
     }
+}
 
-    for (auto child : obj->getChildren()) {
-        ctx.obj = child;
-        scanObjects(ctx);
-    }
+static void ResizeMesh(Mesh& dst, const SceneFBX::MeshOffsets& size)
+{
+    dst.m_points.resize(size.points);
+    dst.m_points_ex.resize(size.points_ex);
+    dst.m_counts.resize(size.counts);
+    dst.m_face_indices.resize(size.face_indices);
+    dst.m_wireframe_indices.resize(size.wireframe_indices);
 }
 
 bool SceneFBX::load(const char* path)
 {
     unload();
 
-    m_document = sfbx::MakeDocument(path);
-    if (!m_document->valid()) {
+    m_load_path = path;
+    m_load_phase = LoadPhase::Parse;
+    m_mono_mesh = std::make_shared<Mesh>();
+    while (loadStep()) {}
+    m_load_path = {};
+    if (!m_document) {
         unload();
         return false;
     }
+    m_mono_mesh->upload();
+
+    return true;
+}
 
+bool SceneFBX::loadAsync(const char* path)
+{
+    unload();
+    if (!path)
+        return false;
+
+    // GL resources must be created on the render thread
     m_mono_mesh = std::make_shared<Mesh>();
+    m_load_mesh = std::make_shared<Mesh>();
+
+    m_load_path = path;
+    m_load_phase = LoadPhase::Parse;
+    m_loading = true;
+    m_load_task.start([this]() { return loadStep(); });
+    return true;
+}
+
+bool SceneFBX::loadStep()
+{
+    // m_load_mesh is staging data for async load
+    Mesh& dst_mesh = m_load_mesh ? *m_load_mesh : *m_mono_mesh;
+
+    switch (m_load_phase) {
+    case LoadPhase::Parse:
     {
-        ImportContext ctx;
-        ctx.obj = m_document->getRootModel();
-        scanObjects(ctx);
+        // sfbx parses the whole document at once
+        {
+            std::ifstream fin(m_load_path, std::ios::in | std::ios::binary | std::ios::ate);
+            if (fin)
+                m_load_task.m_bytes_total = (uint64_t)fin.tellg();
+        }
+        auto doc = sfbx::MakeDocument(m_load_path);
+        if (!doc->valid()) {
+            m_load_task.fail();
+            m_load_phase = LoadPhase::Done;
+            break;
+        }
+        m_document = doc;
+        m_load_task.m_bytes_read = m_load_task.m_bytes_total.load();
+        m_load_stack.push_back(m_document->getRootModel());
+        m_load_phase = LoadPhase::Collect;
+        break;
     }
-    m_mono_mesh->upload();
 
-    return true;
+    case LoadPhase::Collect:
+        for (int i = 0; i < 256 && !m_load_stack.empty(); ++i) {
+            auto obj = m_load_stack.back();
+            m_load_stack.pop_back();
+            bool included = scanObject(obj);
+            ++m_load_task.m_nodes_scanned;
+            if (!included)
+                continue;
+
+            // push in reverse order to visit children in the same order as the recursive walk
+            auto children = obj->getChildren();
+            for (size_t ci = children.size(); ci-- > 0; )
+                m_load_stack.push_back(children[ci]);
+        }
+        if (m_load_stack.empty()) {
+            std::unique_lock<std::mutex> lock(m_load_mutex);
+            ResizeMesh(dst_mesh, m_load_total);
+            m_load_baked = 0;
+            m_load_phase = LoadPhase::Bake;
+        }
+        break;
+
+    case LoadPhase::Bake:
+    {
+        // meshes are baked in batches so that progress is visible and cancel requests are handled in time.
+        // each mesh writes to its own region, so the result doesn't depend on scheduling.
+        size_t num_meshes = m_mesh_data.size();
+        size_t begin = m_load_baked;
+        size_t end = std::min(begin + (size_t)GetWorkerCount() * 4, num_meshes);
+        {
+            std::unique_lock<std::mutex> lock(m_load_mutex);
+            parallel_for((int)begin, (int)end, [&](int mi) {
+                bakeMesh(*m_mesh_data[mi], dst_mesh);
+            });
+            m_load_ready = end < num_meshes ? m_mesh_data[end]->offsets : m_load_total;
+            m_load_dirty = true;
+        }
+        m_load_baked = end;
+        m_load_task.m_objects_baked += uint32_t(end - begin);
+        if (m_load_baked == num_meshes) {
+            if (m_settings.bake_animation && setupAnimationBake())
+                m_load_phase = LoadPhase::BakeAnimation;
+            else
+                m_load_phase = LoadPhase::Done;
+        }
+        break;
+    }
+
+    case LoadPhase::BakeAnimation:
+        if (!bakeAnimationStep())
+            m_load_phase = LoadPhase::Done;
+        break;
+
+    default:
+        break;
+    }
+    return m_load_phase != LoadPhase::Done;
+}
+
+void SceneFBX::cancelLoad()
+{
+    if (m_loading)
+        unload();
+}
+
+LoadProgress SceneFBX::getLoadProgress() const
+{
+    return m_load_task.getProgress();
+}
+
+void SceneFBX::update()
+{
+    if (!m_loading)
+        return;
+
+    bool running = m_load_task.update();
+    {
+        // copying is throttled as the staging data grows every step
+        auto now = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(m_load_mutex);
+        if (m_load_dirty && (!running || now - m_load_last_sync > std::chrono::milliseconds(100))) {
+            m_mono_mesh->assign(*m_load_mesh);
+            // drop the part that is allocated but not baked yet
+            ResizeMesh(*m_mono_mesh, m_load_ready);
+            m_mono_mesh->upload();
+            m_load_dirty = false;
+            m_load_last_sync = now;
+        }
+    }
+
+    if (!running) {
+        m_load_task.wait();
+        m_loading = false;
+        m_load_mesh = {};
+        m_load_path = {};
+
+        if (m_load_task.getProgress().state != LoadState::Completed) {
+            unload();
+        }
+        else if (m_seek_requested) {
+            m_seek_requested = false;
+            seek(m_seek_request, m_seek_request_mask);
+        }
+    }
 }
 
 bool SceneFBX::loadAdditive(const char* path)
 {
-    if (!m_document)
+    if (!m_document || m_loading)
+        return false;
+    if (!m_document->mergeAnimations(path))
         return false;
-    return m_document->mergeAnimations(path);
+
+    // baked tracks are outdated
+    m_anim_baked = false;
+    if (m_settings.bake_animation && setupAnimationBake()) {
+        while (bakeAnimationStep()) {}
+    }
+    m_time = -1.0;
+    return true;
 }
 
 void SceneFBX::unload()
 {
+    m_load_task.cancel();
+    m_load_phase = LoadPhase::Done;
+    m_load_stack = {};
+    m_load_total = {};
+    m_load_baked = 0;
+    m_load_ready = {};
+    m_load_mesh = {};
+    m_load_dirty = false;
+    m_loading = false;
+    m_seek_requested = false;
+
     m_document = nullptr;
 
     m_time = -1.0;
+    m_eval_done = EvalMask::None;
     m_mono_mesh = {};
+    m_mesh_data = {};
+    m_model_table = {};
+    // m_eval_paths is kept as a setting
+    m_camera_selected = {};
+    m_selection_valid = false;
 
     m_cameras = {};
     m_camera_table = {};
+
+    m_nodes = {};
+    m_node_indices = {};
+    m_camera_nodes = {};
+    m_channels = {};
+    m_node_locals = {};
+    m_node_globals = {};
+    m_anim_tracks = {};
+    m_anim_weights = {};
+    m_anim_num_tracks = 0;
+    m_anim_num_frames = 0;
+    m_anim_start = 0.0;
+    m_anim_baked = false;
+    m_anim_has_skin = false;
+    m_bake_pass = 0;
+    m_bake_frame = 0;
 }
 
 std::tuple<double, double> SceneFBX::getTimeRange() const
 {
+    if (m_loading || !m_document)
+        return {};
     if (auto take = m_document->getCurrentTake())
         return { take->getLocalStart(), take->getLocalStop() };
     return {};
 }
 
+void SceneFBX::updateVisibility()
+{
+    if (!m_settings.skip_invisible)
+        return;
+
+    for (auto& mesh : m_mesh_data) {
+        bool visible = true;
+        for (auto model = mesh->mesh_fbx->getModel(); model; model = model->getParent()) {
+            if (!model->getVisibility()) {
+                visible = false;
+                break;
+            }
+        }
+
+        if (!visible && mesh->visible) {
+            // collapse to degenerate primitives
+            auto& ofs = mesh->offsets;
+            size_t num_points = mesh->mesh_fbx->getPoints().size();
+            size_t num_points_ex = mesh->indices_tri.size();
+            std::fill_n(m_mono_mesh->m_points.data() + ofs.points, num_points, float3::zero());
+            std::fill_n(m_mono_mesh->m_points_ex.data() + ofs.points_ex, num_points_ex, float3::zero());
+        }
+        mesh->visible = visible;
+    }
+}
+
 void SceneFBX::applyDeform()
 {
+    updateVisibility();
     for (auto& mesh : m_mesh_data) {
+        if (!mesh->selected || !mesh->visible)
+            continue;
         auto points_deformed = mesh->mesh_fbx->getPointsDeformed(true);
         auto src = make_span((float3*)points_deformed.data(), points_deformed.size());
-        auto dst = make_span(m_mono_mesh->m_points.data() + mesh->points_offset, m_mono_mesh->m_points.size());
-        auto dst_ex = make_span(m_mono_mesh->m_points_ex.data() + mesh->pointsex_offset, mesh->indices_tri.size());
+        auto dst = make_span(m_mono_mesh->m_points.data() + mesh->offsets.points, m_mono_mesh->m_points.size());
+        auto dst_ex = make_span(m_mono_mesh->m_points_ex.data() + mesh->offsets.points_ex, mesh->indices_tri.size());
         sfbx::copy(dst, src);
         sfbx::copy_indexed(dst_ex, src, mesh->indices_tri);
     }
@@ -231,37 +594,402 @@ void SceneFBX::applyDeform()
     m_mono_mesh->upload();
 }
 
-void SceneFBX::seek(double time)
+void SceneFBX::seek(double time, EvalMask mask)
 {
-    if (!m_document || time == m_time)
+    if (m_loading) {
+        // seek after the load job is completed
+        m_seek_requested = true;
+        m_seek_request = time;
+        m_seek_request_mask = mask;
+        return;
+    }
+    if (!m_document)
+        return;
+    if (time == m_time && (m_eval_done & mask) == mask)
         return;
 
-    if (auto take = m_document->getCurrentTake())
-        take->applyAnimation(time);
-    applyDeform();
+    if (time != m_time)
+        m_eval_done = EvalMask::None;
+    m_time = time;
+    if (mask != EvalMask::None)
+        mask = mask | EvalMask::Transforms;
+    updateSelection();
+
+    if (m_anim_baked) {
+        seekBaked(time, mask);
+        m_eval_done = m_eval_done | mask;
+        return;
+    }
+
+    // sfbx evaluates all curves at once. only the parts after that can be skipped.
+    if (!has_flag(m_eval_done, EvalMask::Transforms)) {
+        if (auto take = m_document->getCurrentTake())
+            take->applyAnimation(time);
+    }
+    if (has_flag(mask, EvalMask::Geometry))
+        applyDeform();
+
+    if (has_flag(mask, EvalMask::Cameras)) {
+        size_t num_cameras = m_cameras.size();
+        for (size_t ci = 0; ci < num_cameras; ++ci) {
+            if (!m_camera_selected[ci])
+                continue;
+            auto dst = static_cast<Camera*>(m_cameras[ci]);
+            auto fbx = (sfbx::Camera*)dst->m_userdata;
+            updateCamera(*dst, to<float4x4>(fbx->getGlobalMatrix()));
+        }
+    }
+    m_eval_done = m_eval_done | mask;
+}
+
+bool SceneFBX::evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback)
+{
+    if (m_loading || !m_document || dst.size() < times.size())
+        return false;
+
+    // the document has a single animated state, so frames are evaluated one by one. the shown frame is restored afterwards.
+    double time = m_time;
+    size_t num_frames = times.size();
+    for (size_t fi = 0; fi < num_frames; ++fi) {
+        seek(times[fi], EvalMask::Geometry);
+        auto& frame = dst[fi];
+        auto points = m_mono_mesh->getPoints();
+        frame.time = times[fi];
+        frame.points.assign(points.begin(), points.end());
+        frame.particles.clear();
+        if (callback)
+            callback(fi);
+    }
+    if (time >= 0.0)
+        seek(time);
+    return true;
+}
+
+void SceneFBX::setEvalPaths(const std::vector<std::string>& paths)
+{
+    m_eval_paths = paths;
+    m_selection_valid = false;
+    m_eval_done = EvalMask::None;
+}
+
+void SceneFBX::updateSelection()
+{
+    if (m_selection_valid)
+        return;
+    for (auto& mesh : m_mesh_data)
+        mesh->selected = IsPathSelected(mesh->mesh_fbx->getModel()->getPath(), m_eval_paths);
+    m_camera_selected.clear();
+    for (auto cam : m_cameras)
+        m_camera_selected.push_back(IsPathSelected(cam->getPath(), m_eval_paths));
+    m_selection_valid = true;
+}
+
+bool SceneFBX::getGlobalMatrix(const std::string& path, float4x4& dst) const
+{
+    if (m_loading || !has_flag(m_eval_done, EvalMask::Transforms))
+        return false;
+    auto it = m_model_table.find(path);
+    if (it == m_model_table.end())
+        return false;
+
+    if (m_anim_baked) {
+        auto ni = m_node_indices.find(it->second);
+        if (ni != m_node_indices.end()) {
+            dst = m_node_globals[ni->second];
+            return true;
+        }
+    }
+    dst = to<float4x4>(it->second->getGlobalMatrix());
+    return true;
+}
+
+void SceneFBX::updateCamera(Camera& dst, const float4x4& global_matrix)
+{
+    auto fbx = (sfbx::Camera*)dst.m_userdata;
+
+    float3 pos = extract_position(global_matrix);
+    float3 dir = normalize(mul_v(global_matrix, float3{ -1.0f, 0.0f, 0.0f }));
+    float3 up = normalize(mul_v(global_matrix, float3{ 0.0f, 1.0f, 0.0f }));
+
+    dst.m_position = pos;
+    dst.m_direction = dir;
+    dst.m_up = up;
+
+    dst.m_focal_length = fbx->getFocalLength();
+    dst.m_aperture = to<float2>(fbx->getFilmSize());
+    dst.m_lens_shift = to<float2>(fbx->getFilmOffset()) / dst.m_aperture;
+
+    dst.m_near = std::max(fbx->getNearPlane(), 0.01f);
+    dst.m_far = std::max(fbx->getFarPlane(), dst.m_near);
+}
+
+bool SceneFBX::setupAnimationBake()
+{
+    m_anim_baked = false;
+    auto take = m_document->getCurrentTake();
+    if (!take || m_settings.bake_frame_rate <= 0.0f)
+        return false;
+
+    // flatten the model hierarchy
+    m_nodes.clear();
+    m_node_indices.clear();
+    auto& node_indices = m_node_indices;
+    std::vector<sfbx::Object*> stack{ m_document->getRootModel() };
+    while (!stack.empty()) {
+        auto obj = stack.back();
+        stack.pop_back();
+        if (auto model = as<sfbx::Model>(obj)) {
+            NodeData node;
+            node.model = model;
+            auto it = node_indices.find(model->getParent());
+            if (it != node_indices.end())
+                node.parent = it->second;
+            node_indices[model] = (int)m_nodes.size();
+            m_nodes.push_back(node);
+
+            auto children = obj->getChildren();
+            for (size_t ci = children.size(); ci-- > 0; )
+                stack.push_back(children[ci]);
+        }
+    }
 
-    for (auto& kvp : m_camera_table) {
-        Camera* dst = kvp.second.get();
-        auto fbx = (sfbx::Camera*)dst->m_userdata;
+    m_camera_nodes.clear();
+    for (auto cam : m_cameras) {
+        auto it = node_indices.find((sfbx::Camera*)static_cast<Camera*>(cam)->m_userdata);
+        m_camera_nodes.push_back(it != node_indices.end() ? it->second : -1);
+    }
+
+    m_channels.clear();
+    m_anim_has_skin = false;
+    for (auto& mesh : m_mesh_data) {
+        auto it = node_indices.find(mesh->mesh_fbx->getModel());
+        mesh->node = it != node_indices.end() ? it->second : -1;
+        mesh->blendshape = mesh->skinned = false;
+        for (auto deformer : mesh->mesh_fbx->getDeformers()) {
+            if (auto bs = as<sfbx::BlendShape>(deformer)) {
+                for (auto ch : bs->getChannels())
+                    m_channels.push_back(ch);
+                mesh->blendshape = true;
+            }
+            else {
+                // skinning depends on the joints' global matrices held by sfbx. it is evaluated by sfbx as before.
+                mesh->skinned = true;
+                m_anim_has_skin = true;
+            }
+        }
+    }
+
+    double duration = std::max(take->getLocalStop() - take->getLocalStart(), 0.0f);
+    m_anim_start = take->getLocalStart();
+    m_anim_num_frames = (int)(duration * m_settings.bake_frame_rate + 0.5) + 1;
+    m_anim_num_tracks = 0;
+    m_anim_has_unbaked = false;
+    m_node_locals.resize(m_nodes.size());
+    m_node_globals.resize(m_nodes.size());
+    m_anim_tracks.clear();
+    m_anim_weights.resize(m_anim_num_frames * m_channels.size());
+    m_bake_pass = 0;
+    m_bake_frame = 0;
+    return true;
+}
+
+bool SceneFBX::bakeAnimationStep()
+{
+    // pass 0 finds animated nodes and records blend shape weights. pass 1 records the tracks of animated nodes.
+    // applyAnimation() is the expensive part, so a step handles a few frames.
+    auto take = m_document->getCurrentTake();
+    size_t num_nodes = m_nodes.size();
+    size_t num_channels = m_channels.size();
+    for (int i = 0; i < 4 && m_bake_frame < m_anim_num_frames; ++i, ++m_bake_frame) {
+        int frame = m_bake_frame;
+        take->applyAnimation(float(m_anim_start + frame / m_settings.bake_frame_rate));
+
+        if (m_bake_pass == 0) {
+            for (size_t ni = 0; ni < num_nodes; ++ni) {
+                auto& node = m_nodes[ni];
+                float4x4 local = to<float4x4>(node.model->getLocalMatrix());
+                if (frame == 0)
+                    m_node_locals[ni] = local;
+                else if (node.track < 0 && local != m_node_locals[ni])
+                    node.track = 0; // mark as animated. actual indices are assigned at the end of this pass
+            }
+            float* weights = m_anim_weights.data() + num_channels * frame;
+            for (size_t ci = 0; ci < num_channels; ++ci)
+                weights[ci] = m_channels[ci]->getWeight();
+
+            if (frame == 0) {
+                getUnbakedValues(m_anim_unbaked);
+            }
+            else if (!m_anim_has_unbaked) {
+                getUnbakedValues(m_anim_unbaked_tmp);
+                m_anim_has_unbaked = m_anim_unbaked_tmp != m_anim_unbaked;
+            }
+        }
+        else {
+            TRS* tracks = m_anim_tracks.data() + (size_t)m_anim_num_tracks * frame;
+            for (auto& node : m_nodes) {
+                if (node.track < 0)
+                    continue;
+                float4x4 local = to<float4x4>(node.model->getLocalMatrix());
+                tracks[node.track] = { extract_position(local), extract_rotation(local), extract_scale(local) };
+            }
+        }
+    }
+
+    if (m_bake_frame < m_anim_num_frames)
+        return true;
+
+    if (m_bake_pass == 0) {
+        for (auto& node : m_nodes) {
+            if (node.track >= 0)
+                node.track = m_anim_num_tracks++;
+        }
+        if (m_anim_num_tracks > 0) {
+            m_anim_tracks.resize((size_t)m_anim_num_tracks * m_anim_num_frames);
+            m_bake_pass = 1;
+            m_bake_frame = 0;
+            return true;
+        }
+    }
+    m_anim_baked = true;
+    return false;
+}
 
-        float4x4 global_matrix = to<float4x4>(fbx->getGlobalMatrix());
-        float3 pos = extract_position(global_matrix);
-        float3 dir = normalize(mul_v(global_matrix, float3{ -1.0f, 0.0f, 0.0f }));
-        float3 up = normalize(mul_v(global_matrix, float3{ 0.0f, 1.0f, 0.0f }));
+void SceneFBX::getUnbakedValues(std::vector<float>& dst)
+{
+    dst.clear();
+    size_t num_cameras = m_cameras.size();
+    for (size_t ci = 0; ci < num_cameras; ++ci) {
+        auto fbx = (sfbx::Camera*)static_cast<Camera*>(m_cameras[ci])->m_userdata;
+        float2 film_size = to<float2>(fbx->getFilmSize());
+        float2 film_offset = to<float2>(fbx->getFilmOffset());
+        float values[] = { fbx->getFocalLength(), film_size.x, film_size.y, film_offset.x, film_offset.y, fbx->getNearPlane(), fbx->getFarPlane() };
+        dst.insert(dst.end(), std::begin(values), std::end(values));
+        if (m_camera_nodes[ci] < 0) {
+            float4x4 global = to<float4x4>(fbx->getGlobalMatrix());
+            const float* m = (const float*)&global;
+            dst.insert(dst.end(), m, m + 16);
+        }
+    }
+    for (auto& node : m_nodes)
+        dst.push_back(node.model->getVisibility() ? 1.0f : 0.0f);
+}
 
-        dst->m_position = pos;
-        dst->m_direction = dir;
-        dst->m_up = up;
+void SceneFBX::seekBaked(double time, EvalMask mask)
+{
+    // skinned meshes need the joints evaluated by sfbx, and properties that are not baked are read from sfbx
+    bool apply = (m_anim_has_skin && has_flag(mask, EvalMask::Geometry)) ||
+        (m_anim_has_unbaked && (has_flag(mask, EvalMask::Geometry) || has_flag(mask, EvalMask::Cameras)));
+    if (apply) {
+        if (auto take = m_document->getCurrentTake())
+            take->applyAnimation(time);
+    }
 
-        dst->m_focal_length = fbx->getFocalLength();
-        dst->m_aperture = to<float2>(fbx->getFilmSize());
-        dst->m_lens_shift = to<float2>(fbx->getFilmOffset()) / dst->m_aperture;
+    // find frames
+    int last_frame = m_anim_num_frames - 1;
+    double frame = clamp((time - m_anim_start) * m_settings.bake_frame_rate, 0.0, (double)last_frame);
+    int f0, f1;
+    float w;
+    if (m_settings.interpolate) {
+        f0 = (int)frame;
+        f1 = std::min(f0 + 1, last_frame);
+        w = float(frame - f0);
+    }
+    else {
+        f0 = f1 = std::min((int)(frame + 0.5), last_frame);
+        w = 0.0f;
+    }
 
-        dst->m_near = std::max(fbx->getNearPlane(), 0.01f);
-        dst->m_far = std::max(fbx->getFarPlane(), dst->m_near);
+    // transforms
+    const TRS* tracks0 = m_anim_tracks.data() + (size_t)m_anim_num_tracks * f0;
+    const TRS* tracks1 = m_anim_tracks.data() + (size_t)m_anim_num_tracks * f1;
+    size_t num_nodes = m_nodes.size();
+    for (size_t ni = 0; ni < num_nodes; ++ni) {
+        auto& node = m_nodes[ni];
+        float4x4 local;
+        if (node.track < 0) {
+            local = m_node_locals[ni];
+        }
+        else {
+            auto& a = tracks0[node.track];
+            auto& b = tracks1[node.track];
+            local = f0 == f1 ? transform(a.t, a.r, a.s) : transform(lerp(a.t, b.t, w), slerp(a.r, b.r, w), lerp(a.s, b.s, w));
+        }
+        m_node_globals[ni] = node.parent < 0 ? local : local * m_node_globals[node.parent];
+    }
+    if (has_flag(mask, EvalMask::Geometry))
+        deformBaked(f0, f1, w);
+
+    // cameras
+    size_t num_cameras = has_flag(mask, EvalMask::Cameras) ? m_cameras.size() : 0;
+    for (size_t ci = 0; ci < num_cameras; ++ci) {
+        if (!m_camera_selected[ci])
+            continue;
+        auto dst = static_cast<Camera*>(m_cameras[ci]);
+        int node = m_camera_nodes[ci];
+        if (node >= 0)
+            updateCamera(*dst, m_node_globals[node]);
+        else
+            updateCamera(*dst, to<float4x4>(((sfbx::Camera*)dst->m_userdata)->getGlobalMatrix()));
     }
 }
 
+void SceneFBX::deformBaked(int f0, int f1, float w)
+{
+    // blend shape weights
+    size_t num_channels = m_channels.size();
+    const float* weights0 = m_anim_weights.data() + num_channels * f0;
+    const float* weights1 = m_anim_weights.data() + num_channels * f1;
+    for (size_t ci = 0; ci < num_channels; ++ci)
+        m_channels[ci]->setWeight(lerp(weights0[ci], weights1[ci], w));
+
+    // meshes
+    updateVisibility();
+    auto& dst_mesh = *m_mono_mesh;
+    auto write_points = [&dst_mesh](MeshData& data, span<float3> src, const float4x4* matrix) {
+        float3* dst = dst_mesh.m_points.data() + data.offsets.points;
+        size_t n = src.size();
+        if (matrix) {
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = mul_p(*matrix, (float3&)src[i]);
+        }
+        else {
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = (float3&)src[i];
+        }
+
+        float3* dst_ex = dst_mesh.m_points_ex.data() + data.offsets.points_ex;
+        const int* indices = data.indices_tri.data();
+        size_t num_indices = data.indices_tri.size();
+        for (size_t i = 0; i < num_indices; ++i)
+            dst_ex[i] = dst[indices[i]];
+    };
+
+    // rigid meshes only need the baked global matrix
+    parallel_for(0, (int)m_mesh_data.size(), [&](int mi) {
+        auto& data = *m_mesh_data[mi];
+        if (!data.selected || !data.visible || data.blendshape || data.skinned || data.node < 0)
+            return;
+        auto points = data.mesh_fbx->getPoints();
+        write_points(data, make_span((float3*)points.data(), points.size()), &m_node_globals[data.node]);
+    });
+    for (auto& pdata : m_mesh_data) {
+        auto& data = *pdata;
+        if (!data.selected || !data.visible) {
+            continue;
+        }
+        else if (data.skinned || data.node < 0) {
+            auto points = data.mesh_fbx->getPointsDeformed(true);
+            write_points(data, make_span((float3*)points.data(), points.size()), nullptr);
+        }
+        else if (data.blendshape) {
+            auto points = data.mesh_fbx->getPointsDeformed(false);
+            write_points(data, make_span((float3*)points.data(), points.size()), &m_node_globals[data.node]);
+        }
+    }
+    m_mono_mesh->upload();
+}
+
 IScene* CreateSceneFBX_()
 {
     return new SceneFBX();
@@ -1,6 +1,17 @@
 #include "pch.h"
 #include "WebAlembicViewer.h"
 #include "SceneGraph.h"
+#include "Parallel.h"
+#ifdef _WIN32
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 namespace wabc {
 
@@ -13,22 +24,55 @@ bool Skin::deformImpl(span<Vec> dst, span<Vec> src, const Mul& mul) const
         return false;
     }
 
-    const JointWeight* weights = m_weights.data();
-    size_t nvertices = src.size();
-    for (size_t vi = 0; vi < nvertices; ++vi) {
-        Vec p = src[vi];
-        Vec r{};
-        int cjoints = m_counts[vi];
-        for (int bi = 0; bi < cjoints; ++bi) {
-            JointWeight w = weights[bi];
-            r += mul(m_matrices[w.index], p) * w.weight;
+    const int grain = BlockSize;
+    int nvertices = (int)src.size();
+    int nblocks = (nvertices + grain - 1) / grain;
+    if ((int)m_block_offsets.size() != nblocks + 1 || m_block_offsets[nblocks] != (int)m_weights.size())
+        updateWeightOffsets();
+
+    parallel_for(0, nblocks, [&](int block) {
+        int first = block * grain;
+        int last = std::min(first + grain, nvertices);
+        const JointWeight* weights = m_weights.data() + m_block_offsets[block];
+        for (int vi = first; vi < last; ++vi) {
+            Vec p = src[vi];
+            Vec r{};
+            int cjoints = m_counts[vi];
+            for (int bi = 0; bi < cjoints; ++bi) {
+                JointWeight w = weights[bi];
+                r += mul(m_matrices[w.index], p) * w.weight;
+            }
+            dst[vi] = r;
+            weights += cjoints;
         }
-        dst[vi] = r;
-        weights += cjoints;
-    }
+    });
     return true;
 }
 
+void Skin::updateWeightOffsets() const
+{
+    // weights are packed per vertex. count the weights of each block first to know where the blocks' weights start.
+    const int grain = BlockSize;
+    int nvertices = (int)m_counts.size();
+    int nblocks = (nvertices + grain - 1) / grain;
+    m_block_offsets.resize(nblocks + 1);
+    parallel_for(0, nblocks, [&](int block) {
+        int first = block * grain;
+        int last = std::min(first + grain, nvertices);
+        int n = 0;
+        for (int vi = first; vi < last; ++vi)
+            n += m_counts[vi];
+        m_block_offsets[block] = n;
+    });
+    int offset = 0;
+    for (int bi = 0; bi < nblocks; ++bi) {
+        int c = m_block_offsets[bi];
+        m_block_offsets[bi] = offset;
+        offset += c;
+    }
+    m_block_offsets[nblocks] = offset;
+}
+
 bool Skin::deformPoints(span<float3> dst, span<float3> src) const
 {
     return deformImpl(dst, src,
@@ -42,26 +86,44 @@ bool Skin::deformNormals(span<float3> dst, span<float3> src) const
 }
 
 
-bool BlendShape::deformPoints(span<float3> dst, span<float3> src, float w) const
+// blend shapes without indices are dense and have a delta for every point
+static bool BlendDeltas(span<float3> dst, span<float3> src, const RawVector<int>& indices, const RawVector<float3>& deltas, float w)
 {
+    if (dst.size() != src.size() || deltas.size() != (indices.empty() ? dst.size() : indices.size())) {
+        printf("BlendShape::deform(): vertex count mismatch\n");
+        return false;
+    }
     if (dst.data() != src.data())
         memcpy(dst.data(), src.data(), src.size_bytes());
+    if (w == 0.0f)
+        return true;
 
-    size_t c = m_indices.size();
-    for (size_t i = 0; i < c; ++i)
-        dst[m_indices[i]] += m_delta_points[i];
+    if (indices.empty()) {
+        // a flat multiply-add over the floats. vectorized by the compiler.
+        const int grain = 65536;
+        float* d = (float*)dst.data();
+        const float* delta = (const float*)deltas.data();
+        parallel_for_blocked(0, (int)dst.size() * 3, grain, [&](int first, int last) {
+            for (int i = first; i < last; ++i)
+                d[i] += delta[i] * w;
+        });
+    }
+    else {
+        size_t c = indices.size();
+        for (size_t i = 0; i < c; ++i)
+            dst[indices[i]] += deltas[i] * w;
+    }
     return true;
 }
 
-bool BlendShape::deformNormals(span<float3> dst, span<float3> src, float w) const
+bool BlendShape::deformPoints(span<float3> dst, span<float3> src, float w) const
 {
-    if (dst.data() != src.data())
-        memcpy(dst.data(), src.data(), src.size_bytes());
+    return BlendDeltas(dst, src, m_indices, m_delta_points, w);
+}
 
-    size_t c = m_indices.size();
-    for (size_t i = 0; i < c; ++i)
-        dst[m_indices[i]] += m_delta_normals[i];
-    return true;
+bool BlendShape::deformNormals(span<float3> dst, span<float3> src, float w) const
+{
+    return BlendDeltas(dst, src, m_indices, m_delta_normals, w);
 }
 
 
@@ -74,6 +136,9 @@ Mesh::Mesh()
     glGenBuffers(1, &m_buf_points_ex);
     glGenBuffers(1, &m_buf_normals_ex);
     glGenBuffers(1, &m_buf_wireframe_indices);
+    glGenBuffers(1, &m_buf_lod_indices);
+    glGenBuffers(1, &m_buf_cluster_points);
+    glGenBuffers(1, &m_buf_cluster_indices);
 #endif
 }
 
@@ -84,6 +149,9 @@ Mesh::~Mesh()
     glDeleteBuffers(1, &m_buf_points_ex);
     glDeleteBuffers(1, &m_buf_normals_ex);
     glDeleteBuffers(1, &m_buf_wireframe_indices);
+    glDeleteBuffers(1, &m_buf_lod_indices);
+    glDeleteBuffers(1, &m_buf_cluster_points);
+    glDeleteBuffers(1, &m_buf_cluster_indices);
 #endif
 }
 
@@ -97,6 +165,36 @@ void Mesh::clear()
     m_counts.clear();
     m_face_indices.clear();
     m_wireframe_indices.clear();
+    m_lod_indices.clear();
+    m_has_draw_ranges = false;
+    m_draw_ranges.clear();
+
+    m_cluster_points.clear();
+    m_cluster_points_q.clear();
+    m_cluster_indices.clear();
+    m_clusters.clear();
+    m_visible_clusters.clear();
+    m_cluster_layout_dirty = true;
+    m_cluster_dirty_ranges.clear();
+}
+
+void Mesh::assign(const Mesh& v)
+{
+    m_points = v.m_points;
+    m_normals = v.m_normals;
+    m_points_ex = v.m_points_ex;
+    m_normals_ex = v.m_normals_ex;
+
+    m_counts = v.m_counts;
+    m_face_indices = v.m_face_indices;
+    m_wireframe_indices = v.m_wireframe_indices;
+    m_lod_indices = v.m_lod_indices;
+
+    m_cluster_points = v.m_cluster_points;
+    m_cluster_points_q = v.m_cluster_points_q;
+    m_cluster_indices = v.m_cluster_indices;
+    m_clusters = v.m_clusters;
+    m_cluster_layout_dirty = true;
 }
 
 void Mesh::upload()
@@ -118,7 +216,33 @@ void Mesh::upload()
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buf_wireframe_indices);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_wireframe_indices.size() * sizeof(int), m_wireframe_indices.data(), GL_STREAM_DRAW);
     }
+    if (!m_lod_indices.empty()) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buf_lod_indices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_lod_indices.size() * sizeof(int), m_lod_indices.data(), GL_STREAM_DRAW);
+    }
+    if (!m_cluster_points.empty() || !m_cluster_points_q.empty()) {
+        // either one is used
+        bool quantized = !m_cluster_points_q.empty();
+        size_t stride = quantized ? sizeof(int16_t) * 3 : sizeof(float3);
+        auto* data = quantized ? (const char*)m_cluster_points_q.data() : (const char*)m_cluster_points.data();
+        size_t size = quantized ? m_cluster_points_q.size() / 3 : m_cluster_points.size();
+
+        glBindBuffer(GL_ARRAY_BUFFER, m_buf_cluster_points);
+        if (m_cluster_layout_dirty) {
+            glBufferData(GL_ARRAY_BUFFER, size * stride, data, GL_DYNAMIC_DRAW);
+        }
+        else {
+            for (auto& r : m_cluster_dirty_ranges)
+                glBufferSubData(GL_ARRAY_BUFFER, r.x * stride, r.y * stride, data + r.x * stride);
+        }
+    }
+    if (!m_cluster_indices.empty() && m_cluster_layout_dirty) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buf_cluster_indices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_cluster_indices.size() * sizeof(uint16_t), m_cluster_indices.data(), GL_STATIC_DRAW);
+    }
 #endif
+    m_cluster_layout_dirty = false;
+    m_cluster_dirty_ranges.clear();
 }
 
 
@@ -140,6 +264,13 @@ Points::~Points()
 void Points::clear()
 {
     m_points.clear();
+    m_has_draw_ranges = false;
+    m_draw_ranges.clear();
+}
+
+void Points::assign(const Points& v)
+{
+    m_points = v.m_points;
 }
 
 void Points::upload()
@@ -152,32 +283,440 @@ void Points::upload()
 #endif
 }
 
-IScene* LoadScene_(const char* path)
+
+
+
+FileStream::FileStream()
+    : std::istream(&m_buf)
+{
+}
+
+bool FileStream::open(const char* path)
 {
-    if (!path)
-        return nullptr;
-    size_t len = std::strlen(path);
-    if (len > 4) {
-        char ext[3]{};
-        for (int i = 0; i < 3; ++i)
-            ext[i] = std::tolower(path[len - 3 + i]);
-
-        if (std::memcmp(ext, "abc", 3) == 0) {
-            auto scene = CreateSceneABC_();
-            if (scene->load(path))
-                return scene;
-            else
-                scene->release();
+    if (!m_buf.open(path, std::ios::in | std::ios::binary))
+        return false;
+    m_size = (uint64_t)m_buf.pubseekoff(0, std::ios::end, std::ios::in);
+    m_buf.pubseekpos(0, std::ios::in);
+    m_buf.m_bytes_read = 0;
+    clear();
+    return true;
+}
+
+bool FileStream::is_open() const
+{
+    return m_buf.is_open();
+}
+
+uint64_t FileStream::getSize() const
+{
+    return m_size;
+}
+
+uint64_t FileStream::getBytesRead() const
+{
+    return m_buf.m_bytes_read;
+}
+
+std::streamsize FileStream::Buffer::xsgetn(char_type* dst, std::streamsize n)
+{
+    auto ret = std::filebuf::xsgetn(dst, n);
+    m_bytes_read += ret;
+    return ret;
+}
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_file = file;
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    m_mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = (const char*)::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        close();
+        return false;
+    }
+    m_size = (uint64_t)size.QuadPart;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        data = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    m_data = (const char*)data;
+    m_size = (uint64_t)st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (m_data)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping)
+        ::CloseHandle(m_mapping);
+    if (m_file)
+        ::CloseHandle(m_file);
+    m_mapping = m_file = nullptr;
+#else
+    if (m_data)
+        ::munmap((void*)m_data, (size_t)m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+
+FrameArena::~FrameArena()
+{
+    reset();
+    ::operator delete(m_block);
+}
+
+void* FrameArena::allocate(size_t size, size_t align)
+{
+    // reserve enough to align within the reserved range
+    size_t reserved = size + align - 1;
+    size_t offset = m_used.fetch_add(reserved);
+    if (offset + reserved <= m_capacity) {
+        auto addr = (uintptr_t)(m_block + offset);
+        return (void*)((addr + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    auto p = ::operator new(reserved);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_overflow.push_back(p);
+    }
+    return (void*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void FrameArena::reset()
+{
+    for (auto p : m_overflow)
+        ::operator delete(p);
+    m_overflow.clear();
+
+    size_t used = m_used;
+    if (used > m_capacity) {
+        // headroom for frames that are a bit larger
+        ::operator delete(m_block);
+        m_capacity = used + used / 4;
+        m_block = (char*)::operator new(m_capacity);
+    }
+    m_used = 0;
+}
+
+
+
+LoadTask::~LoadTask()
+{
+    cancel();
+}
+
+void LoadTask::start(const Step& step, uint64_t bytes_total)
+{
+    cancel();
+
+    m_step = step;
+    m_bytes_read = 0;
+    m_bytes_total = bytes_total;
+    m_nodes_scanned = 0;
+    m_objects_baked = 0;
+    m_canceled = false;
+    m_state = LoadState::Loading;
+    m_running = true;
+
+#ifdef wabcWithThreads
+    m_thread = std::thread([this]() {
+        while (!m_canceled && runStep()) {}
+        finish();
+    });
+#endif
+}
+
+void LoadTask::cancel()
+{
+    if (m_running)
+        m_canceled = true;
+    wait();
+}
+
+void LoadTask::wait()
+{
+#ifdef wabcWithThreads
+    if (m_thread.joinable())
+        m_thread.join();
+#else
+    while (m_running && !m_canceled && runStep()) {}
+    if (m_running)
+        finish();
+#endif
+}
+
+void LoadTask::fail()
+{
+    m_state = LoadState::Failed;
+}
+
+bool LoadTask::runStep()
+{
+    // e.g. Alembic throws on corrupt data. on a worker thread it would terminate the viewer.
+    try {
+        return m_step();
+    }
+    catch (const std::exception& e) {
+        printf("LoadTask: %s\n", e.what());
+    }
+    catch (...) {
+        printf("LoadTask: unknown exception\n");
+    }
+    fail();
+    return false;
+}
+
+bool LoadTask::update(double budget_ms)
+{
+#ifndef wabcWithThreads
+    if (m_running) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(int64_t(budget_ms * 1000.0));
+        bool more = true;
+        while (more && !m_canceled && std::chrono::steady_clock::now() < deadline)
+            more = runStep();
+        if (!more || m_canceled)
+            finish();
+    }
+#endif
+    return m_running;
+}
+
+bool LoadTask::isRunning() const
+{
+    return m_running;
+}
+
+bool LoadTask::isCanceled() const
+{
+    return m_canceled;
+}
+
+LoadProgress LoadTask::getProgress() const
+{
+    LoadProgress ret;
+    ret.state = m_state;
+    ret.bytes_read = m_bytes_read;
+    ret.bytes_total = m_bytes_total;
+    ret.nodes_scanned = m_nodes_scanned;
+    ret.objects_baked = m_objects_baked;
+    return ret;
+}
+
+void LoadTask::finish()
+{
+    if (m_canceled)
+        m_state = LoadState::Canceled;
+    else if (m_state == LoadState::Loading)
+        m_state = LoadState::Completed;
+    m_step = {};
+    m_running = false;
+}
+
+
+
+bool IsPathSelected(const std::string& path, const std::vector<std::string>& paths)
+{
+    if (paths.empty())
+        return true;
+    for (auto& p : paths) {
+        if (p.empty())
+            return true; // the root
+        if (path.size() < p.size() || path.compare(0, p.size(), p) != 0)
+            continue;
+        // exact match, or p is an ancestor
+        if (path.size() == p.size() || p.back() == '/' || path[p.size()] == '/')
+            return true;
+    }
+    return false;
+}
+
+
+bool MatchPattern(const char* str, const char* pattern)
+{
+    // iterative matching with backtracking to the last '*'
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*str) {
+        if (*pattern == '?' || *pattern == *str) {
+            ++str;
+            ++pattern;
         }
-        else if (std::memcmp(ext, "fbx", 3) == 0) {
-            auto scene = CreateSceneFBX_();
-            if (scene->load(path))
-                return scene;
-            else
-                scene->release();
+        else if (*pattern == '*') {
+            star = pattern++;
+            resume = str;
         }
+        else if (star) {
+            pattern = star + 1;
+            str = ++resume;
+        }
+        else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        ++pattern;
+    return *pattern == '\0';
+}
+
+bool MatchPathPatterns(const std::string& path, const std::vector<std::string>& patterns)
+{
+    if (patterns.empty())
+        return false;
+
+    std::string sub;
+    size_t len = path.size();
+    for (size_t e = 1; e <= len; ++e) {
+        if (e != len && path[e] != '/')
+            continue;
+        sub.assign(path, 0, e);
+        for (auto& pattern : patterns) {
+            if (MatchPattern(sub.c_str(), pattern.c_str()))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool IsPathIncluded(const std::string& path, const SceneSettings& settings, bool geometry)
+{
+    if (MatchPathPatterns(path, settings.exclude_patterns))
+        return false;
+    if (geometry && !settings.include_patterns.empty())
+        return MatchPathPatterns(path, settings.include_patterns);
+    return true;
+}
+
+
+bool IsInFrustum(const float4x4& mvp, float3 bmin, float3 bmax)
+{
+    float4 corners[8];
+    for (int i = 0; i < 8; ++i) {
+        float3 p{
+            (i & 1) ? bmax.x : bmin.x,
+            (i & 2) ? bmax.y : bmin.y,
+            (i & 4) ? bmax.z : bmin.z,
+        };
+        corners[i] = mul4(mvp, p);
+    }
+
+    // -w <= x,y,z <= w
+    for (int axis = 0; axis < 3; ++axis) {
+        bool all_below = true;
+        bool all_above = true;
+        for (auto& c : corners) {
+            all_below = all_below && c[axis] < -c.w;
+            all_above = all_above && c[axis] > c.w;
+        }
+        if (all_below || all_above)
+            return false;
+    }
+    return true;
+}
+
+void GetMeshTopology(const IMesh& mesh, std::vector<int>& triangles, std::vector<int>& edges)
+{
+    triangles.clear();
+    edges.clear();
+    const int* indices = mesh.getFaceIndices().data();
+    for (int c : mesh.getCounts()) {
+        for (int fi = 0; fi < c - 2; ++fi) {
+            triangles.push_back(indices[0]);
+            triangles.push_back(indices[1 + fi]);
+            triangles.push_back(indices[2 + fi]);
+        }
+        indices += c;
+    }
+
+    // the wireframe has an edge once per face that shares it
+    auto wireframe = mesh.getWireframeIndices();
+    std::vector<uint64_t> keys;
+    keys.reserve(wireframe.size() / 2);
+    for (size_t i = 0; i + 1 < wireframe.size(); i += 2) {
+        uint32_t a = (uint32_t)wireframe[i], b = (uint32_t)wireframe[i + 1];
+        keys.push_back(a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a);
     }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (uint64_t key : keys) {
+        edges.push_back((int)(key >> 32));
+        edges.push_back((int)(key & 0xffffffff));
+    }
+}
+
+
+
+static IScene* CreateSceneByExtension(const char* path)
+{
+    if (!path)
+        return nullptr;
+    const char* ext = std::strrchr(path, '.');
+    if (!ext)
+        return nullptr;
+    std::string lower;
+    for (const char* c = ext + 1; *c; ++c)
+        lower += (char)std::tolower(*c);
+
+    if (lower == "abc")
+        return CreateSceneABC_();
+    else if (lower == "fbx")
+        return CreateSceneFBX_();
+    else if (lower == "wabc")
+        return CreateSceneWABC_();
     return nullptr;
 }
 
+IScene* LoadScene_(const char* path, const SceneSettings& settings)
+{
+    auto scene = CreateSceneByExtension(path);
+    if (scene)
+        scene->setSettings(settings);
+    if (scene && !scene->load(path)) {
+        scene->release();
+        scene = nullptr;
+    }
+    return scene;
+}
+
+IScene* LoadSceneAsync_(const char* path, const SceneSettings& settings)
+{
+    auto scene = CreateSceneByExtension(path);
+    if (scene)
+        scene->setSettings(settings);
+    if (scene && !scene->loadAsync(path)) {
+        scene->release();
+        scene = nullptr;
+    }
+    return scene;
+}
+
 } // namespace wabc
@@ -49,10 +49,18 @@ public:
     bool deformPoints(span<float3> dst, span<float3> src) const override;
     bool deformNormals(span<float3> dst, span<float3> src) const override;
 
+    // should be called after m_counts or m_weights change. deform*() update the offsets if their sizes don't match,
+    // but the skin can be deformed from multiple threads only if they are up to date.
+    void updateWeightOffsets() const;
+
 public:
     RawVector<int> m_counts;
     RawVector<JointWeight> m_weights;
     RawVector<float4x4> m_matrices;
+
+private:
+    static const int BlockSize = 4096; // vertices deformed as a unit
+    mutable RawVector<int> m_block_offsets; // block -> its first weight in m_weights. one more than blocks.
 };
 using SkinPtr = std::shared_ptr<Skin>;
 
@@ -87,15 +95,28 @@ public:
     span<int> getCounts() const override { return make_span(m_counts); }
     span<int> getFaceIndices() const override { return make_span(m_face_indices); }
     span<int> getWireframeIndices() const override { return make_span(m_wireframe_indices); }
+    span<int> getLODIndices() const override { return make_span(m_lod_indices); }
+    span<float4x4> getInstanceMatrices() const override { return make_span(m_instance_matrices); }
+    bool hasDrawRanges() const override { return m_has_draw_ranges; }
+    span<DrawRange> getDrawRanges() const override { return make_span(m_draw_ranges); }
+    span<float3> getClusterPoints() const override { return make_span(m_cluster_points); }
+    span<int16_t> getClusterPointsQuantized() const override { return make_span(m_cluster_points_q); }
+    span<uint16_t> getClusterIndices() const override { return make_span(m_cluster_indices); }
+    span<MeshCluster> getClusters() const override { return make_span(m_clusters); }
+    span<int> getVisibleClusters() const override { return make_span(m_visible_clusters); }
 
 #ifdef wabcWithGL
     GLuint getPointsBuffer() const override { return m_buf_points; }
     GLuint getPointsExBuffer() const override { return m_buf_points_ex; }
     GLuint getNormalsExBuffer() const override { return m_buf_normals_ex; }
     GLuint getWireframeIndicesBuffer() const override { return m_buf_wireframe_indices; }
+    GLuint getLODIndicesBuffer() const override { return m_buf_lod_indices; }
+    GLuint getClusterPointsBuffer() const override { return m_buf_cluster_points; }
+    GLuint getClusterIndicesBuffer() const override { return m_buf_cluster_indices; }
 #endif
 
     void clear();
+    void assign(const Mesh& v); // copy vertex & index data. buffers are not shared.
     void upload();
 
 public:
@@ -107,12 +128,29 @@ public:
     RawVector<int> m_counts;
     RawVector<int> m_face_indices;
     RawVector<int> m_wireframe_indices;
+    RawVector<int> m_lod_indices;
+    RawVector<float4x4> m_instance_matrices;
+    bool m_has_draw_ranges = false;
+    RawVector<DrawRange> m_draw_ranges;
+
+    RawVector<float3> m_cluster_points;
+    RawVector<int16_t> m_cluster_points_q; // 3 per point
+    RawVector<uint16_t> m_cluster_indices;
+    RawVector<MeshCluster> m_clusters;
+    RawVector<int> m_visible_clusters;
+    // if m_cluster_layout_dirty is false, upload() sends only m_cluster_dirty_ranges (offset and count of m_cluster_points).
+    // the scene clears it when the clusters are laid out as in the last upload.
+    bool m_cluster_layout_dirty = true;
+    RawVector<int2> m_cluster_dirty_ranges;
 
 #ifdef wabcWithGL
     GLuint m_buf_points{};
     GLuint m_buf_points_ex{};
     GLuint m_buf_normals_ex{};
     GLuint m_buf_wireframe_indices{};
+    GLuint m_buf_lod_indices{};
+    GLuint m_buf_cluster_points{};
+    GLuint m_buf_cluster_indices{};
 #endif
 };
 using MeshPtr = std::shared_ptr<Mesh>;
@@ -124,19 +162,155 @@ public:
     Points();
     ~Points() override;
     span<float3> getPoints() const override { return make_span(m_points); }
+    bool hasDrawRanges() const override { return m_has_draw_ranges; }
+    span<DrawRange> getDrawRanges() const override { return make_span(m_draw_ranges); }
 #ifdef wabcWithGL
     GLuint getPointBuffer() const override { return m_vb_points; }
 #endif
 
     void clear();
+    void assign(const Points& v);
     void upload();
 
 public:
     RawVector<float3> m_points;
+    bool m_has_draw_ranges = false;
+    RawVector<DrawRange> m_draw_ranges;
 #ifdef wabcWithGL
     GLuint m_vb_points{};
 #endif
 };
 using PointsPtr = std::shared_ptr<Points>;
 
+
+// true if path is one of paths or a descendant of them. empty paths, or an empty one in them, selects everything.
+bool IsPathSelected(const std::string& path, const std::vector<std::string>& paths);
+// glob match. '*' matches any sequence and '?' matches any single character.
+bool MatchPattern(const char* str, const char* pattern);
+// true if path or one of its ancestors matches one of patterns
+bool MatchPathPatterns(const std::string& path, const std::vector<std::string>& patterns);
+// applies SceneSettings::include_patterns and exclude_patterns. set geometry to false for non-geometry objects.
+bool IsPathIncluded(const std::string& path, const SceneSettings& settings, bool geometry);
+// false if the box is entirely outside one of the clip planes. mvp: local to clip space.
+bool IsInFrustum(const float4x4& mvp, float3 bmin, float3 bmax);
+// faces of mesh triangulated as fans like the expanded points, and the edges of its wireframe with each edge once.
+// indices to the points of mesh.
+void GetMeshTopology(const IMesh& mesh, std::vector<int>& triangles, std::vector<int>& edges);
+
+
+// istream that counts bytes handed to the reader. used to report load progress.
+class FileStream : public std::istream
+{
+public:
+    FileStream();
+    bool open(const char* path);
+    bool is_open() const;
+    uint64_t getSize() const;
+    uint64_t getBytesRead() const;
+
+private:
+    class Buffer : public std::filebuf
+    {
+    public:
+        std::atomic<uint64_t> m_bytes_read{};
+
+    protected:
+        std::streamsize xsgetn(char_type* dst, std::streamsize n) override;
+    };
+
+    Buffer m_buf;
+    uint64_t m_size{};
+};
+using FileStreamPtr = std::shared_ptr<FileStream>;
+
+
+// read-only memory mapping of a whole file. pages are loaded by the OS on first access.
+class MappedFile
+{
+public:
+    ~MappedFile();
+    bool open(const char* path);
+    void close();
+    const char* getData() const { return m_data; }
+    uint64_t getSize() const { return m_size; }
+    // nullptr if the count elements at offset are not in the file or offset is not aligned for T
+    template<class T> const T* get(uint64_t offset, uint64_t count = 1) const
+    {
+        if (offset > m_size || count > (m_size - offset) / sizeof(T) || (uintptr_t)(m_data + offset) % alignof(T) != 0)
+            return nullptr;
+        return (const T*)(m_data + offset);
+    }
+
+private:
+    const char* m_data{};
+    uint64_t m_size{};
+#ifdef _WIN32
+    void* m_file{};
+    void* m_mapping{};
+#endif
+};
+
+
+// bump allocator for scratch data that lives until the end of an evaluation. allocate() can be called from any thread.
+// requests beyond the block are served from the heap, and reset() grows the block to the peak usage,
+// so after the first frames every allocation comes from the block and evaluations don't touch the heap.
+class FrameArena
+{
+public:
+    ~FrameArena();
+    // memory is uninitialized. align must be a power of two.
+    void* allocate(size_t size, size_t align = 16);
+    template<class T> T* allocate(size_t n) { return (T*)allocate(sizeof(T) * n, alignof(T)); }
+    // invalidates everything allocated. must not be called while another thread allocates.
+    void reset();
+    size_t getCapacity() const { return m_capacity; }
+
+private:
+    char* m_block{};
+    size_t m_capacity{};
+    std::atomic<size_t> m_used{}; // may exceed m_capacity. that is the peak to grow to.
+    std::mutex m_mutex;
+    std::vector<void*> m_overflow; // guarded by m_mutex
+};
+
+
+// drives a resumable load job.
+// a step does a bounded amount of work and returns false when the job is finished.
+// steps run on a worker thread if threads are available. otherwise update() runs them on the main thread within a time budget.
+class LoadTask
+{
+public:
+    using Step = std::function<bool()>;
+
+    ~LoadTask();
+    // bytes_total is the size of the source if it is known before the job starts
+    void start(const Step& step, uint64_t bytes_total = 0);
+    void cancel();
+    void wait();
+    void fail(); // should be called from a step
+    bool update(double budget_ms = 8.0); // returns true while the job is running
+    bool isRunning() const;
+    bool isCanceled() const;
+    LoadProgress getProgress() const;
+
+public:
+    std::atomic<uint64_t> m_bytes_read{};
+    std::atomic<uint64_t> m_bytes_total{};
+    std::atomic<uint32_t> m_nodes_scanned{};
+    std::atomic<uint32_t> m_objects_baked{};
+
+private:
+    void finish();
+    // m_step(). an exception fails the job and ends it
+    bool runStep();
+
+    Step m_step;
+    std::atomic<LoadState> m_state{ LoadState::Idle };
+    std::atomic<bool> m_running{ false };
+    std::atomic<bool> m_canceled{ false };
+#ifdef wabcWithThreads
+    std::thread m_thread;
+#endif
+};
+
 } // namespace wabc
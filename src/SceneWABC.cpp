@@ -0,0 +1,616 @@
+#include "pch.h"
+#include "SceneGraph.h"
+#include "Parallel.h"
+#include "PositionCodec.h"
+#include "MeshPCA.h"
+
+namespace wabc {
+
+// .wabc: playback cache baked from another scene by ExportWABC(). little endian.
+// arrays start at 64 byte aligned offsets from the beginning of the file, so they are used in place from the mapped file.
+//   WABCHeader
+//   int triangle_indices[triangle_index_count]  indices to the points of a frame
+//   int edge_indices[edge_index_count]          pairs. each edge appears once
+//   char camera_paths[camera_paths_size]        null terminated strings
+//   per frame: points, float3 particles[WABCFrame::particle_count], WABCCamera cameras[camera_count]
+//   float3 pca_shapes[(pca_components + 1) * point_count]  the mean followed by the basis. if pca_components is not 0.
+//                                                          pca_shapes is 0 otherwise
+//   WABCFrame frames[frame_count]
+// points are float3[point_count] if quantize_step and pca_components are 0. if quantize_step is not 0, they are encoded by
+// PositionEncoder with quantize_step, keyframe_interval and origin, and decoded on seek.
+// if pca_components is not 0, they are float[pca_components] coefficients of the basis and reconstructed by MeshPCA.
+struct WABCHeader
+{
+    char magic[4];
+    uint32_t version;
+    double start_time;
+    double frame_rate;
+    uint32_t frame_count;
+    uint32_t point_count;
+    uint32_t triangle_index_count;
+    uint32_t edge_index_count;
+    uint32_t camera_count;
+    uint32_t camera_paths_size;
+    float quantize_step;
+    uint32_t keyframe_interval;
+    float3 origin;
+    uint32_t pca_components; // 0 in version 2
+    // offsets
+    uint64_t triangle_indices;
+    uint64_t edge_indices;
+    uint64_t camera_paths;
+    uint64_t frames;
+    uint64_t pca_shapes; // since version 3
+};
+
+struct WABCFrame
+{
+    // offsets
+    uint64_t points;
+    uint64_t particles;
+    uint64_t cameras;
+    uint64_t points_size; // bytes of the encoded points. 0 if not encoded
+    uint32_t particle_count;
+    uint32_t reserved;
+};
+
+struct WABCCamera
+{
+    float3 position;
+    float3 direction;
+    float3 up;
+    float focal_length;
+    float2 aperture;
+    float2 lens_shift;
+    float near_plane;
+    float far_plane;
+};
+
+static const char g_wabc_magic[4] = { 'W', 'A', 'B', 'C' };
+static const uint32_t g_wabc_version = 3;
+static const uint32_t g_wabc_min_version = 2; // version 2 is version 3 without pca
+static const uint64_t g_wabc_alignment = 64;
+
+
+// mesh and points whose positions are read in place from the mapped file
+class MappedMesh : public Mesh
+{
+public:
+    span<float3> getPoints() const override { return m_mapped_points; }
+    span<float3> m_mapped_points;
+};
+
+class MappedPoints : public Points
+{
+public:
+    span<float3> getPoints() const override { return m_mapped_points; }
+    span<float3> m_mapped_points;
+};
+
+
+class SceneWABC : public IScene
+{
+public:
+    // arrays of a frame in the mapped file
+    struct Frame
+    {
+        const float3* points{};   // null if encoded or pca coded
+        PositionBlock encoded;
+        const float* coefficients{}; // if pca coded
+        const float3* particles{};
+        size_t particle_count{};
+        const WABCCamera* cameras{};
+    };
+
+    ~SceneWABC() override;
+    void release() override;
+
+    void setSettings(const SceneSettings& v) override { m_settings = v; }
+    const SceneSettings& getSettings() const override { return m_settings; }
+
+    bool load(const char* path) override;
+    // the cache is a single baked scene. nothing can be merged into it.
+    bool loadAdditive(const char* path) override { return false; }
+    void unload() override;
+
+    // mapping the file takes no time. loads synchronously.
+    bool loadAsync(const char* path) override { return load(path); }
+    void cancelLoad() override {}
+    LoadProgress getLoadProgress() const override { return m_progress; }
+    void update() override {}
+
+    std::tuple<double, double> getTimeRange() const override;
+    // shows the nearest baked frame
+    void seek(double time, EvalMask mask = EvalMask::All) override;
+    // seeking is a lookup into the mapped file
+    void seekAsync(double time) override { seek(time); }
+    bool hasPendingFrame() const override { return false; }
+    bool evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback) override;
+    // objects are flattened into the monolithic mesh and points
+    void setEvalPaths(const std::vector<std::string>& paths) override {}
+    bool getGlobalMatrix(const std::string& path, float4x4& dst) const override { return false; }
+    void cull(const float4x4& view_proj, float2 screen_size) override {} // the cache has no per object bounds
+
+    double getTime() const override { return m_time; }
+    IMesh* getMesh() override { return m_mesh.get(); }
+    IPoints* getPoints() override { return m_points.get(); }
+    span<IMesh*> getInstancedMeshes() override { return {}; }
+    span<ICamera*> getCameras() override { return make_span(m_cameras); }
+
+private:
+    int getFrameIndex(double time) const;
+    bool isEncoded() const { return m_header->quantize_step > 0.0f; }
+    bool isPCACoded() const { return m_header->version >= 3 && m_header->pca_components > 0; }
+    bool getFramePoints(const Frame& frame, int fi, PositionDecoder& decoder, float3* dst) const;
+    PositionCodecParams getCodecParams() const;
+
+    SceneSettings m_settings;
+    MappedFile m_file;
+    const WABCHeader* m_header{};
+    std::vector<Frame> m_frames;
+    std::vector<PositionBlock> m_encoded_frames;
+    LoadProgress m_progress;
+
+    double m_time = -1.0;
+    int m_geometry_frame = -1; // frame uploaded to the mesh and points
+    std::shared_ptr<MappedMesh> m_mesh;
+    std::shared_ptr<MappedPoints> m_points;
+    PositionDecoder m_decoder;
+    MeshPCA m_pca;
+    RawVector<float3> m_decoded_points; // mesh points if they are encoded or pca coded
+    std::vector<CameraPtr> m_camera_data;
+    std::vector<ICamera*> m_cameras;
+};
+
+
+SceneWABC::~SceneWABC()
+{
+    unload();
+}
+
+void SceneWABC::release()
+{
+    delete this;
+}
+
+bool SceneWABC::load(const char* path)
+{
+    unload();
+    m_progress.state = LoadState::Failed;
+    if (!m_file.open(path))
+        return false;
+
+    auto fail = [this](const char* message) {
+        printf("SceneWABC::load(): %s\n", message);
+        unload();
+        m_progress.state = LoadState::Failed;
+        return false;
+    };
+
+    auto header = m_file.get<WABCHeader>(0);
+    if (!header || std::memcmp(header->magic, g_wabc_magic, 4) != 0)
+        return fail("not a .wabc file");
+    if (header->version < g_wabc_min_version || header->version > g_wabc_version)
+        return fail("unsupported version");
+    if (header->frame_count == 0 || header->frame_rate <= 0.0)
+        return fail("no frames");
+
+    auto triangles = m_file.get<int>(header->triangle_indices, header->triangle_index_count);
+    auto edges = m_file.get<int>(header->edge_indices, header->edge_index_count);
+    auto camera_paths = m_file.get<char>(header->camera_paths, header->camera_paths_size);
+    auto frames = m_file.get<WABCFrame>(header->frames, header->frame_count);
+    if (!triangles || !edges || !camera_paths || !frames)
+        return fail("broken file");
+    auto out_of_range = [&](const int* indices, uint32_t count) {
+        return std::any_of(indices, indices + count, [&](int i) { return (uint32_t)i >= header->point_count; });
+    };
+    if (out_of_range(triangles, header->triangle_index_count) || out_of_range(edges, header->edge_index_count))
+        return fail("broken file");
+
+    // check every array once here. seek() only does pointer arithmetic.
+    if (header->version >= 3 && header->pca_shapes != 0 && header->pca_components == 0)
+        return fail("broken file");
+    bool pca = header->version >= 3 && header->pca_components > 0;
+    if (pca) {
+        auto shapes = m_file.get<float3>(header->pca_shapes, ((uint64_t)header->pca_components + 1) * header->point_count);
+        if (!shapes)
+            return fail("broken file");
+        m_pca.setup(shapes, shapes + header->point_count, header->point_count, (int)header->pca_components);
+    }
+    m_frames.resize(header->frame_count);
+    for (uint32_t fi = 0; fi < header->frame_count; ++fi) {
+        auto& src = frames[fi];
+        auto& dst = m_frames[fi];
+        if (pca) {
+            dst.coefficients = m_file.get<float>(src.points, header->pca_components);
+            if (!dst.coefficients)
+                return fail("broken file");
+        }
+        else if (header->quantize_step > 0.0f) {
+            // the contents are validated when decoded
+            dst.encoded.data = m_file.get<uint8_t>(src.points, src.points_size);
+            dst.encoded.size = src.points_size;
+            if (!dst.encoded.data)
+                return fail("broken file");
+        }
+        else {
+            dst.points = m_file.get<float3>(src.points, header->point_count);
+            if (!dst.points)
+                return fail("broken file");
+        }
+        dst.particles = m_file.get<float3>(src.particles, src.particle_count);
+        dst.particle_count = src.particle_count;
+        dst.cameras = m_file.get<WABCCamera>(src.cameras, header->camera_count);
+        if (!dst.particles || !dst.cameras)
+            return fail("broken file");
+        m_encoded_frames.push_back(dst.encoded);
+    }
+
+    const char* name = camera_paths;
+    const char* names_end = camera_paths + header->camera_paths_size;
+    for (uint32_t ci = 0; ci < header->camera_count; ++ci) {
+        const char* term = std::find(name, names_end, '\0');
+        if (term == names_end)
+            return fail("broken file");
+        auto cam = std::make_shared<Camera>();
+        cam->m_path.assign(name, term);
+        m_camera_data.push_back(cam);
+        m_cameras.push_back(cam.get());
+        name = term + 1;
+    }
+
+    // triangles and edges are drawn as one indexed range. only positions change per frame.
+    m_mesh = std::make_shared<MappedMesh>();
+    m_mesh->m_lod_indices.assign(triangles, triangles + header->triangle_index_count);
+    m_mesh->m_lod_indices.resize(header->triangle_index_count + header->edge_index_count);
+    std::copy(edges, edges + header->edge_index_count, m_mesh->m_lod_indices.data() + header->triangle_index_count);
+    DrawRange range;
+    range.points_count = (int)header->point_count;
+    range.lod_offset = 0;
+    range.lod_count = (int)header->triangle_index_count;
+    range.lod_wireframe_offset = (int)header->triangle_index_count;
+    range.lod_wireframe_count = (int)header->edge_index_count;
+    m_mesh->m_has_draw_ranges = true;
+    m_mesh->m_draw_ranges.push_back(range);
+    m_mesh->upload();
+    m_points = std::make_shared<MappedPoints>();
+
+    m_header = header;
+    if (isEncoded())
+        m_decoder.setup(getCodecParams());
+    if (isEncoded() || isPCACoded())
+        m_decoded_points.resize(header->point_count);
+    m_progress.state = LoadState::Completed;
+    m_progress.bytes_read = m_progress.bytes_total = m_file.getSize();
+    seek(header->start_time);
+    return true;
+}
+
+void SceneWABC::unload()
+{
+    m_header = nullptr;
+    m_frames = {};
+    m_encoded_frames = {};
+    m_file.close();
+    m_progress = {};
+    m_time = -1.0;
+    m_geometry_frame = -1;
+    m_mesh = {};
+    m_points = {};
+    m_decoded_points = {};
+    m_pca.clear();
+    m_camera_data = {};
+    m_cameras = {};
+}
+
+std::tuple<double, double> SceneWABC::getTimeRange() const
+{
+    if (!m_header)
+        return {};
+    return { m_header->start_time, m_header->start_time + (m_header->frame_count - 1) / m_header->frame_rate };
+}
+
+PositionCodecParams SceneWABC::getCodecParams() const
+{
+    PositionCodecParams params;
+    params.num_points = m_header->point_count;
+    params.origin = m_header->origin;
+    params.step = m_header->quantize_step;
+    params.keyframe_interval = (int)m_header->keyframe_interval;
+    return params;
+}
+
+// frames that are not stored as they are. false if an encoded frame is broken.
+bool SceneWABC::getFramePoints(const Frame& frame, int fi, PositionDecoder& decoder, float3* dst) const
+{
+    if (isPCACoded()) {
+        m_pca.reconstruct(frame.coefficients, span<float3>{ dst, m_header->point_count });
+        return true;
+    }
+    return decoder.decode(m_encoded_frames.data(), fi, dst);
+}
+
+int SceneWABC::getFrameIndex(double time) const
+{
+    int fi = (int)std::round((time - m_header->start_time) * m_header->frame_rate);
+    return std::min(std::max(fi, 0), (int)m_header->frame_count - 1);
+}
+
+void SceneWABC::seek(double time, EvalMask mask)
+{
+    if (!m_header)
+        return;
+    m_time = time;
+    int fi = getFrameIndex(time);
+    auto& frame = m_frames[fi];
+
+    if (has_flag(mask, EvalMask::Geometry) && fi != m_geometry_frame) {
+        m_geometry_frame = fi;
+        const float3* points = frame.points;
+        if (!points) {
+            // playback decodes one frame of differences or adds the pca basis. a broken frame leaves the previous positions.
+            getFramePoints(frame, fi, m_decoder, m_decoded_points.data());
+            points = m_decoded_points.data();
+        }
+        m_mesh->m_mapped_points = span<float3>{ (float3*)points, m_header->point_count };
+        m_points->m_mapped_points = span<float3>{ (float3*)frame.particles, frame.particle_count };
+#ifdef wabcWithGL
+        // straight from the mapped pages to the GL buffers
+        if (!m_mesh->m_mapped_points.empty()) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_mesh->m_buf_points);
+            glBufferData(GL_ARRAY_BUFFER, m_mesh->m_mapped_points.size_bytes(), points, GL_STREAM_DRAW);
+        }
+        if (!m_points->m_mapped_points.empty()) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_points->m_vb_points);
+            glBufferData(GL_ARRAY_BUFFER, m_points->m_mapped_points.size_bytes(), frame.particles, GL_DYNAMIC_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+    }
+
+    if (has_flag(mask, EvalMask::Cameras)) {
+        size_t num_cameras = m_camera_data.size();
+        for (size_t ci = 0; ci < num_cameras; ++ci) {
+            auto& src = frame.cameras[ci];
+            auto& dst = *m_camera_data[ci];
+            dst.m_position = src.position;
+            dst.m_direction = src.direction;
+            dst.m_up = src.up;
+            dst.m_focal_length = src.focal_length;
+            dst.m_aperture = src.aperture;
+            dst.m_lens_shift = src.lens_shift;
+            dst.m_near = src.near_plane;
+            dst.m_far = src.far_plane;
+        }
+    }
+}
+
+bool SceneWABC::evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback)
+{
+    if (!m_header || dst.size() < times.size())
+        return false;
+
+    // encoded frames are decoded from the keyframe before them. each task has its own decoder and takes frames in order,
+    // so consecutive times decode one frame of differences each.
+    size_t num_frames = times.size();
+    size_t num_tasks = isEncoded() ? std::min((size_t)std::max(GetWorkerCount(), 1), num_frames) : num_frames;
+    std::atomic<size_t> next{ 0 };
+    std::atomic<bool> ok{ true };
+    parallel_for(0, (int)num_tasks, [&](int) {
+        PositionDecoder decoder;
+        if (isEncoded())
+            decoder.setup(getCodecParams());
+        for (size_t i; (i = next++) < num_frames; ) {
+            int fi = getFrameIndex(times[i]);
+            auto& src = m_frames[fi];
+            auto& frame = dst[i];
+            frame.time = times[i];
+            if (!src.points) {
+                frame.points.resize(m_header->point_count);
+                if (!getFramePoints(src, fi, decoder, frame.points.data()))
+                    ok = false;
+            }
+            else {
+                frame.points.assign(src.points, src.points + m_header->point_count);
+            }
+            frame.particles.assign(src.particles, src.particles + src.particle_count);
+            if (callback)
+                callback(i);
+        }
+    });
+    return ok;
+}
+
+
+bool ExportWABC(IScene* scene, const char* path, double frame_rate, float quantize_step, int pca_components)
+{
+    if (!scene || frame_rate <= 0.0)
+        return false;
+
+    auto time_range = scene->getTimeRange();
+    double start = std::get<0>(time_range);
+    int num_frames = (int)((std::get<1>(time_range) - start) * frame_rate + 1e-6) + 1;
+    scene->seek(start);
+    if (!scene->getInstancedMeshes().empty())
+        printf("ExportWABC(): instanced meshes are not exported\n");
+
+    // topology of the first frame
+    std::vector<int> triangles;
+    std::vector<int> edges;
+    size_t num_points = 0;
+    if (auto mesh = scene->getMesh()) {
+        num_points = mesh->getPoints().size();
+        GetMeshTopology(*mesh, triangles, edges);
+    }
+
+    // quantized around the center of the first frame
+    PositionCodecParams codec;
+    codec.num_points = num_points;
+    codec.step = quantize_step;
+    if (num_points > 0) {
+        auto points = scene->getMesh()->getPoints();
+        float3 bmin = points[0], bmax = points[0];
+        for (auto& p : points) {
+            bmin = min(bmin, p);
+            bmax = max(bmax, p);
+        }
+        codec.origin = (bmin + bmax) * 0.5f;
+    }
+    // pca needs all frames at once. they are kept until the end.
+    bool pca = pca_components > 0 && num_points > 0;
+    if (pca && quantize_step > 0.0f)
+        printf("ExportWABC(): quantize_step is ignored with pca_components\n");
+    RawVector<float3> all_points;
+    if (pca)
+        all_points.resize((size_t)num_frames * num_points);
+    std::vector<float> zero_coefficients(pca ? pca_components : 0);
+    bool encode = !pca && quantize_step > 0.0f;
+    PositionEncoder encoder;
+    encoder.setup(codec);
+    std::vector<uint8_t> encoded;
+
+    auto cameras = scene->getCameras();
+    std::string camera_paths;
+    for (auto cam : cameras) {
+        camera_paths += cam->getPath();
+        camera_paths += '\0';
+    }
+
+    std::ofstream os(path, std::ios::out | std::ios::binary);
+    if (!os)
+        return false;
+    auto write = [&](const void* data, size_t size) {
+        os.write((const char*)data, size);
+    };
+    // pads to the alignment and returns the offset of the next section
+    auto align = [&]() {
+        static const char zeros[g_wabc_alignment]{};
+        uint64_t pos = (uint64_t)os.tellp();
+        write(zeros, (size_t)((g_wabc_alignment - pos % g_wabc_alignment) % g_wabc_alignment));
+        return pos + (g_wabc_alignment - pos % g_wabc_alignment) % g_wabc_alignment;
+    };
+
+    WABCHeader header{};
+    std::memcpy(header.magic, g_wabc_magic, 4);
+    header.version = g_wabc_version;
+    header.start_time = start;
+    header.frame_rate = frame_rate;
+    header.frame_count = (uint32_t)num_frames;
+    header.point_count = (uint32_t)num_points;
+    header.triangle_index_count = (uint32_t)triangles.size();
+    header.edge_index_count = (uint32_t)edges.size();
+    header.camera_count = (uint32_t)cameras.size();
+    header.camera_paths_size = (uint32_t)camera_paths.size();
+    header.quantize_step = encode ? quantize_step : 0.0f;
+    header.keyframe_interval = (uint32_t)codec.keyframe_interval;
+    header.origin = codec.origin;
+    write(&header, sizeof(header)); // rewritten at the end with the offsets
+
+    header.triangle_indices = align();
+    write(triangles.data(), triangles.size() * sizeof(int));
+    header.edge_indices = align();
+    write(edges.data(), edges.size() * sizeof(int));
+    header.camera_paths = align();
+    write(camera_paths.data(), camera_paths.size());
+
+    // frames are evaluated in batches to bound memory
+    const int batch_size = 64;
+    std::vector<double> times(batch_size);
+    std::vector<FrameData> batch(batch_size);
+    std::vector<WABCFrame> frames;
+    std::vector<WABCCamera> camera_states(cameras.size());
+    for (int f0 = 0; f0 < num_frames; f0 += batch_size) {
+        int n = std::min(batch_size, num_frames - f0);
+        for (int i = 0; i < n; ++i)
+            times[i] = start + (f0 + i) / frame_rate;
+        if (!scene->evaluateRange(span<double>{ times.data(), (size_t)n }, span<FrameData>{ batch.data(), (size_t)n }))
+            return false;
+
+        for (int i = 0; i < n; ++i) {
+            auto& src = batch[i];
+            if (src.points.size() != num_points) {
+                printf("ExportWABC(): topology changes at time %lf\n", times[i]);
+                return false;
+            }
+            // evaluateRange() doesn't evaluate cameras
+            scene->seek(times[i], EvalMask::Cameras);
+            for (size_t ci = 0; ci < cameras.size(); ++ci) {
+                auto cam = cameras[ci];
+                auto& dst = camera_states[ci];
+                dst.position = cam->getPosition();
+                dst.direction = cam->getDirection();
+                dst.up = cam->getUp();
+                dst.focal_length = cam->getFocalLength();
+                dst.aperture = cam->getAperture();
+                dst.lens_shift = cam->getLensShift();
+                dst.near_plane = cam->getNearPlane();
+                dst.far_plane = cam->getFarPlane();
+            }
+
+            WABCFrame frame{};
+            frame.points = align();
+            if (pca) {
+                // the coefficients are written over this when the basis is built
+                std::copy(src.points.begin(), src.points.end(), all_points.data() + (size_t)(f0 + i) * num_points);
+                write(zero_coefficients.data(), zero_coefficients.size() * sizeof(float));
+            }
+            else if (encode) {
+                encoded.clear();
+                encoder.encode(src.points.data(), encoded);
+                write(encoded.data(), encoded.size());
+                frame.points_size = encoded.size();
+            }
+            else {
+                write(src.points.data(), src.points.size() * sizeof(float3));
+            }
+            frame.particles = align();
+            write(src.particles.data(), src.particles.size() * sizeof(float3));
+            frame.particle_count = (uint32_t)src.particles.size();
+            frame.cameras = align();
+            write(camera_states.data(), camera_states.size() * sizeof(WABCCamera));
+            frames.push_back(frame);
+        }
+    }
+
+    if (pca) {
+        MeshPCA builder;
+        if (!builder.build(all_points.data(), num_frames, num_points, pca_components))
+            return false;
+        all_points = {};
+        int K = builder.getComponentCount();
+        printf("ExportWABC(): %d components. rms error %f\n", K, builder.getError());
+        // frames that don't vary have no components. they get one zero shape, as PCA coded files must have at least one.
+        // its coefficients are the zeros already written to the frames.
+        header.pca_components = (uint32_t)std::max(K, 1);
+        header.pca_shapes = align();
+        write(builder.getMean().data(), builder.getMean().size_bytes());
+        for (int k = 0; k < K; ++k)
+            write(builder.getBasis(k).getDeltaPoints().data(), builder.getBasis(k).getDeltaPoints().size_bytes());
+        if (K == 0) {
+            std::vector<float3> zero_shape(num_points);
+            write(zero_shape.data(), zero_shape.size() * sizeof(float3));
+        }
+
+        header.frames = align();
+        write(frames.data(), frames.size() * sizeof(WABCFrame));
+        auto coefficients = builder.getCoefficients();
+        for (int f = 0; f < num_frames; ++f) {
+            os.seekp(frames[f].points);
+            write(coefficients.data() + (size_t)f * K, K * sizeof(float));
+        }
+    }
+    else {
+        header.frames = align();
+        write(frames.data(), frames.size() * sizeof(WABCFrame));
+    }
+    os.seekp(0);
+    write(&header, sizeof(header));
+    return os.good();
+}
+
+IScene* CreateSceneWABC_()
+{
+    return new SceneWABC();
+}
+
+} // namespace wabc
@@ -0,0 +1,149 @@
+#include "pch.h"
+#include "SkinDecomposition.h"
+#ifdef wabcWithEigen
+    #include "libSSDS.h"
+#endif
+
+namespace wabc {
+
+#ifdef wabcWithEigen
+// libSSDS has its own vector types with the same layout
+static_assert(sizeof(ssds::float3) == sizeof(float3), "");
+static_assert(sizeof(ssds::float4x4) == sizeof(float4x4), "");
+static_assert(sizeof(ssds::int2) == sizeof(int) * 2, "");
+#endif
+
+bool SkinDecomposition::build(IScene* scene, const SkinDecompositionSettings& settings)
+{
+    clear();
+    if (!scene || settings.frame_rate <= 0.0)
+        return false;
+#ifdef wabcWithEigen
+    auto time_range = scene->getTimeRange();
+    double start = std::get<0>(time_range);
+    int num_frames = (int)((std::get<1>(time_range) - start) * settings.frame_rate + 1e-6) + 1;
+    scene->seek(start);
+    auto mesh = scene->getMesh();
+    size_t num_points = mesh ? mesh->getPoints().size() : 0;
+    if (num_points == 0) {
+        printf("SkinDecomposition::build(): the scene has no mesh\n");
+        return false;
+    }
+    std::vector<int> triangles;
+    std::vector<int> edges;
+    GetMeshTopology(*mesh, triangles, edges);
+
+    // all frames are needed at once. they are evaluated in batches like BakeVAT().
+    RawVector<float3> all_points;
+    all_points.resize((size_t)num_frames * num_points);
+    const int batch_size = 64;
+    std::vector<double> times(batch_size);
+    std::vector<FrameData> batch(batch_size);
+    for (int f0 = 0; f0 < num_frames; f0 += batch_size) {
+        int n = std::min(batch_size, num_frames - f0);
+        for (int i = 0; i < n; ++i)
+            times[i] = start + (f0 + i) / settings.frame_rate;
+        if (!scene->evaluateRange(span<double>{ times.data(), (size_t)n }, span<FrameData>{ batch.data(), (size_t)n }))
+            return false;
+        for (int i = 0; i < n; ++i) {
+            auto& src = batch[i].points;
+            if (src.size() != num_points) {
+                printf("SkinDecomposition::build(): topology changes at time %lf\n", times[i]);
+                return false;
+            }
+            std::copy(src.begin(), src.end(), all_points.data() + (size_t)(f0 + i) * num_points);
+        }
+    }
+    m_rest_points.assign(all_points.data(), all_points.data() + num_points);
+
+    ssds::Input input;
+    input.rest_shape = { (const ssds::float3*)m_rest_points.data(), num_points };
+    input.samples = { (const ssds::float3*)all_points.data(), all_points.size() };
+    input.edges = { (const ssds::int2*)edges.data(), edges.size() / 2 };
+    input.num_joints = settings.max_joints;
+    input.num_indices = settings.max_influences;
+    input.num_iterations = settings.iterations;
+    input.transform_type = settings.scale ? ssds::TransformType::SRT : ssds::TransformType::RT;
+    ssds::Output output;
+    if (!ssds::Decompose(output, input)) {
+        clear();
+        return false;
+    }
+
+    // weights are packed per vertex without the unused slots
+    m_skin.m_counts.resize(num_points);
+    m_skin.m_weights.clear();
+    for (size_t vi = 0; vi < num_points; ++vi) {
+        int count = 0;
+        const ssds::JointWeight* weights = &output.weights[vi * output.num_indices];
+        for (int i = 0; i < output.num_indices; ++i) {
+            if (weights[i].index >= 0 && weights[i].weight > 0.0f) {
+                m_skin.m_weights.push_back({ weights[i].index, weights[i].weight });
+                ++count;
+            }
+        }
+        m_skin.m_counts[vi] = count;
+    }
+    m_skin.updateWeightOffsets();
+    m_start_time = start;
+    m_frame_rate = settings.frame_rate;
+    m_frame_count = num_frames;
+    m_joint_count = output.num_joints;
+    auto* matrices = (const float4x4*)output.matrices.data();
+    m_matrices.assign(matrices, matrices + output.matrices.size());
+
+    // the error of what is actually played rather than the solver's
+    double total = 0.0;
+    RawVector<float3> played;
+    played.resize(num_points);
+    for (int f = 0; f < num_frames; ++f) {
+        deformPoints(f, make_span(played));
+        const float3* src = all_points.data() + (size_t)f * num_points;
+        for (size_t vi = 0; vi < num_points; ++vi)
+            total += length_sq(played[vi] - src[vi]);
+    }
+    m_error = (float)std::sqrt(total / ((double)num_frames * num_points));
+    return true;
+#else
+    printf("SkinDecomposition::build(): libSSDS is not available\n");
+    return false;
+#endif
+}
+
+void SkinDecomposition::clear()
+{
+    m_start_time = m_frame_rate = 0.0;
+    m_frame_count = m_joint_count = 0;
+    m_rest_points.clear();
+    m_skin.m_counts.clear();
+    m_skin.m_weights.clear();
+    m_skin.m_matrices.clear();
+    m_matrices.clear();
+    m_error = 0.0f;
+}
+
+span<float4x4> SkinDecomposition::getJointMatrices(int frame) const
+{
+    return { m_matrices.data() + (size_t)frame * m_joint_count, (size_t)m_joint_count };
+}
+
+size_t SkinDecomposition::getDataSize() const
+{
+    return sizeof(int) * m_skin.m_counts.size() + sizeof(JointWeight) * m_skin.m_weights.size() + sizeof(float4x4) * m_matrices.size();
+}
+
+size_t SkinDecomposition::getSourceDataSize() const
+{
+    return sizeof(float3) * m_rest_points.size() * m_frame_count;
+}
+
+bool SkinDecomposition::deformPoints(int frame, span<float3> dst)
+{
+    if (frame < 0 || frame >= m_frame_count)
+        return false;
+    auto matrices = getJointMatrices(frame);
+    m_skin.m_matrices.assign(matrices.begin(), matrices.end());
+    return m_skin.deformPoints(dst, getRestPoints());
+}
+
+} // namespace wabc
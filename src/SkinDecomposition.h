@@ -0,0 +1,54 @@
+#pragma once
+#include "SceneGraph.h"
+
+namespace wabc {
+
+struct SkinDecompositionSettings
+{
+    double frame_rate = 30.0;
+    int max_joints = 32;
+    int max_influences = 4; // joints per vertex
+    int iterations = 10;
+    bool scale = false;     // joints scale in addition to rotating and translating
+};
+
+// linear blend skinning that approximates the mesh animation of a scene, made by libSSDS.
+// the rest shape is the first frame. a frame is its points skinned by the frame's joint matrices,
+// so per frame data is num_joints matrices instead of num_points points.
+class SkinDecomposition
+{
+public:
+    // evaluates the monolithic mesh of scene at frame_rate from the start to the end of its time range.
+    // false if there is no mesh, its topology changes, or libSSDS is not available (it needs Eigen).
+    bool build(IScene* scene, const SkinDecompositionSettings& settings);
+    void clear();
+
+    double getStartTime() const { return m_start_time; }
+    double getFrameRate() const { return m_frame_rate; }
+    int getFrameCount() const { return m_frame_count; }
+    int getJointCount() const { return m_joint_count; }
+    span<float3> getRestPoints() const { return make_span(m_rest_points); }
+    // weights of the joints. its matrices are of the last frame given to deformPoints()
+    const Skin& getSkin() const { return m_skin; }
+    span<float4x4> getJointMatrices(int frame) const;
+    // rms distance between the evaluated frames and the frames played by deformPoints(). only after build()
+    float getError() const { return m_error; }
+    // bytes of the weights and matrices, and of the points of all frames that they replace
+    size_t getDataSize() const;
+    size_t getSourceDataSize() const;
+
+    // dst = the rest points skinned by the joint matrices of frame. dst must have getRestPoints().size() points.
+    bool deformPoints(int frame, span<float3> dst);
+
+private:
+    double m_start_time{};
+    double m_frame_rate{};
+    int m_frame_count{};
+    int m_joint_count{};
+    RawVector<float3> m_rest_points;
+    Skin m_skin;
+    RawVector<float4x4> m_matrices; // m_frame_count * m_joint_count, frame major
+    float m_error{};
+};
+
+} // namespace wabc
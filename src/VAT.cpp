@@ -0,0 +1,403 @@
+#include "pch.h"
+#include "SceneGraph.h"
+#include "Parallel.h"
+
+namespace wabc {
+
+// .wvat: vertex animation textures written by ExportVAT(). little endian.
+// arrays start at 64 byte aligned offsets from the beginning of the file like .wabc.
+//   WVATHeader
+//   VATObject objects[object_count]
+//   int indices[index_count]
+//   float3 points[frame_count * point_count]   frame major
+//   float3 normals[frame_count * point_count]  if has_normals is not 0
+struct WVATHeader
+{
+    char magic[4];
+    uint32_t version;
+    double start_time;
+    double frame_rate;
+    uint32_t frame_count;
+    uint32_t point_count;
+    uint32_t object_count;
+    uint32_t index_count;
+    uint32_t has_normals;
+    uint32_t reserved;
+    // offsets
+    uint64_t objects;
+    uint64_t indices;
+    uint64_t points;
+    uint64_t normals;
+};
+
+static const char g_wvat_magic[4] = { 'W', 'V', 'A', 'T' };
+static const uint32_t g_wvat_version = 1;
+static const uint64_t g_wvat_alignment = 64;
+
+// texels are laid out in rows of up to this many, and layers of up to this many rows.
+// both are the minimum GL_MAX_TEXTURE_SIZE of GLES 3.0, so only the layer count depends on the device.
+static const size_t g_vat_texture_size = 2048;
+
+
+class VAT : public IVAT
+{
+public:
+    ~VAT() override;
+    void release() override;
+
+    double getStartTime() const override { return m_start_time; }
+    double getFrameRate() const override { return m_frame_rate; }
+    int getFrameCount() const override { return m_frame_count; }
+    int getPointCount() const override { return m_point_count; }
+    span<VATObject> getObjects() const override { return make_span(m_objects); }
+    span<int> getIndices() const override { return make_span(m_indices); }
+    span<float3> getPoints(int frame) const override { return getFrame(m_points, frame); }
+    span<float3> getNormals(int frame) const override { return getFrame(m_normals, frame); }
+
+    bool upload() override;
+#ifdef wabcWithGL
+    GLuint getPointsTexture() const override { return m_tex_points; }
+    GLuint getNormalsTexture() const override { return m_tex_normals; }
+    GLuint getIndicesBuffer() const override { return m_buf_indices; }
+#endif
+
+    void computeNormals();
+
+private:
+    span<float3> getFrame(const RawVector<float3>& src, int frame) const;
+
+public:
+    double m_start_time{};
+    double m_frame_rate = 30.0;
+    int m_frame_count{};
+    int m_point_count{};
+    RawVector<VATObject> m_objects;
+    RawVector<int> m_indices;
+    RawVector<float3> m_points;  // frame major
+    RawVector<float3> m_normals; // same layout as m_points. empty if not baked
+
+#ifdef wabcWithGL
+    GLuint m_tex_points{};
+    GLuint m_tex_normals{};
+    GLuint m_buf_indices{};
+#endif
+};
+
+
+VAT::~VAT()
+{
+#ifdef wabcWithGL
+    glDeleteTextures(1, &m_tex_points);
+    glDeleteTextures(1, &m_tex_normals);
+    glDeleteBuffers(1, &m_buf_indices);
+#endif
+}
+
+void VAT::release()
+{
+    delete this;
+}
+
+span<float3> VAT::getFrame(const RawVector<float3>& src, int frame) const
+{
+    if (src.empty() || frame < 0 || frame >= m_frame_count)
+        return {};
+    return span<float3>{ (float3*)src.data() + (size_t)frame * m_point_count, (size_t)m_point_count };
+}
+
+void VAT::computeNormals()
+{
+    m_normals.resize_zeroclear(m_points.size());
+    parallel_for(0, m_frame_count, [this](int f) {
+        size_t base = (size_t)f * m_point_count;
+        const float3* points = m_points.data() + base;
+        float3* normals = m_normals.data() + base;
+        // area weighted face normals accumulated to the points. points objects have no triangles and keep zero.
+        for (auto& obj : m_objects) {
+            const int* tri = m_indices.data() + obj.triangles_offset;
+            for (int i = 0; i + 2 < obj.triangles_count; i += 3) {
+                int a = tri[i], b = tri[i + 1], c = tri[i + 2];
+                float3 n = cross(points[b] - points[a], points[c] - points[a]);
+                normals[a] += n;
+                normals[b] += n;
+                normals[c] += n;
+            }
+        }
+        for (int i = 0; i < m_point_count; ++i) {
+            float len = length(normals[i]);
+            if (len > 0.0f)
+                normals[i] = normals[i] / len;
+        }
+    });
+}
+
+#ifdef wabcWithGL
+static GLuint CreateVATTexture(const float3* data, size_t count)
+{
+    size_t width = std::min(count, g_vat_texture_size);
+    size_t rows = (count + width - 1) / width;
+    size_t layer_rows = std::min(rows, g_vat_texture_size);
+    size_t layers = (rows + layer_rows - 1) / layer_rows;
+    GLint max_layers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    if (layers > (size_t)max_layers) {
+        printf("VAT::upload(): %zu texels need %zu layers (%d supported)\n", count, layers, max_layers);
+        return 0;
+    }
+
+    GLuint tex{};
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    // fetched with texelFetch(). float textures are not filterable.
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB32F, (GLsizei)width, (GLsizei)layer_rows, (GLsizei)layers);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    size_t layer_size = width * layer_rows;
+    for (size_t l = 0; l < layers; ++l) {
+        // full rows, then the rest of the last row
+        size_t first = l * layer_size;
+        size_t n = std::min(count - first, layer_size);
+        size_t full_rows = n / width;
+        size_t rest = n % width;
+        if (full_rows > 0)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)l, (GLsizei)width, (GLsizei)full_rows, 1, GL_RGB, GL_FLOAT, data + first);
+        if (rest > 0)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, (GLint)full_rows, (GLint)l, (GLsizei)rest, 1, 1, GL_RGB, GL_FLOAT, data + first + full_rows * width);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return tex;
+}
+#endif
+
+bool VAT::upload()
+{
+#ifdef wabcWithGL
+    if (m_points.empty())
+        return false;
+    if (!m_tex_points)
+        m_tex_points = CreateVATTexture(m_points.data(), m_points.size());
+    if (!m_tex_normals && !m_normals.empty())
+        m_tex_normals = CreateVATTexture(m_normals.data(), m_normals.size());
+    if (!m_buf_indices && !m_indices.empty()) {
+        glGenBuffers(1, &m_buf_indices);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buf_indices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(int), m_indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    return m_tex_points != 0 && (m_normals.empty() || m_tex_normals != 0);
+#else
+    return false;
+#endif
+}
+
+
+IVAT* BakeVAT_(IScene* scene, double frame_rate, bool normals)
+{
+    if (!scene || frame_rate <= 0.0)
+        return nullptr;
+
+    auto time_range = scene->getTimeRange();
+    double start = std::get<0>(time_range);
+    int num_frames = (int)((std::get<1>(time_range) - start) * frame_rate + 1e-6) + 1;
+    scene->seek(start);
+    if (!scene->getInstancedMeshes().empty())
+        printf("BakeVAT(): instanced meshes are not baked\n");
+
+    std::vector<int> triangles;
+    std::vector<int> edges;
+    size_t num_mesh_points = 0;
+    if (auto mesh = scene->getMesh()) {
+        num_mesh_points = mesh->getPoints().size();
+        GetMeshTopology(*mesh, triangles, edges);
+    }
+
+    // frames come from evaluateRange() rather than seek(). it evaluates them in parallel and nothing is culled.
+    // a frame is mesh points followed by particles. the particle count is taken from the first frame.
+    std::unique_ptr<VAT> ret(new VAT());
+    const int batch_size = 64;
+    std::vector<double> times(batch_size);
+    std::vector<FrameData> batch(batch_size);
+    size_t num_particles = 0;
+    bool keep_particles = true;
+    size_t stride = 0;
+    for (int f0 = 0; f0 < num_frames; f0 += batch_size) {
+        int n = std::min(batch_size, num_frames - f0);
+        for (int i = 0; i < n; ++i)
+            times[i] = start + (f0 + i) / frame_rate;
+        if (!scene->evaluateRange(span<double>{ times.data(), (size_t)n }, span<FrameData>{ batch.data(), (size_t)n }))
+            return nullptr;
+
+        if (f0 == 0) {
+            num_particles = batch[0].particles.size();
+            stride = num_mesh_points + num_particles;
+            ret->m_points.resize((size_t)num_frames * stride);
+        }
+        for (int i = 0; i < n; ++i) {
+            auto& src = batch[i];
+            if (src.points.size() != num_mesh_points) {
+                printf("BakeVAT(): topology changes at time %lf\n", times[i]);
+                return nullptr;
+            }
+            if (keep_particles && src.particles.size() != num_particles) {
+                printf("BakeVAT(): point count changes at time %lf. points are not baked\n", times[i]);
+                keep_particles = false;
+            }
+            float3* dst = ret->m_points.data() + (size_t)(f0 + i) * stride;
+            std::copy(src.points.begin(), src.points.end(), dst);
+            if (keep_particles)
+                std::copy(src.particles.begin(), src.particles.end(), dst + num_mesh_points);
+        }
+    }
+
+    if (!keep_particles && num_particles > 0) {
+        // close the gaps of the dropped particles. frames only move towards the front.
+        for (int f = 1; f < num_frames; ++f) {
+            float3* points = ret->m_points.data();
+            std::memmove(points + (size_t)f * num_mesh_points, points + (size_t)f * stride, num_mesh_points * sizeof(float3));
+        }
+        num_particles = 0;
+        ret->m_points.resize((size_t)num_frames * num_mesh_points);
+    }
+    if (num_mesh_points + num_particles == 0) {
+        printf("BakeVAT(): nothing to bake\n");
+        return nullptr;
+    }
+
+    ret->m_start_time = start;
+    ret->m_frame_rate = frame_rate;
+    ret->m_frame_count = num_frames;
+    ret->m_point_count = (int)(num_mesh_points + num_particles);
+    ret->m_indices.assign(triangles.data(), triangles.data() + triangles.size());
+    ret->m_indices.resize(triangles.size() + edges.size());
+    std::copy(edges.begin(), edges.end(), ret->m_indices.data() + triangles.size());
+    if (num_mesh_points > 0) {
+        VATObject obj;
+        obj.points_offset = 0;
+        obj.points_count = (int)num_mesh_points;
+        obj.triangles_offset = 0;
+        obj.triangles_count = (int)triangles.size();
+        obj.edges_offset = (int)triangles.size();
+        obj.edges_count = (int)edges.size();
+        ret->m_objects.push_back(obj);
+    }
+    if (num_particles > 0) {
+        VATObject obj;
+        obj.points_offset = (int)num_mesh_points;
+        obj.points_count = (int)num_particles;
+        ret->m_objects.push_back(obj);
+    }
+    if (normals)
+        ret->computeNormals();
+    return ret.release();
+}
+
+IVAT* LoadVAT_(const char* path)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return nullptr;
+
+    auto fail = [](const char* message) -> IVAT* {
+        printf("LoadVAT(): %s\n", message);
+        return nullptr;
+    };
+
+    auto header = file.get<WVATHeader>(0);
+    if (!header || std::memcmp(header->magic, g_wvat_magic, 4) != 0)
+        return fail("not a .wvat file");
+    if (header->version != g_wvat_version)
+        return fail("unsupported version");
+    if (header->frame_count == 0 || header->point_count == 0 || header->frame_rate <= 0.0)
+        return fail("no frames");
+
+    uint64_t num_texels = (uint64_t)header->frame_count * header->point_count;
+    auto objects = file.get<VATObject>(header->objects, header->object_count);
+    auto indices = file.get<int>(header->indices, header->index_count);
+    auto points = file.get<float3>(header->points, num_texels);
+    auto normals = header->has_normals ? file.get<float3>(header->normals, num_texels) : nullptr;
+    if (!objects || !indices || !points || (header->has_normals && !normals))
+        return fail("broken file");
+
+    // ranges are checked here, so that drawing can't read out of the textures and buffers
+    auto in_range = [](int offset, int count, uint32_t size) {
+        return offset >= 0 && count >= 0 && (uint64_t)offset + count <= size;
+    };
+    for (uint32_t oi = 0; oi < header->object_count; ++oi) {
+        auto& obj = objects[oi];
+        if (!in_range(obj.points_offset, obj.points_count, header->point_count) ||
+            !in_range(obj.triangles_offset, obj.triangles_count, header->index_count) ||
+            !in_range(obj.edges_offset, obj.edges_count, header->index_count))
+            return fail("broken file");
+    }
+    if (std::any_of(indices, indices + header->index_count, [&](int i) { return (uint32_t)i >= header->point_count; }))
+        return fail("broken file");
+
+    auto ret = new VAT();
+    ret->m_start_time = header->start_time;
+    ret->m_frame_rate = header->frame_rate;
+    ret->m_frame_count = (int)header->frame_count;
+    ret->m_point_count = (int)header->point_count;
+    ret->m_objects.assign(objects, objects + header->object_count);
+    ret->m_indices.assign(indices, indices + header->index_count);
+    ret->m_points.assign(points, points + num_texels);
+    if (normals)
+        ret->m_normals.assign(normals, normals + num_texels);
+    return ret;
+}
+
+bool ExportVAT(IVAT* vat, const char* path)
+{
+    if (!vat || vat->getFrameCount() == 0)
+        return false;
+
+    std::ofstream os(path, std::ios::out | std::ios::binary);
+    if (!os)
+        return false;
+    auto write = [&](const void* data, size_t size) {
+        os.write((const char*)data, size);
+    };
+    // pads to the alignment and returns the offset of the next section
+    auto align = [&]() {
+        static const char zeros[g_wvat_alignment]{};
+        uint64_t pos = (uint64_t)os.tellp();
+        write(zeros, (size_t)((g_wvat_alignment - pos % g_wvat_alignment) % g_wvat_alignment));
+        return pos + (g_wvat_alignment - pos % g_wvat_alignment) % g_wvat_alignment;
+    };
+
+    auto objects = vat->getObjects();
+    auto indices = vat->getIndices();
+    int num_frames = vat->getFrameCount();
+    bool has_normals = !vat->getNormals(0).empty();
+
+    WVATHeader header{};
+    std::memcpy(header.magic, g_wvat_magic, 4);
+    header.version = g_wvat_version;
+    header.start_time = vat->getStartTime();
+    header.frame_rate = vat->getFrameRate();
+    header.frame_count = (uint32_t)num_frames;
+    header.point_count = (uint32_t)vat->getPointCount();
+    header.object_count = (uint32_t)objects.size();
+    header.index_count = (uint32_t)indices.size();
+    header.has_normals = has_normals ? 1 : 0;
+    write(&header, sizeof(header)); // rewritten at the end with the offsets
+
+    header.objects = align();
+    write(objects.data(), objects.size_bytes());
+    header.indices = align();
+    write(indices.data(), indices.size_bytes());
+    header.points = align();
+    for (int f = 0; f < num_frames; ++f)
+        write(vat->getPoints(f).data(), vat->getPoints(f).size_bytes());
+    if (has_normals) {
+        header.normals = align();
+        for (int f = 0; f < num_frames; ++f)
+            write(vat->getNormals(f).data(), vat->getNormals(f).size_bytes());
+    }
+
+    os.seekp(0);
+    write(&header, sizeof(header));
+    return os.good();
+}
+
+} // namespace wabc
@@ -51,14 +51,43 @@ public:
 class IBlendShape : public IEntity
 {
 public:
-    virtual span<int> getIndices() const = 0; // indices to vertices
+    virtual span<int> getIndices() const = 0; // indices to vertices. empty if the deltas are dense (one per vertex)
     virtual span<float3> getDeltaPoints() const = 0;
     virtual span<float3> getDeltaNormals() const = 0;
 
+    // dst = src + deltas * w
     virtual bool deformPoints(span<float3> dst, span<float3> src, float w) const = 0;
     virtual bool deformNormals(span<float3> dst, span<float3> src, float w) const = 0;
 };
 
+// part of a monolithic mesh or points. offsets and counts of expanded points (faces), wireframe indices and points.
+struct DrawRange
+{
+    int points_ex_offset{};
+    int points_ex_count{};
+    int wireframe_offset{};
+    int wireframe_count{};
+    int points_offset{};
+    int points_count{};
+    // simplified level of detail. if lod_count is not 0, faces and wireframe are drawn from IMesh::getLODIndices() instead.
+    int lod_offset{};
+    int lod_count{};
+    int lod_wireframe_offset{};
+    int lod_wireframe_count{};
+};
+
+// part of a clustered mesh. offsets and counts of IMesh::getClusterPoints() and IMesh::getClusterIndices().
+// indices are local to the cluster's points, so they fit in 16 bit.
+struct MeshCluster
+{
+    int vertex_offset{};
+    int vertex_count{};
+    int index_offset{};
+    int index_count{};
+    float3 bmin{}; // world space bounds
+    float3 bmax{};
+};
+
 class IMesh : public IEntity
 {
 public:
@@ -69,12 +98,28 @@ public:
     virtual span<int> getCounts() const = 0;
     virtual span<int> getFaceIndices() const = 0;
     virtual span<int> getWireframeIndices() const = 0;
+    virtual span<int> getLODIndices() const = 0; // indices to points. referred by DrawRange
+    // empty if points are in world space. otherwise points are in local space and the mesh is drawn once per matrix.
+    virtual span<float4x4> getInstanceMatrices() const = 0;
+    // if hasDrawRanges() is true, only getDrawRanges() are drawn. used to skip culled objects.
+    virtual bool hasDrawRanges() const = 0;
+    virtual span<DrawRange> getDrawRanges() const = 0;
+    // faces of clustered objects. they are not in getPointsEx() and drawn per cluster instead.
+    virtual span<float3> getClusterPoints() const = 0;
+    // if not empty, cluster points are 3 x snorm16 per point quantized against each cluster's bounds, and getClusterPoints() is empty
+    virtual span<int16_t> getClusterPointsQuantized() const = 0;
+    virtual span<uint16_t> getClusterIndices() const = 0;
+    virtual span<MeshCluster> getClusters() const = 0;
+    virtual span<int> getVisibleClusters() const = 0; // indices to getClusters(). used if hasDrawRanges() is true
 
 #ifdef wabcWithGL
     virtual GLuint getPointsBuffer() const = 0;
     virtual GLuint getPointsExBuffer() const = 0;
     virtual GLuint getNormalsExBuffer() const = 0;
     virtual GLuint getWireframeIndicesBuffer() const = 0;
+    virtual GLuint getLODIndicesBuffer() const = 0;
+    virtual GLuint getClusterPointsBuffer() const = 0;
+    virtual GLuint getClusterIndicesBuffer() const = 0;
 #endif
 };
 
@@ -82,36 +127,218 @@ class IPoints : public IEntity
 {
 public:
     virtual span<float3> getPoints() const = 0;
+    virtual bool hasDrawRanges() const = 0;
+    virtual span<DrawRange> getDrawRanges() const = 0; // points_offset and points_count are used
 #ifdef wabcWithGL
     virtual GLuint getPointBuffer() const = 0;
 #endif
 };
 
+enum class LoadState
+{
+    Idle,
+    Loading,
+    Completed,
+    Failed,
+    Canceled,
+};
+
+struct LoadProgress
+{
+    LoadState state = LoadState::Idle;
+    uint64_t bytes_read{};
+    uint64_t bytes_total{};
+    uint32_t nodes_scanned{};
+    uint32_t objects_baked{};
+};
+
+struct SceneSettings
+{
+    // FBX: sample animated transforms and blend shape weights onto a frame grid at load time.
+    // seek() becomes a table lookup instead of evaluating every animation curve.
+    bool bake_animation = false;
+    float bake_frame_rate = 30.0f;
+    bool interpolate = true; // interpolate between baked frames. false: nearest frame
+
+    // load time object filter. glob patterns ('*' and '?') matched against object paths and their ancestors' paths.
+    // excluded objects are not loaded with their descendants. if include_patterns is not empty, only geometry that matches is loaded.
+    std::vector<std::string> include_patterns;
+    std::vector<std::string> exclude_patterns;
+    // skip geometry hidden by visibility, including visibility inherited from parents
+    bool skip_invisible = true;
+
+    // ABC: geometry shared by multiple objects (instances, or meshes that refer to the same array samples)
+    // is decoded once and drawn with per-object matrices instead of being baked into the monolithic mesh.
+    bool instancing = true;
+
+    // ABC: objects whose self bounds are outside the view frustum given by IScene::cull() are not drawn.
+    bool frustum_culling = true;
+    // ABC: culled objects are not decoded either. moving the camera re-decodes the mesh when culled objects come into view.
+    bool cull_decode = false;
+
+    // ABC: build up to lod_levels simplified index sets at load for constant topology meshes with lod_min_triangles or more.
+    // levels are picked per object by IScene::cull() so that the simplification error stays under lod_pixel_error pixels.
+    // positions still come from the full resolution samples.
+    int lod_levels = 0;
+    int lod_min_triangles = 20000;
+    float lod_pixel_error = 1.5f;
+
+    // ABC: split constant topology meshes into clusters of up to cluster_triangles triangles at load.
+    // clusters are culled individually and indexed with 16 bit indices. vertices of objects whose positions and matrices
+    // didn't change are not uploaded again.
+    bool mesh_clusters = false;
+    int cluster_triangles = 256;
+    // ABC: cluster points are quantized to 16 bit integers against each cluster's bounds. halves their upload size.
+    bool quantize_points = false;
+
+    // ABC: geometry at times between stored samples. if false, the sample at or before the time is used.
+    // if true, meshes and points with velocities are extrapolated from that sample, and other constant topology meshes
+    // are blended with the next sample. the two samples are kept, so stepping through an interval reads nothing.
+    bool interpolate_samples = false;
+
+    // ABC: if not 0, points are sorted into a spatial hierarchy when decoded and at most points_budget of them are drawn,
+    // about points_density per pixel of the screen area they cover.
+    int points_budget = 0;
+    float points_density = 1.0f;
+};
+
+// parts of the scene evaluated by IScene::seek()
+enum class EvalMask : uint32_t
+{
+    None = 0,
+    Transforms = 0x1,
+    Cameras = 0x2,
+    Geometry = 0x4,
+    All = 0x7,
+};
+inline EvalMask operator|(EvalMask a, EvalMask b) { return EvalMask((uint32_t)a | (uint32_t)b); }
+inline EvalMask operator&(EvalMask a, EvalMask b) { return EvalMask((uint32_t)a & (uint32_t)b); }
+inline bool has_flag(EvalMask v, EvalMask f) { return ((uint32_t)v & (uint32_t)f) != 0; }
+
+// a frame evaluated by IScene::evaluateRange(). owned by the caller. the vectors keep their capacity when reused.
+struct FrameData
+{
+    double time{};
+    std::vector<float3> points;    // same layout as IMesh::getPoints() of the monolithic mesh
+    std::vector<float3> particles; // same layout as IPoints::getPoints() of the monolithic points without points_budget
+};
+
 class IScene
 {
 public:
     virtual ~IScene() {};
     virtual void release() = 0;
 
+    // settings must be set before load
+    virtual void setSettings(const SceneSettings& v) = 0;
+    virtual const SceneSettings& getSettings() const = 0;
+
     virtual bool load(const char* path) = 0;
     virtual bool loadAdditive(const char* path) = 0;
     virtual void unload() = 0;
 
+    // returns immediately. loading proceeds in background and objects become visible as they are ready.
+    // update() must be called every frame on the render thread while loading.
+    virtual bool loadAsync(const char* path) = 0;
+    virtual void cancelLoad() = 0;
+    virtual LoadProgress getLoadProgress() const = 0;
+    virtual void update() = 0;
+
     virtual std::tuple<double, double> getTimeRange() const = 0;
-    virtual void seek(double time) = 0;
+    // parts not in mask are not evaluated and keep their previous state.
+    // e.g. EvalMask::Cameras updates cameras without rebuilding the mesh.
+    virtual void seek(double time, EvalMask mask = EvalMask::All) = 0;
+    // evaluates time on a worker thread and returns immediately. the frame is shown by update() when it is ready.
+    // only the latest request is evaluated; requests made while the worker is busy replace each other.
+    // meant for scrubbing. a following seek() waits for the worker and evaluates synchronously.
+    virtual void seekAsync(double time) = 0;
+    // true while a frame requested by seekAsync() is being evaluated or waits for update()
+    virtual bool hasPendingFrame() const = 0;
+    // evaluates world space positions at each of times into dst (at least times.size() elements). frames are evaluated
+    // concurrently on the worker threads. callback, if any, is called on a worker with the index of each finished frame.
+    // nothing is culled, and the frame shown by getMesh() and getPoints() is not changed.
+    virtual bool evaluateRange(span<double> times, span<FrameData> dst, const std::function<void(size_t)>& callback = {}) = 0;
+    // restricts evaluation to the objects at or under the given paths. empty: everything.
+    virtual void setEvalPaths(const std::vector<std::string>& paths) = 0;
+    // global matrix of the object at path as of the last seek with EvalMask::Transforms.
+    virtual bool getGlobalMatrix(const std::string& path, float4x4& dst) const = 0;
+    // culls objects against the frustum of view_proj (IRenderer::getViewProjection()) and picks levels of detail for screen_size.
+    // should be called when the camera moves.
+    virtual void cull(const float4x4& view_proj, float2 screen_size) = 0;
 
     virtual double getTime() const = 0;
     virtual IMesh* getMesh() = 0;     // monolithic mesh
     virtual IPoints* getPoints() = 0; // monolithic points
+    virtual span<IMesh*> getInstancedMeshes() = 0; // shared geometry. not included in the monolithic mesh
     virtual span<ICamera*> getCameras() = 0;
 };
 IScene* CreateSceneABC_();
 IScene* CreateSceneFBX_();
-IScene* LoadScene_(const char* path);
+IScene* CreateSceneWABC_(); // playback cache written by ExportWABC()
+IScene* LoadScene_(const char* path, const SceneSettings& settings = {});
+IScene* LoadSceneAsync_(const char* path, const SceneSettings& settings = {});
 using IScenePtr = std::shared_ptr<IScene>;
 inline IScenePtr CreateSceneABC() { return IScenePtr(CreateSceneABC_(), releaser<IScene>()); }
 inline IScenePtr CreateSceneFBX() { return IScenePtr(CreateSceneFBX_(), releaser<IScene>()); }
-inline IScenePtr LoadScene(const char* path) { return IScenePtr(LoadScene_(path), releaser<IScene>()); }
+inline IScenePtr CreateSceneWABC() { return IScenePtr(CreateSceneWABC_(), releaser<IScene>()); }
+inline IScenePtr LoadScene(const char* path, const SceneSettings& settings = {}) { return IScenePtr(LoadScene_(path, settings), releaser<IScene>()); }
+inline IScenePtr LoadSceneAsync(const char* path, const SceneSettings& settings = {}) { return IScenePtr(LoadSceneAsync_(path, settings), releaser<IScene>()); }
+// bakes the monolithic mesh, points and cameras of scene at frame_rate into a .wabc playback cache.
+// the mesh topology must be constant. instanced meshes are not included, so scene should be loaded with instancing disabled.
+// if quantize_step is not 0, mesh points are quantized to it (in world units) and delta coded between frames.
+// if pca_components is not 0, mesh points are stored as the mean shape plus up to pca_components basis shapes,
+// and each frame as their coefficients. all frames are kept in memory while exporting. quantize_step is ignored then.
+bool ExportWABC(IScene* scene, const char* path, double frame_rate = 30.0, float quantize_step = 0.0f, int pca_components = 0);
+
+
+// part of the geometry baked into an IVAT. offsets and counts of the points of a frame and of IVAT::getIndices().
+// objects without triangles and edges are points.
+struct VATObject
+{
+    int points_offset{};
+    int points_count{};
+    int triangles_offset{};
+    int triangles_count{};
+    int edges_offset{};
+    int edges_count{};
+};
+
+// vertex animation textures: positions, and optionally normals, of every frame of constant topology geometry.
+// IRenderer::draw(IVAT*, time) fetches them in the vertex shader by vertex index and frame,
+// so playback decodes and uploads nothing and seeking is a uniform update.
+class IVAT
+{
+public:
+    virtual ~IVAT() {};
+    virtual void release() = 0;
+
+    virtual double getStartTime() const = 0;
+    virtual double getFrameRate() const = 0;
+    virtual int getFrameCount() const = 0;
+    virtual int getPointCount() const = 0; // points of a frame, of all objects
+    virtual span<VATObject> getObjects() const = 0;
+    virtual span<int> getIndices() const = 0; // triangles and edge pairs of all objects. indices to the points of a frame
+    virtual span<float3> getPoints(int frame) const = 0;
+    virtual span<float3> getNormals(int frame) const = 0; // empty if normals are not baked
+
+    // creates the textures and the index buffer. a GL context must be current.
+    virtual bool upload() = 0;
+#ifdef wabcWithGL
+    // GL_TEXTURE_2D_ARRAY of RGB32F. texel i in row major order over the layers is point i % point_count of frame i / point_count.
+    virtual GLuint getPointsTexture() const = 0;
+    virtual GLuint getNormalsTexture() const = 0; // 0 if normals are not baked
+    virtual GLuint getIndicesBuffer() const = 0;
+#endif
+};
+// bakes the monolithic mesh and points of scene at frame_rate. the mesh topology must be constant.
+// points are dropped if their count changes. instanced meshes are not included, like ExportWABC().
+// all frames are kept in memory and in the textures: 12 bytes per point per frame, twice that with normals.
+IVAT* BakeVAT_(IScene* scene, double frame_rate = 30.0, bool normals = false);
+IVAT* LoadVAT_(const char* path); // .wvat written by ExportVAT()
+using IVATPtr = std::shared_ptr<IVAT>;
+inline IVATPtr BakeVAT(IScene* scene, double frame_rate = 30.0, bool normals = false) { return IVATPtr(BakeVAT_(scene, frame_rate, normals), releaser<IVAT>()); }
+inline IVATPtr LoadVAT(const char* path) { return IVATPtr(LoadVAT_(path), releaser<IVAT>()); }
+bool ExportVAT(IVAT* vat, const char* path);
 
 
 enum class SensorFitMode
@@ -128,16 +355,32 @@ public:
     virtual void release() = 0;
 
     virtual bool initialize(GLFWwindow* v) = 0;
+#ifdef wabcWithHeadless
+    // renders into an offscreen framebuffer of width x height instead of a window. a GL context must be current.
+    virtual bool initializeOffscreen(int width, int height) = 0;
+#endif
     virtual void setCamera(float3 pos, float3 dir, float3 up, float fov, float znear, float zfar, float2 shift = float2::zero()) = 0;
     virtual void setCamera(ICamera* cam, SensorFitMode ft = SensorFitMode::Auto) = 0;
     virtual void setDrawPoints(bool v) = 0;
     virtual void setDrawWireframe(bool v) = 0;
     virtual void setDrawFaces(bool v) = 0;
+    virtual float4x4 getViewProjection() const = 0; // as of the last setCamera()
+    virtual float2 getScreenSize() const = 0; // in pixels
 
     virtual void beginDraw() = 0;
     virtual void endDraw() = 0;
     virtual void draw(IMesh* mesh) = 0;
     virtual void draw(IPoints* points) = 0;
+    // draws vat at time, blended between the nearest frames. time is clamped to the baked range.
+    // draws faces, wireframe and points of mesh objects by the flags, and points objects always.
+    virtual void draw(IVAT* vat, double time) = 0;
+
+#ifdef wabcWithHeadless
+    // offscreen only. beginReadback() queues a copy of the last frame into a pixel buffer and endReadback() takes the oldest one
+    // as RGBA8 with bottom-up rows, so the transfer overlaps with whatever the caller does in between. up to 2 copies can be queued.
+    virtual bool beginReadback() = 0;
+    virtual bool endReadback(std::vector<uint8_t>& dst) = 0;
+#endif
 };
 IRenderer* CreateRenderer_();
 using IRendererPtr = std::shared_ptr<IRenderer>;
@@ -1,2 +1,16 @@
 #pragma once
 #include "libSSDS/ssdsTypes.h"
+
+namespace ssds {
+
+// Smooth Skinning Decomposition with Rigid Bones [Le and Deng 2012]: approximates the samples with linear blend skinning
+// of the rest shape. joints are seeded by adaptive clustering [Le and Deng 2014], then weights and transforms are updated in turns.
+// returns false if the input is empty or the sizes of rest_shape and samples don't match.
+bool Decompose(Output& dst, const Input& src);
+
+// the transform step of Decompose(): registers every joint in every sample for the weights of dst.
+// num_joints, num_indices, weights and rest_joint_pos of dst must be set, and matrices are the initial transforms.
+// src.transform_type is used and the other settings are ignored. returns false if the sizes don't match.
+bool UpdateTransforms(Output& dst, const Input& src);
+
+} // namespace ssds
@@ -1,142 +1,129 @@
 #include "pch.h"
 #include "ssdsMath.h"
 #include "ssdsTypes.h"
+#include "../libSSDS.h"
+#include "../../../Parallel.h" // task scheduler shared with the viewer
 #include <Eigen/Eigenvalues>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define ssdsWithSSE2
+#endif
 
 namespace ssds {
 
-static float4x4 calcRegistrationT(span<float3> s, span<float3> d)
+// solver state. while solving, matrices are num_samples * input.num_joints and joints are removed by shifting.
+// they are compacted to output.num_joints at the end.
+struct Context
 {
-    size_t num_points = s.size();
-    double3 cs{}, cd{}; // double for precision
-    for (size_t i = 0; i < num_points; ++i) {
-        cs += s[i];
-        cd += d[i];
-    }
-    return translate(float3((cd - cs) / double(num_points)));
-}
+    const Input* input{};
+    Output* output{};
+    int num_points{};
+    int num_samples{};
+    int num_indices{};
+    int joint_stride{};
+
+    std::vector<std::vector<int>> neighbor;     // per vertex
+    std::vector<std::vector<int>> vert_cluster; // candidate joints per vertex. empty if all joints are candidates
+
+    const float3& rest(int v) const { return input->rest_shape[v]; }
+    const float3& sample(int s, int v) const { return input->samples[(size_t)s * num_points + v]; }
+    JointWeight* weights(int v) { return &output->weights[(size_t)v * num_indices]; }
+    const JointWeight* weights(int v) const { return &output->weights[(size_t)v * num_indices]; }
+    float4x4& matrix(int s, int j) { return output->matrices[(size_t)s * joint_stride + j]; }
+    const float4x4& matrix(int s, int j) const { return output->matrices[(size_t)s * joint_stride + j]; }
+};
+
 
-static float4x4 calcRegistrationRT(span<float3> s, span<float3> d)
+// rotation that maps s to d best, from the cross covariance cov[a][b] = sum of s[a] * d[b] [Horn 1987].
+// the result is in the row vector convention of mul_p().
+static float4x4 calcRotation(const double (&cov)[3][3])
 {
-    size_t num_points = s.size();
-    double3 cs{}, cd{}; // double for precision
-    for (size_t i = 0; i < num_points; ++i) {
-        cs += s[i];
-        cd += d[i];
-    }
-    cs /= double(num_points);
-    cd /= double(num_points);
-    if (num_points < 3)
-        return translate(cd - cs);
+    double sxx = cov[0][0], sxy = cov[0][1], sxz = cov[0][2];
+    double syx = cov[1][0], syy = cov[1][1], syz = cov[1][2];
+    double szx = cov[2][0], szy = cov[2][1], szz = cov[2][2];
 
     Eigen::Matrix<double, 4, 4> moment;
-    {
-        auto sit = s.data();
-        auto dit = d.data();
-        double sxx = 0, sxy = 0, sxz = 0, syx = 0, syy = 0, syz = 0, szx = 0, szy = 0, szz = 0;
-        for (int i = 0; i < num_points; ++i, ++sit, ++dit) {
-            sxx += (sit->x - cs.x) * (dit->x - cd.x);
-            sxy += (sit->x - cs.x) * (dit->y - cd.y);
-            sxz += (sit->x - cs.x) * (dit->z - cd.z);
-            syx += (sit->y - cs.y) * (dit->x - cd.x);
-            syy += (sit->y - cs.y) * (dit->y - cd.y);
-            syz += (sit->y - cs.y) * (dit->z - cd.z);
-            szx += (sit->z - cs.z) * (dit->x - cd.x);
-            szy += (sit->z - cs.z) * (dit->y - cd.y);
-            szz += (sit->z - cs.z) * (dit->z - cd.z);
-        }
-        moment(0, 0) = sxx + syy + szz;
-        moment(0, 1) = syz - szy;        moment(1, 0) = moment(0, 1);
-        moment(0, 2) = szx - sxz;        moment(2, 0) = moment(0, 2);
-        moment(0, 3) = sxy - syx;        moment(3, 0) = moment(0, 3);
-        moment(1, 1) = sxx - syy - szz;
-        moment(1, 2) = sxy + syx;        moment(2, 1) = moment(1, 2);
-        moment(1, 3) = szx + sxz;        moment(3, 1) = moment(1, 3);
-        moment(2, 2) = -sxx + syy - szz;
-        moment(2, 3) = syz + szy;        moment(3, 2) = moment(2, 3);
-        moment(3, 3) = -sxx - syy + szz;
-    }
+    moment(0, 0) = sxx + syy + szz;
+    moment(0, 1) = syz - szy;        moment(1, 0) = moment(0, 1);
+    moment(0, 2) = szx - sxz;        moment(2, 0) = moment(0, 2);
+    moment(0, 3) = sxy - syx;        moment(3, 0) = moment(0, 3);
+    moment(1, 1) = sxx - syy - szz;
+    moment(1, 2) = sxy + syx;        moment(2, 1) = moment(1, 2);
+    moment(1, 3) = szx + sxz;        moment(3, 1) = moment(1, 3);
+    moment(2, 2) = -sxx + syy - szz;
+    moment(2, 3) = syz + szy;        moment(3, 2) = moment(2, 3);
+    moment(3, 3) = -sxx - syy + szz;
+    if (!(moment.norm() > 0))
+        return float4x4::identity();
+
+    // eigenvalues are in ascending order. the eigenvector of the largest one is the rotation as (w, x, y, z).
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 4, 4>> es(moment);
+    auto v = es.eigenvectors().col(3);
+    // to_mat4x4() is for column vectors. the conjugate gives its transpose.
+    quatf rot = normalize(quatf{ -(float)v(1), -(float)v(2), -(float)v(3), (float)v(0) });
+    return to_mat4x4(rot);
+}
 
-    float4x4 transform;
-    if (moment.norm() > 0) {
-        Eigen::EigenSolver<Eigen::Matrix<double, 4, 4>> es(moment);
-        int maxi = 0;
-        for (int i = 1; i < 4; ++i) {
-            if (es.eigenvalues()(maxi).real() < es.eigenvalues()(i).real()) {
-                maxi = i;
-            }
-        }
+// weighted cross covariance of a joint in a sample [Le and Deng 2012]:
+// sum of w * (p - cor_model) * (r - w * cor_sample)^T, where p is the rest point, r is the sample point minus
+// the contributions of the other joints, cor_model = sum of w^2 * p / sum of w^2 and cor_sample = sum of w * r / sum of w^2.
+// registrations find the linear part of the transform from it. the caller adds the translation.
+struct Covariance
+{
+    double cov[3][3];
+    double denom[3]; // sum of (w * (p - cor_model))^2 per axis
+};
 
-        quatf rot = {
-            (float)es.eigenvectors()(0, maxi).real(),
-            (float)es.eigenvectors()(1, maxi).real(),
-            (float)es.eigenvectors()(2, maxi).real(),
-            (float)es.eigenvectors()(3, maxi).real(),
-        };
-        transform = to_mat4x4(rot);
-    }
-    float3 cs0 = mul_p(transform, float3(cs));
-    (float3&)transform[3] = cd - cs0;
-    return transform;
+static float4x4 calcRegistrationT(const Covariance& /*c*/)
+{
+    return float4x4::identity();
 }
 
-#if 0
-float4x4 calcRegistrationSRT(span<float3> s, span<float3> d)
+static float4x4 calcRegistrationRT(const Covariance& c)
+{
+    return calcRotation(c.cov);
+}
+
+static float4x4 calcRegistrationSRT(const Covariance& c)
 {
-    size_t num_points = s.size();
     const int num_iterations = 50;
     const double threshold = 1.0e-8;
-    const double scaleLowerBound = 1.0e-3;
-    float4x4 transform = calcRegistrationRT(s, d);
-
-    float3 scale = float3::one();
-    float3 denom = float3::zero();
-    {
-        auto sit = s.data();
-        for (int i = 0; i < num_points; ++i, ++sit) {
-            denom[0] += (*sit)[0] * (*sit)[0];
-            denom[1] += (*sit)[1] * (*sit)[1];
-            denom[2] += (*sit)[2] * (*sit)[2];
-        }
-    }
-
-    std::vector<float3> sstm(num_points);
-    {
-        auto sit = s.data();
-        for (int i = 0; i < num_points; ++i, ++sit) {
-            sstm[i][0] = (*sit)[0];
-            sstm[i][1] = (*sit)[1];
-            sstm[i][2] = (*sit)[2];
-        }
-    }
-
-    std::vector<float3> dstm(num_points);
-    for (size_t l = 0; l < num_iterations; ++l) {
-        float4x4 im = invert(transform);
-        auto dit = d.data();
-        for (size_t i = 0; i < num_points; ++i, ++dit)
-            dstm[i] = mul_p(im, *dit);
-
-        for (size_t d = 0; d < 3; ++d) {
-            double ds = 0.0;
-            auto sit = s.data();
-            for (size_t i = 0; i < num_points; ++i, ++sit) {
-                ds += (*sit)[d] * dstm[i][d];
-            }
-            scale[d] = denom[d] < threshold ? 1.0 : ds / denom[d];
-            sit = s.data();
-            for (size_t i = 0; i < num_points; ++i, ++sit) {
-                sstm[i][d] = scale[d] * (*sit)[d];
+    const double scale_lower_bound = 1.0e-3;
+    double denom_total = c.denom[0] + c.denom[1] + c.denom[2];
+
+    // rotation and per axis scale are solved in turns. both only need the covariance:
+    // the covariance of scaled points is its rows scaled, and the scale of an axis is the points projected on the samples rotated back.
+    double scale[3] = { 1.0, 1.0, 1.0 };
+    float4x4 rot = float4x4::identity();
+    for (int l = 0; l < num_iterations; ++l) {
+        double scov[3][3];
+        for (int a = 0; a < 3; ++a)
+            for (int b = 0; b < 3; ++b)
+                scov[a][b] = scale[a] * c.cov[a][b];
+        rot = calcRotation(scov);
+
+        double diff = 0.0;
+        for (int a = 0; a < 3; ++a) {
+            double sa = 1.0;
+            if (c.denom[a] > denom_total * threshold) {
+                double num = rot[a][0] * c.cov[a][0] + rot[a][1] * c.cov[a][1] + rot[a][2] * c.cov[a][2];
+                sa = std::max(num / c.denom[a], scale_lower_bound);
             }
+            diff = std::max(diff, std::abs(sa - scale[a]));
+            scale[a] = sa;
         }
-        transform = calcRegistrationRT(num_points, sstm.begin(), pd);
+        if (diff < threshold)
+            break;
     }
-    double sv[3] = { scale[0], scale[1], scale[2] };
-    transform.setScale(sv, MSpace::kTransform);
-    return transform;
+    return scale44(float3{ (float)scale[0], (float)scale[1], (float)scale[2] }) * rot;
 }
 
-using RegistrationFunc = float4x4(*)(span<float3> ps, span<float3> pd);
+using RegistrationFunc = float4x4(*)(const Covariance& c);
+
+static bool isValidTransformType(TransformType v)
+{
+    return (int)v >= 0 && (int)v < 3;
+}
 
 static RegistrationFunc registrationFuncs[3] = {
     calcRegistrationT,
@@ -144,483 +131,638 @@ static RegistrationFunc registrationFuncs[3] = {
     calcRegistrationSRT
 };
 
-void computeSamplePoints(std::vector<float3>& sample, int sid, int joint, const Output& output, const Input& input)
+
+// raw moments of a joint in a sample, from which Covariance and the centroids are derived. with u = w * p,
+//   m[d] (d < 3) = sum of u[d] * (r, w)
+//   m[3] = sum of w * (r, w)
+//   m[4] = sum of (u, w)^2 (the last lane is unused)
+// p is relative to the rest position of the joint. the moments are not centered, so this keeps them small.
+template<class T>
+struct JointMoments
+{
+    alignas(16) T m[5][4];
+};
+using BlockMoments = JointMoments<float>;
+using SampleMoments = JointMoments<double>;
+
+// accumulates the moments of the joints in group in sample sid in one pass over the vertices. group: joint -> 1 if accumulated.
+// the contributions of the other joints are the reconstruction minus the joint's own, so a vertex is transformed once per influence.
+// blocks of vertices are accumulated in float (4 lanes at a time with SSE2) and added to dst in double.
+static void accumulateMoments(std::vector<SampleMoments>& dst, std::vector<BlockMoments>& block, std::vector<float4>& tp,
+    int sid, const std::vector<char>& group, const Context& ctx)
 {
-    const int num_vertices = input.num_vertices;
-    const int& num_indices = output.num_indices;
-
-    for (int v = 0; v < num_vertices; ++v) {
-        sample[v] = input.sample[sid * num_vertices + v];
-        const float3& s = input.rest_shape[v];
-        for (int i = 0; i < num_indices; ++i) {
-            const int jnt = output.skin_indices[v * num_indices + i];
-            if (jnt >= 0 && jnt != joint) {
-                const double w = output.skin_weights[v * num_indices + i];
-                const float4x4& at = output.skinMatrix[sid * input.num_joints + jnt];
-                sample[v] -= w * (s * at.asMatrix());
+    const int num_points = ctx.num_points;
+    const int num_joints = ctx.output->num_joints;
+    const int num_indices = ctx.num_indices;
+    const float3* joint_pos = ctx.output->rest_joint_pos.data();
+    const float4x4* matrices = &ctx.matrix(sid, 0);
+    const int grain = 1024;
+
+    dst.assign(num_joints, SampleMoments{});
+    block.resize(num_joints);
+    tp.resize(num_indices);
+    for (int first = 0; first < num_points; first += grain) {
+        int last = std::min(first + grain, num_points);
+        std::fill(block.begin(), block.end(), BlockMoments{});
+        for (int v = first; v < last; ++v) {
+            const JointWeight* weights = ctx.weights(v);
+            const float3 p = ctx.rest(v);
+            const float3 q = ctx.sample(sid, v);
+#ifdef ssdsWithSSE2
+            const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+            __m128 e = _mm_setr_ps(q.x, q.y, q.z, 0.0f);
+            for (int i = 0; i < num_indices; ++i) {
+                const JointWeight jw = weights[i];
+                if (jw.index < 0)
+                    continue;
+                const float4x4& m = matrices[jw.index];
+                __m128 t = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(px, _mm_loadu_ps(m[0].data())), _mm_mul_ps(py, _mm_loadu_ps(m[1].data()))),
+                    _mm_add_ps(_mm_mul_ps(pz, _mm_loadu_ps(m[2].data())), _mm_loadu_ps(m[3].data())));
+                _mm_storeu_ps(tp[i].data(), t);
+                e = _mm_sub_ps(e, _mm_mul_ps(_mm_set1_ps(jw.weight), t));
             }
+            const __m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            for (int i = 0; i < num_indices; ++i) {
+                const JointWeight jw = weights[i];
+                if (jw.index < 0 || jw.weight == 0.0f || !group[jw.index])
+                    continue;
+                const float3 d = p - joint_pos[jw.index];
+                const float w = jw.weight;
+                const __m128 wv = _mm_set1_ps(w);
+                // (r, w)
+                __m128 r = _mm_add_ps(e, _mm_mul_ps(wv, _mm_loadu_ps(tp[i].data())));
+                r = _mm_or_ps(_mm_and_ps(xyz_mask, r), _mm_andnot_ps(xyz_mask, wv));
+                const __m128 u = _mm_setr_ps(w * d.x, w * d.y, w * d.z, w);
+
+                float* a = block[jw.index].m[0];
+                _mm_store_ps(a + 0, _mm_add_ps(_mm_load_ps(a + 0), _mm_mul_ps(_mm_set1_ps(w * d.x), r)));
+                _mm_store_ps(a + 4, _mm_add_ps(_mm_load_ps(a + 4), _mm_mul_ps(_mm_set1_ps(w * d.y), r)));
+                _mm_store_ps(a + 8, _mm_add_ps(_mm_load_ps(a + 8), _mm_mul_ps(_mm_set1_ps(w * d.z), r)));
+                _mm_store_ps(a + 12, _mm_add_ps(_mm_load_ps(a + 12), _mm_mul_ps(wv, r)));
+                _mm_store_ps(a + 16, _mm_add_ps(_mm_load_ps(a + 16), _mm_mul_ps(u, u)));
+            }
+#else
+            float3 e = q;
+            for (int i = 0; i < num_indices; ++i) {
+                const JointWeight jw = weights[i];
+                if (jw.index < 0)
+                    continue;
+                float3 t = mul_p(matrices[jw.index], p);
+                tp[i] = { t.x, t.y, t.z, 0.0f };
+                e -= t * jw.weight;
+            }
+            for (int i = 0; i < num_indices; ++i) {
+                const JointWeight jw = weights[i];
+                if (jw.index < 0 || jw.weight == 0.0f || !group[jw.index])
+                    continue;
+                const float3 d = p - joint_pos[jw.index];
+                const float w = jw.weight;
+                const float r[4] = { e.x + w * tp[i].x, e.y + w * tp[i].y, e.z + w * tp[i].z, w };
+                const float u[4] = { w * d.x, w * d.y, w * d.z, w };
+
+                auto& a = block[jw.index].m;
+                for (int k = 0; k < 4; ++k) {
+                    for (int l = 0; l < 4; ++l)
+                        a[k][l] += u[k] * r[l];
+                    a[4][k] += u[k] * u[k];
+                }
+            }
+#endif
+        }
+        for (int j = 0; j < num_joints; ++j) {
+            if (!group[j])
+                continue;
+            const float* src = block[j].m[0];
+            double* acc = dst[j].m[0];
+            for (int k = 0; k < 20; ++k)
+                acc[k] += src[k];
         }
     }
 }
 
-void subtractCentroid(std::vector<float3>& model, std::vector<float3>& sample, float3& corModel, float3& corSample, const Eigen::VectorXd& weight, const Output& output, const Input& input)
+// the transform of a joint from its moments. identity if the joint has no weights.
+static float4x4 solveTransform(const SampleMoments& mo, const float3& joint_pos, TransformType transform_type)
 {
-    const int num_vertices = input.num_vertices;
-
-    double wsqsum = 0;
-    corModel = {};
-    corSample = {};
-    for (int v = 0; v < num_vertices; ++v) {
-        const double w = weight[v];
-        corModel += w * w * input.restShape[v];
-        corSample += w * sample[v];
-        wsqsum += w * w;
-    }
-    corModel = corModel / wsqsum;
-    corSample = corSample / wsqsum;
-    for (int v = 0; v < num_vertices; ++v) {
-        model[v] = weight[v] * (input.restShape[v] - corModel);
-        sample[v] -= weight[v] * corSample;
+    const auto& m = mo.m;
+    const double w2 = m[3][3];
+    if (!(w2 > 1.0e-8))
+        return float4x4::identity();
+
+    // cor_model (relative to the joint) = p1 / w2, cor_sample = q1 / w2. centering the moments subtracts p1 * q1^T / w2.
+    const double p1[3] = { m[0][3], m[1][3], m[2][3] };
+    const double q1[3] = { m[3][0], m[3][1], m[3][2] };
+    Covariance c;
+    for (int a = 0; a < 3; ++a) {
+        for (int b = 0; b < 3; ++b)
+            c.cov[a][b] = m[a][b] - p1[a] * q1[b] / w2;
+        c.denom[a] = std::max(m[4][a] - p1[a] * p1[a] / w2, 0.0);
     }
+    float4x4 transform = registrationFuncs[(int)transform_type](c);
+    float3 cor_model = joint_pos + float3{ (float)(p1[0] / w2), (float)(p1[1] / w2), (float)(p1[2] / w2) };
+    float3 cor_sample = { (float)(q1[0] / w2), (float)(q1[1] / w2), (float)(q1[2] / w2) };
+    (float3&)transform[3] = cor_sample - mul_v(transform, cor_model);
+    return transform;
 }
 
-
-class JointTransformUpdator
+// selection: the joint to update. -1 to update all joints.
+// updating a joint changes the samples that the joints sharing vertices with it are registered to. so joints are
+// colored such that no two joints of a color share a vertex, and the joints of a color are solved from one pass over the vertices.
+// the joints are updated in the order of colors rather than indices, so the result differs from updating them one by one,
+// but no joint is solved against a stale neighbour within a pass. as many passes as colors instead of joints.
+static void updateJointTransformProc(Context& ctx, int selection = -1)
 {
-private:
-    Output* output;
-    const Input* input;
-    const Eigen::VectorXd* weight;
-    int transformType;
-    int joint;
-
-public:
-    JointTransformUpdator(Output* output_, const Input* input_,
-        const Eigen::VectorXd* weight_, int joint_, int transformType_)
-        : output(output_), input(input_),
-        weight(weight_), joint(joint_), transformType(transformType_)
-    {
+    const int num_joints = ctx.output->num_joints;
+    const int num_indices = ctx.num_indices;
+    const TransformType transform_type = ctx.input->transform_type;
+
+    std::vector<std::vector<char>> groups;
+    if (selection >= 0) {
+        groups.resize(1, std::vector<char>(num_joints));
+        groups[0][selection] = 1;
     }
-
-    void operator ()(const tbb::blocked_range<int>& range) const
-    {
-        std::vector<float3> model(input->num_vertices);
-        std::vector<float3> sample(input->num_vertices);
-        for (int s = range.begin(); s != range.end(); ++s) {
-            if (s == 0) {
-                output->skinMatrix[joint] = float4x4::identity;
-                continue;
-            }
-            computeSamplePoints(sample, s, joint, *output, *input);
-            float3 corModel(0, 0, 0), corSample(0, 0, 0);
-            subtractCentroid(model, sample, corModel, corSample, *weight, *output, *input);
-            float4x4 transform = registrationFuncs[transformType](model.size(), model.begin(), sample.begin());
-            float3 d = corSample - corModel * transform.asMatrix();
-            transform.setTranslation(d + transform.getTranslation(MSpace::kTransform), MSpace::kTransform);
-            output->skinMatrix[s * input->num_joints + joint] = transform;
-        }
-    }
-};
-
-void updateJointTransformProc(Output& output, int transformType, const Input& input, int selection = -1)
-{
-    const int num_vertices = input.sample.front().points.size();
-    const int num_samples  = input.sample.size();
-    const int num_joints    = output.num_joints;
-    const int num_indices  = output.num_indices;
-
-    Eigen::VectorXd weight = Eigen::VectorXd::Zero(num_vertices);
-    int begin = selection < 0 ? 0 : selection;
-    int end = selection < 0 ? num_joints : selection + 1;
-    for (int joint = begin; joint < end; ++joint) {
-        for (int v = 0; v < num_vertices; ++v) {
-            weight[v] = 0.0;
+    else {
+        // greedy coloring of the joints that share vertices
+        std::vector<std::set<int>> adjacency(num_joints);
+        for (int v = 0; v < ctx.num_points; ++v) {
+            const JointWeight* weights = ctx.weights(v);
             for (int i = 0; i < num_indices; ++i) {
-                int jnt = output.skin_indices[v * num_indices + i];
-                if (jnt == joint) {
-                    weight[v] = output.skin_weights[v * num_indices + i];
-                    break;
-                }
+                if (weights[i].index < 0 || weights[i].weight == 0.0f)
+                    continue;
+                for (int k = i + 1; k < num_indices; ++k)
+                    if (weights[k].index >= 0 && weights[k].weight != 0.0f && weights[k].index != weights[i].index) {
+                        adjacency[weights[i].index].insert(weights[k].index);
+                        adjacency[weights[k].index].insert(weights[i].index);
+                    }
             }
         }
-        double wsqsum = weight.dot(weight);
-        if (wsqsum > 1.0e-8) {
-            tbb::blocked_range<int> blockedRange(0, num_samples);
-            JointTransformUpdator transformUpdator(&output, &input, &weight, joint, transformType);
-            tbb::parallel_for(blockedRange, transformUpdator);
-        }
-        else {
-            for (int s = 0; s < num_samples; ++s) {
-                output.skinMatrix[s * input.num_joints + joint] = float4x4::identity;
-            }
-            char buf[256];
-            printf(buf, "Fixed joint #%d", joint);
+        std::vector<int> colors(num_joints, -1);
+        for (int j = 0; j < num_joints; ++j) {
+            int c = 0;
+            while (std::any_of(adjacency[j].begin(), adjacency[j].end(), [&](int n) { return colors[n] == c; }))
+                ++c;
+            colors[j] = c;
+            if (c == (int)groups.size())
+                groups.push_back(std::vector<char>(num_joints));
+            groups[c][j] = 1;
         }
     }
-}
 
-static PyObject* updateJointTransform(PyObject *self, PyObject *args)
-{
-    PyObject* pin            = PyTuple_GET_ITEM(args, 0);
-    PyObject* pout           = PyTuple_GET_ITEM(args, 1);
-    const int transformType = PyInt_AsLong(PyTuple_GET_ITEM(args, 2));
-    Input* const input   = reinterpret_cast<Input*>(PyCapsule_GetPointer(pin, "SSDSInput"));
-    Output* const output = reinterpret_cast<Output*>(PyCapsule_GetPointer(pout, "SSDSOutput"));
-    updateJointTransformProc(*output, transformType, *input);
-    return Py_None;
+    // a sample per task. the scratch buffers are reused by the tasks that run on the same thread.
+    wabc::parallel_for(0, ctx.num_samples, [&](int s) {
+        static thread_local std::vector<SampleMoments> moments;
+        static thread_local std::vector<BlockMoments> block;
+        static thread_local std::vector<float4> tp;
+        for (auto& group : groups) {
+            accumulateMoments(moments, block, tp, s, group, ctx);
+            for (int joint = 0; joint < num_joints; ++joint)
+                if (group[joint])
+                    ctx.matrix(s, joint) = solveTransform(moments[joint], ctx.output->rest_joint_pos[joint], transform_type);
+        }
+    });
 }
 
 
-// see https://sites.google.com/view/fumiyanarita/project/la_ssdr_mdmc
-static void detectNeighborClusters(const Input& input, Output& output)
+// min |A w - q|^2 subject to w >= 0, where M = A^T A and b = A^T q. active set method of [Lawson and Hanson 1974].
+// set: indices of the columns to solve for. w receives their weights.
+static void solveNNLS(const Eigen::MatrixXd& M, const Eigen::VectorXd& b, const std::vector<int>& set, std::vector<double>& w)
 {
-    MGlobal::displayInfo("Detecting neighbor clusters");
-    const int& num_indices = output.num_indices;
-
-    std::vector<std::set<int>> clusters(output.num_joints);
-    for (int v = 0; v < input.num_vertices; ++v) {
-        const int primjid = output.skinIndex[v * num_indices];
-        if (input.numRings == 0) {
-            for (int j = 0; j < output.num_joints; ++j) {
-                for (int v = 0; v < output.num_joints; ++v) {
-                    clusters[j].insert(v);
-                }
+    const int n = (int)set.size();
+    w.assign(n, 0.0);
+    std::vector<char> passive(n, 0);
+    double tolerance = 1.0e-12 * (b.cwiseAbs().maxCoeff() + 1.0);
+
+    Eigen::MatrixXd Mp;
+    Eigen::VectorXd bp, z;
+    std::vector<int> p;
+    for (int iteration = 0; iteration < n * 3; ++iteration) {
+        // the most negative gradient among the zero weights
+        int best = -1;
+        double max_grad = tolerance;
+        for (int i = 0; i < n; ++i) {
+            if (passive[i])
+                continue;
+            double grad = b[set[i]];
+            for (int j = 0; j < n; ++j)
+                grad -= M(set[i], set[j]) * w[j];
+            if (grad > max_grad) {
+                max_grad = grad;
+                best = i;
             }
         }
-        else {
-            clusters[primjid].insert(0);
-            clusters[primjid].insert(primjid);
-            // one-ring neighbors
-            for (auto nvit = input.neighbor[v].begin(); nvit != input.neighbor[v].end(); ++nvit) {
-                const int nvid = nvit->first;
-                clusters[primjid].insert(output.skinIndex[nvid * num_indices]);
-                if (input.numRings == 1) {
-                    continue;
+        if (best < 0)
+            break;
+        passive[best] = 1;
+
+        for (;;) {
+            // unconstrained solution on the passive set
+            p.clear();
+            for (int i = 0; i < n; ++i)
+                if (passive[i])
+                    p.push_back(i);
+            const int np = (int)p.size();
+            Mp.resize(np, np);
+            bp.resize(np);
+            for (int i = 0; i < np; ++i) {
+                bp[i] = b[set[p[i]]];
+                for (int j = 0; j < np; ++j)
+                    Mp(i, j) = M(set[p[i]], set[p[j]]);
+            }
+            z = Mp.ldlt().solve(bp);
+
+            // step towards it until a weight hits zero
+            double alpha = 1.0;
+            for (int i = 0; i < np; ++i) {
+                if (z[i] <= 0.0) {
+                    double wi = w[p[i]];
+                    alpha = std::min(alpha, wi / (wi - z[i]));
                 }
-                // two-ring neighbors
-                for (auto nnvit = input.neighbor[nvid].begin(); nnvit != input.neighbor[nvid].end(); ++nnvit) {
-                    const int nnvid = nnvit->first;
-                    clusters[primjid].insert(output.skinIndex[nnvid * num_indices]);
+            }
+            for (int i = 0; i < np; ++i)
+                w[p[i]] += alpha * (z[i] - w[p[i]]);
+            if (alpha >= 1.0)
+                break;
+            for (int i = 0; i < np; ++i) {
+                if (w[p[i]] <= tolerance) {
+                    w[p[i]] = 0.0;
+                    passive[p[i]] = 0;
                 }
             }
         }
     }
-    for (int v = 0; v < input.num_vertices; ++v) {
-        const int primjid = output.skinIndex[v * num_indices];
-        output.vertCluster[v] = std::vector<int>(clusters[primjid].begin(), clusters[primjid].end());
-    }
 }
 
-int bindVertexToJoint(Output& output, const Input& input)
+// weights of each vertex from the candidate joints. the weights are non negative and sum up to 1,
+// and at most num_indices joints influence a vertex.
+static void updateWeights(Context& ctx)
 {
-    const int num_vertices = input.num_vertices;
-    const int num_samples  = input.num_samples;
-    const int num_indices  = output.num_indices;
-
-    std::vector<int> numJointVertices(output.num_joints, 0);
-    for (int v = 0; v < num_vertices; ++v) {
-        int bestJoint = 0;
-        double minErr = std::numeric_limits<double>::max();
-        const float3& restShapePos = input.restShape[v];
-        for (int j = 0; j < output.num_joints; ++j) {
-            double errsq = 0;
+    const int num_samples = ctx.num_samples;
+    const int num_joints = ctx.output->num_joints;
+    const int num_indices = ctx.num_indices;
+
+    std::vector<int> all_joints(num_joints);
+    for (int j = 0; j < num_joints; ++j)
+        all_joints[j] = j;
+
+    wabc::parallel_for_blocked(0, ctx.num_points, 256, [&](int first, int last) {
+        Eigen::MatrixXd M;
+        Eigen::VectorXd b;
+        std::vector<float3> tp;
+        std::vector<int> set, top;
+        std::vector<double> w;
+
+        for (int v = first; v < last; ++v) {
+            const std::vector<int>& candidates = ctx.vert_cluster.empty() ? all_joints : ctx.vert_cluster[v];
+            const int nc = (int)candidates.size();
+            const float3 p = ctx.rest(v);
+
+            // normal equations. the rows of A are the rest point transformed by the candidates in each sample.
+            M.setZero(nc, nc);
+            b.setZero(nc);
+            tp.resize(nc);
             for (int s = 0; s < num_samples; ++s) {
-                float4x4 am = output.skinMatrix[s * input.num_joints + j].asMatrix();
-                float3 diff = input.sample[s * num_vertices + v] - restShapePos * am;
-                errsq += diff * diff;
+                const float3 q = ctx.sample(s, v);
+                for (int c = 0; c < nc; ++c) {
+                    tp[c] = mul_p(ctx.matrix(s, candidates[c]), p);
+                    b[c] += dot(tp[c], q);
+                    for (int d = 0; d <= c; ++d)
+                        M(c, d) += dot(tp[c], tp[d]);
+                }
             }
-            errsq *= (input.restShape[v] - output.restJointPos[j]).length();
-            if (errsq < minErr) {
-                bestJoint = j;
-                minErr = errsq;
+            for (int c = 0; c < nc; ++c)
+                for (int d = 0; d < c; ++d)
+                    M(d, c) = M(c, d);
+
+            // sum of the weights = 1 as a heavily weighted row
+            // a small ridge keeps candidates with the same transforms solvable.
+            double penalty = 1.0e3 * (M.trace() / nc + 1.0e-8);
+            M.array() += penalty;
+            M.diagonal().array() += penalty * 1.0e-9;
+            b.array() += penalty;
+
+            set.resize(nc);
+            for (int c = 0; c < nc; ++c)
+                set[c] = c;
+            solveNNLS(M, b, set, w);
+
+            // too many influences: solve again with the largest ones
+            top.clear();
+            for (int c = 0; c < nc; ++c)
+                if (w[c] > 0.0)
+                    top.push_back(c);
+            std::sort(top.begin(), top.end(), [&](int l, int r) { return w[l] > w[r]; });
+            if ((int)top.size() > num_indices) {
+                top.resize(num_indices);
+                set = top;
+                solveNNLS(M, b, set, w);
+                std::vector<double> wt(nc, 0.0);
+                for (int i = 0; i < num_indices; ++i)
+                    wt[set[i]] = w[i];
+                w.swap(wt);
+                std::sort(top.begin(), top.end(), [&](int l, int r) { return w[l] > w[r]; });
             }
-        }
-        ++numJointVertices[bestJoint];
-        output.skinIndex[v * num_indices + 0] = bestJoint;
-    }
 
-    std::vector<int>::iterator smallestBoneSize = std::min_element(numJointVertices.begin(), numJointVertices.end());
-    while (*smallestBoneSize <= 0) {
-        const int smallestBone = static_cast<int>(smallestBoneSize - numJointVertices.begin());
-        numJointVertices.erase(numJointVertices.begin() + smallestBone);
-        output.restJointPos.erase(output.restJointPos.begin() + smallestBone);
-        for (int s = 0; s < input.num_samples; ++s) {
-            for (int j = output.num_joints - 2; j >= smallestBone; --j) {
-                output.skinMatrix[s * input.num_joints + j] = output.skinMatrix[s * input.num_joints + j + 1];
+            JointWeight* dst = ctx.weights(v);
+            double total = 0.0;
+            for (int c : top)
+                total += w[c];
+            if (top.empty() || !(total > 0.0)) {
+                // keep the primary joint
+                for (int i = 1; i < num_indices; ++i)
+                    dst[i] = {};
+                dst[0].weight = 1.0f;
+                continue;
             }
-        }
-        for (int v = 0; v < num_vertices; ++v) {
-            if (output.skinIndex[v * num_indices + 0] >= smallestBone) {
-                --output.skinIndex[v * num_indices + 0];
+            int n = 0;
+            for (int c : top) {
+                if (n == num_indices)
+                    break;
+                if (w[c] <= 0.0)
+                    continue;
+                dst[n++] = { candidates[c], float(w[c] / total) };
             }
+            for (; n < num_indices; ++n)
+                dst[n] = {};
         }
-        --output.num_joints;
-        smallestBoneSize = std::min_element(numJointVertices.begin(), numJointVertices.end());
-    }
-    return static_cast<int>(numJointVertices.size());
+    });
 }
 
-int findMostStableVertex(const Input& input)
+
+// see https://sites.google.com/view/fumiyanarita/project/la_ssdr_mdmc
+static void detectNeighborClusters(Context& ctx)
 {
-    const int num_vertices = input.num_vertices;
-    const int num_samples = input.num_samples;
-    double minErrorSq = std::numeric_limits<double>::max();
-    int mostStableVertex = -1;
-    for (int v = 0; v < num_vertices; ++v) {
-        double errSq = 0;
-        for (int s = 0; s < num_samples; ++s) {
-            float3 diff = input.sample[s * num_vertices + v] - input.restShape[v];
-            errSq += diff * diff;
-        }
-        if (errSq < minErrorSq) {
-            minErrorSq = errSq;
-            mostStableVertex = v;
+    const Input& input = *ctx.input;
+    ctx.vert_cluster.clear();
+    if (input.num_rings <= 0 || input.edges.empty())
+        return;
+
+    const int num_joints = ctx.output->num_joints;
+    std::vector<std::set<int>> clusters(num_joints);
+    for (int v = 0; v < ctx.num_points; ++v) {
+        const int primjid = ctx.weights(v)[0].index;
+        clusters[primjid].insert(primjid);
+        // one-ring neighbors
+        for (int nvid : ctx.neighbor[v]) {
+            clusters[primjid].insert(ctx.weights(nvid)[0].index);
+            if (input.num_rings == 1)
+                continue;
+            // two-ring neighbors
+            for (int nnvid : ctx.neighbor[nvid])
+                clusters[primjid].insert(ctx.weights(nnvid)[0].index);
         }
     }
-    return mostStableVertex;
+    ctx.vert_cluster.resize(ctx.num_points);
+    for (int v = 0; v < ctx.num_points; ++v) {
+        const int primjid = ctx.weights(v)[0].index;
+        ctx.vert_cluster[v] = std::vector<int>(clusters[primjid].begin(), clusters[primjid].end());
+    }
 }
 
-int findDistantVertex(const Input& input, const Output& output, const std::set<int>& covered)
+// squared error of each vertex transformed by joint
+static void calcJointErrors(std::vector<double>& dst, int joint, const Context& ctx)
 {
-    const int num_vertices = input.num_vertices;
-    const int num_samples  = input.num_samples;
-    const int num_indices  = output.num_indices;
-    double maxErrorSq      = -std::numeric_limits<double>::max();
-    int mostDistantVertex = -1;
-    for (int v = 0; v < num_vertices; ++v) {
-        if (covered.find(v) != covered.end()) {
-            continue;
-        }
-        int index = output.skinIndex[v * num_indices + 0];
-        double errSq = 0;
-        for (int s = 0; s < num_samples; ++s) {
-            float4x4 bm = output.skinMatrix[s * input.num_joints + index].asMatrix();
-            float3 diff = input.sample[s * num_vertices + v] - input.restShape[v] * bm;
-            errSq += diff * diff;
-        }
-        if (errSq > maxErrorSq) {
-            maxErrorSq = errSq;
-            mostDistantVertex = v;
+    dst.resize(ctx.num_points);
+    wabc::parallel_for_blocked(0, ctx.num_points, 1024, [&](int first, int last) {
+        for (int v = first; v < last; ++v) {
+            const float3 p = ctx.rest(v);
+            double errsq = 0;
+            for (int s = 0; s < ctx.num_samples; ++s)
+                errsq += length_sq(ctx.sample(s, v) - mul_p(ctx.matrix(s, joint), p));
+            dst[v] = errsq;
         }
-    }
-    return mostDistantVertex;
+    });
 }
 
+static int findMostStableVertex(const Context& ctx)
+{
+    const int grain = 1024;
+    int num_blocks = (ctx.num_points + grain - 1) / grain;
+    std::vector<std::pair<double, int>> block_min(num_blocks);
+    wabc::parallel_for(0, num_blocks, [&](int bi) {
+        int first = bi * grain;
+        int last = std::min(first + grain, ctx.num_points);
+        std::pair<double, int> r{ std::numeric_limits<double>::max(), -1 };
+        for (int v = first; v < last; ++v) {
+            double errsq = 0;
+            for (int s = 0; s < ctx.num_samples; ++s)
+                errsq += length_sq(ctx.sample(s, v) - ctx.rest(v));
+            if (errsq < r.first)
+                r = { errsq, v };
+        }
+        block_min[bi] = r;
+    });
+    return std::min_element(block_min.begin(), block_min.end())->second;
+}
 
-// solving p-center problem
-static void clusterVerticesPcenter(Output& output, const Input& input, int transformType)
+// the uncovered vertex with the largest error
+static int findDistantVertex(const std::vector<double>& errors, const std::vector<char>& covered)
 {
-    const int& num_indices = output.num_indices;
-
-    output.num_joints = input.num_joints;
-    std::fill(output.skinIndex.begin(), output.skinIndex.end(), -1);
-    std::fill(output.skinWeight.begin(), output.skinWeight.end(), 0.0);
-    std::fill(output.skinMatrix.begin(), output.skinMatrix.end(), float4x4::identity);
-    std::fill(output.restJointPos.begin(), output.restJointPos.end(), float3::origin);
-
-    char buf[512];
-    int stable_vertex = findMostStableVertex(input);
-    output.weights[stable_vertex * num_indices] = { 0, 1.0f };
-    output.restJointPos[0] = input.restShape[stable_vertex];
-    std::vector<int> joint_vertices(output.num_joints);
-    joint_vertices[0] = stable_vertex;
-    sprintf(buf, "Added to Vertex %d (stable)", stable_vertex);
-
-    for (int jid = 1; jid < input.num_joints; ++jid) {
-        double max_dist = -1.0;
-        int distant_vertex = -1;
-        for (int i = 0; i < input.num_vertices; ++i) {
-            if (std::find(joint_vertices.begin(), joint_vertices.end(), i) != joint_vertices.end()) {
-                continue;
-            }
-            double mindist = std::numeric_limits<double>::max();
-            for (int j = 0; j < jid; ++j) {
-                const int joint = joint_vertices[j];
-                float3 v = input.restShape[i] - input.restShape[joint];
-                if (mindist > v.length()) {
-                    mindist = v.length();
-                }
-            }
-            if (mindist > max_dist)
-            {
-                max_dist = mindist;
-                distant_vertex = i;
-            }
+    double max_errsq = -1.0;
+    int most_distant_vertex = -1;
+    for (int v = 0; v < (int)errors.size(); ++v) {
+        if (!covered[v] && errors[v] > max_errsq) {
+            max_errsq = errors[v];
+            most_distant_vertex = v;
         }
-        output.restJointPos[jid] = input.restShape[distant_vertex];
-        joint_vertices[jid] = distant_vertex;
-        sprintf(buf, "Added to Vertex %d, %f", distant_vertex, max_dist);
     }
+    return most_distant_vertex;
+}
 
-    for (int i = 0; i < input.num_vertices; ++i) {
-        double min_dist = std::numeric_limits<double>::max();
-        int nearest_joint = -1;
-        for (int j = 0; j < output.num_joints; ++j) {
-            const int joint = joint_vertices[j];
-            float3 v = input.restShape[i] - input.restShape[joint];
-            if (v.length() < min_dist) {
-                min_dist = v.length();
-                nearest_joint = j;
-            }
-        }
-        output.skinIndex[i * num_indices] = nearest_joint;
-        output.skinWeight[i * num_indices] = 1.0;
+static void removeJoint(Context& ctx, int joint, std::vector<int>& bound_joints)
+{
+    Output& output = *ctx.output;
+    for (int s = 0; s < ctx.num_samples; ++s)
+        for (int j = joint; j < output.num_joints - 1; ++j)
+            ctx.matrix(s, j) = ctx.matrix(s, j + 1);
+    output.rest_joint_pos.erase(output.rest_joint_pos.begin() + joint);
+    for (int v = 0; v < ctx.num_points; ++v) {
+        if (bound_joints[v] > joint)
+            --bound_joints[v];
+        ctx.weights(v)[0].index = bound_joints[v];
     }
-    detectNeighborClusters(input, output);
-    updateJointTransformProc(output, transformType, input);
+    --output.num_joints;
 }
 
-static void clusterVerticesAdaptive(Output& output, const Input& input, int transformType)
+// adds joints one by one at the vertex that the current joints approximate worst [Le and Deng 2014].
+// every vertex is bound to one joint with weight 1: the one with the least error weighted by the distance to the joint.
+static void clusterVerticesAdaptive(Context& ctx)
 {
-    const int& num_indices = output.num_indices;
+    const Input& input = *ctx.input;
+    Output& output = *ctx.output;
+    const int num_points = ctx.num_points;
 
     output.num_joints = 0;
-    std::fill(output.skinIndex.begin(), output.skinIndex.end(), -1);
-    std::fill(output.skinWeight.begin(), output.skinWeight.end(), 0.0);
-    std::fill(output.skinMatrix.begin(), output.skinMatrix.end(), float4x4::identity);
-    output.restJointPos.clear();
-
-    std::set<int> covered;
-    char buf[512];
-
-    int stable_vertex = findMostStableVertex(input);
-    output.skinIndex[stable_vertex * num_indices] = 0;
-    output.skinWeight[stable_vertex * num_indices] = 1.0;
-    output.restJointPos.push_back(input.restShape[stable_vertex]);
-    covered.insert(stable_vertex);
-    sprintf(buf, "Added to Vertex %d (stable)", stable_vertex);
-
-    for (int i = 0; i < input.neighbor[stable_vertex].size(); ++i) {
-        int neighbor = input.neighbor[stable_vertex][i].first;
-        if (neighbor < 0) {
-            continue;
+    std::fill(output.weights.begin(), output.weights.end(), JointWeight{});
+    std::fill(output.matrices.begin(), output.matrices.end(), float4x4::identity());
+    output.rest_joint_pos.clear();
+
+    std::vector<char> covered(num_points);
+    int num_covered = 0;
+    auto cover = [&](int v, int joint) {
+        ctx.weights(v)[0] = { joint, 1.0f };
+        if (!covered[v]) {
+            covered[v] = 1;
+            ++num_covered;
         }
-        output.skinIndex[neighbor * num_indices] = 0;
-        output.skinWeight[neighbor * num_indices] = 1.0;
-        covered.insert(neighbor);
-    }
-    updateJointTransformProc(output, transformType, input, 0);
-    for (int v = 0; v < input.num_vertices; ++v) {
-        output.skinIndex[v * num_indices] = 0;
-        output.skinWeight[v * num_indices] = 1.0;
-    }
+    };
+    auto cover_with_neighbors = [&](int v, int joint) {
+        cover(v, joint);
+        for (int n : ctx.neighbor[v])
+            cover(n, joint);
+    };
+
+    // the first joint at the most stable vertex and its neighbors
+    int stable_vertex = findMostStableVertex(ctx);
+    output.rest_joint_pos.push_back(ctx.rest(stable_vertex));
+    cover_with_neighbors(stable_vertex, 0);
     output.num_joints = 1;
+    updateJointTransformProc(ctx, 0);
+
+    std::vector<int> bound_joints(num_points, 0);
+    std::vector<double> errors, costs(num_points), new_errors;
+    calcJointErrors(errors, 0, ctx);
+    for (int v = 0; v < num_points; ++v) {
+        ctx.weights(v)[0] = { 0, 1.0f };
+        costs[v] = errors[v] * length(ctx.rest(v) - output.rest_joint_pos[0]);
+    }
 
+    std::vector<int> joint_sizes;
     for (int iteration = 0; iteration < input.num_joints + 10; ++iteration) {
-        if (output.num_joints >= input.num_joints || covered.size() >= input.num_vertices) {
+        if (output.num_joints >= input.num_joints || num_covered >= num_points)
             break;
-        }
-        int distant_vertex = findDistantVertex(input, output, covered);
-        output.skinIndex[distant_vertex * num_indices] = output.num_joints;
-        output.restJointPos.push_back(input.restShape[distant_vertex]);
-        covered.insert(distant_vertex);
-        for (int i = 0; i < input.neighbor[distant_vertex].size(); ++i) {
-            int neighbor = input.neighbor[distant_vertex][i].first;
-            if (neighbor < 0) {
-                continue;
+
+        // the new joint is registered to the distant vertex and its neighbors
+        int distant_vertex = findDistantVertex(errors, covered);
+        const int joint = output.num_joints;
+        output.rest_joint_pos.push_back(ctx.rest(distant_vertex));
+        cover_with_neighbors(distant_vertex, joint);
+        ++output.num_joints;
+        updateJointTransformProc(ctx, joint);
+
+        // other joints are not changed. so only the new joint's errors need to be compared.
+        calcJointErrors(new_errors, joint, ctx);
+        const float3 joint_pos = output.rest_joint_pos[joint];
+        for (int v = 0; v < num_points; ++v) {
+            double cost = new_errors[v] * length(ctx.rest(v) - joint_pos);
+            if (cost < costs[v] || v == distant_vertex) {
+                bound_joints[v] = joint;
+                errors[v] = new_errors[v];
+                costs[v] = cost;
             }
-            output.skinIndex[neighbor * num_indices] = output.num_joints;
-            covered.insert(neighbor);
+            ctx.weights(v)[0] = { bound_joints[v], 1.0f };
         }
-        updateJointTransformProc(output, transformType, input, output.num_joints);
-        ++output.num_joints;
-        output.num_joints = bindVertexToJoint(output, input);
 
-        sprintf(buf, "Added to Vertex %d", distant_vertex);
+        // joints that lost all their vertices
+        joint_sizes.assign(output.num_joints, 0);
+        for (int v = 0; v < num_points; ++v)
+            ++joint_sizes[bound_joints[v]];
+        for (int j = output.num_joints - 1; j >= 0; --j)
+            if (joint_sizes[j] == 0)
+                removeJoint(ctx, j, bound_joints);
     }
-    detectNeighborClusters(input, output);
 }
 
-static void initialize(Output& output, Input& input)
+static float calcError(const Context& ctx)
+{
+    const int grain = 1024;
+    int num_blocks = (ctx.num_points + grain - 1) / grain;
+    std::vector<double> block_errors(num_blocks);
+    wabc::parallel_for(0, num_blocks, [&](int bi) {
+        int first = bi * grain;
+        int last = std::min(first + grain, ctx.num_points);
+        double errsq = 0;
+        for (int v = first; v < last; ++v) {
+            const float3 p = ctx.rest(v);
+            const JointWeight* weights = ctx.weights(v);
+            for (int s = 0; s < ctx.num_samples; ++s) {
+                float3 r{};
+                for (int i = 0; i < ctx.num_indices; ++i)
+                    if (weights[i].index >= 0)
+                        r += mul_p(ctx.matrix(s, weights[i].index), p) * weights[i].weight;
+                errsq += length_sq(r - ctx.sample(s, v));
+            }
+        }
+        block_errors[bi] = errsq;
+    });
+    double total = 0;
+    for (double e : block_errors)
+        total += e;
+    return (float)std::sqrt(total / ((double)ctx.num_points * ctx.num_samples));
+}
+
+bool Decompose(Output& output, const Input& input)
 {
-    PyArrayObject* initPos = reinterpret_cast<PyArrayObject*>(PyTuple_GET_ITEM(args, 0));
-    PyArrayObject* shapeSample = reinterpret_cast<PyArrayObject*>(PyTuple_GET_ITEM(args, 1));
-    PyArrayObject* neighborVertices = reinterpret_cast<PyArrayObject*>(PyTuple_GET_ITEM(args, 2));
-    const long numJoints = PyInt_AsLong(PyTuple_GET_ITEM(args, 3));
-    const long numIndices = PyInt_AsLong(PyTuple_GET_ITEM(args, 4));
-    const long numRings = PyInt_AsLong(PyTuple_GET_ITEM(args, 5));
-    const long numVertices = static_cast<long>(initPos->dimensions[0]);
-    const long numSamples = static_cast<long>(shapeSample->dimensions[0]);
-    // allocation
-    input.numVertices = numVertices;
-    input.numSamples = numSamples;
-    input.numJoints = numJoints;
-    input.numRings = numRings;
-    input.rest_shape.points.resize(numVertices);
-    input.sample.resize(numSamples);
-    input.neighbor.resize(numVertices);
-
-    output.joints.resize(numJoints);
-    for (auto& jd : output.joints) {
-        jd.weights.resize(numVertices);
-        jd.matrix.resize(numSamples);
+    output = {};
+    const size_t num_points = input.rest_shape.size();
+    if (num_points == 0 || input.samples.empty() || input.samples.size() % num_points != 0 ||
+        input.num_joints <= 0 || input.num_indices <= 0 || !isValidTransformType(input.transform_type))
+        return false;
+
+    Context ctx;
+    ctx.input = &input;
+    ctx.output = &output;
+    ctx.num_points = (int)num_points;
+    ctx.num_samples = (int)(input.samples.size() / num_points);
+    ctx.num_indices = input.num_indices;
+    ctx.joint_stride = input.num_joints;
+
+    ctx.neighbor.resize(num_points);
+    for (const int2& e : input.edges) {
+        if (e.x < 0 || e.y < 0 || e.x >= (int)num_points || e.y >= (int)num_points || e.x == e.y)
+            continue;
+        ctx.neighbor[e.x].push_back(e.y);
+        ctx.neighbor[e.y].push_back(e.x);
     }
 
-    output.skinMatrix = std::vector<MTransformationMatrix>(numSamples * numJoints, MTransformationMatrix::identity);
-    output.restJointPos = std::vector<MPoint>(numJoints);
-    output.vertCluster = std::vector<std::vector<int>>(numVertices);
-
-    // size normalization
-    MVector centroid(0, 0, 0);
-    MVector minPos(1.0e10, 1.0e10, 1.0e10), maxPos(-1.0e10, -1.0e10, -1.0e10);
-    for (int v = 0; v < numVertices; ++v) {
-        MVector p(GET_DOUBLE2(initPos, v, 0),
-            GET_DOUBLE2(initPos, v, 1),
-            GET_DOUBLE2(initPos, v, 2));
-        input->restShape[v] = p;
-        centroid += p;
-        for (int i = 0; i < 3; ++i) {
-            minPos[i] = std::min(minPos[i], p[i]);
-            maxPos[i] = std::max(maxPos[i], p[i]);
-        }
+    output.num_indices = input.num_indices;
+    output.weights.resize(num_points * input.num_indices);
+    output.matrices.resize((size_t)ctx.num_samples * input.num_joints);
+
+    clusterVerticesAdaptive(ctx);
+    detectNeighborClusters(ctx);
+    for (int iteration = 0; iteration < input.num_iterations; ++iteration) {
+        updateWeights(ctx);
+        updateJointTransformProc(ctx);
     }
-    centroid /= numVertices;
-    double scale = std::max(std::max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
-    MMatrix m = MMatrix::identity;
-    m(0, 0) = m(1, 1) = m(2, 2) = 1.0 / scale;
-    m(3, 0) = -centroid.x / scale;
-    m(3, 1) = -centroid.y / scale;
-    m(3, 2) = -centroid.z / scale;
-    input->normalizer = m;
-    // normalized samples
-    for (int v = 0; v < numVertices; ++v) {
-        input->restShape[v] = input->restShape[v] * input->normalizer;
-        for (int s = 0; s < numSamples; ++s) {
-            MPoint p(GET_DOUBLE3(shapeSample, s, v, 0),
-                GET_DOUBLE3(shapeSample, s, v, 1),
-                GET_DOUBLE3(shapeSample, s, v, 2));
-            input->sample[s * numVertices + v] = p * input->normalizer;
-        }
+    output.error = calcError(ctx);
+
+    // compact the matrices
+    const int num_joints = output.num_joints;
+    if (num_joints != ctx.joint_stride) {
+        for (int s = 0; s < ctx.num_samples; ++s)
+            for (int j = 0; j < num_joints; ++j)
+                output.matrices[(size_t)s * num_joints + j] = ctx.matrix(s, j);
+        output.matrices.resize((size_t)ctx.num_samples * num_joints);
     }
+    return true;
+}
 
-    // one-ring neighbor [Le and Deng 2014]
-    for (int v = 0; v < numVertices; ++v) {
-        double lv = 0.0;
-        for (int i = 0; i < neighborVertices->dimensions[1]; ++i) {
-            long n = GET_LONG2(neighborVertices, v, i);
-            if (n < 0) {
-                continue;
-            }
-            double len = (input->restShape[v] - input->restShape[n]).length();
-            if (len > 0) {
-                // [Le and Deng 2014]
-                double dsqsum = 0;
-                for (int s = 0; s < input->numSamples; ++s) {
-                    float diff = (input->restShape[v] - input->restShape[n]).length()
-                        - (input->sample[s * numVertices + v] - input->sample[s * numVertices + n]).length();
-                    dsqsum += diff * diff;
-                }
-                dsqsum += 1.0e-10;
-                double dvn = 1.0 / std::sqrt(dsqsum / input->numSamples);
-                input->neighbor[v].push_back(std::make_pair(n, dvn));
-                lv += dvn;
-            }
-        }
-        for (int n = 0; n < input->neighbor[v].size(); ++n) {
-            input->neighbor[v][n].second /= -lv;
-        }
+bool UpdateTransforms(Output& output, const Input& input)
+{
+    const size_t num_points = input.rest_shape.size();
+    if (num_points == 0 || input.samples.empty() || input.samples.size() % num_points != 0 ||
+        output.num_joints <= 0 || output.num_indices <= 0 || !isValidTransformType(input.transform_type))
+        return false;
+    const size_t num_samples = input.samples.size() / num_points;
+    if (output.weights.size() != num_points * output.num_indices ||
+        output.matrices.size() != num_samples * output.num_joints ||
+        output.rest_joint_pos.size() != (size_t)output.num_joints)
+        return false;
+    // -1 is an unused slot
+    for (auto& w : output.weights) {
+        if (w.index < -1 || w.index >= output.num_joints)
+            return false;
     }
+
+    Context ctx;
+    ctx.input = &input;
+    ctx.output = &output;
+    ctx.num_points = (int)num_points;
+    ctx.num_samples = (int)num_samples;
+    ctx.num_indices = output.num_indices;
+    ctx.joint_stride = output.num_joints;
+    updateJointTransformProc(ctx);
+    return true;
 }
-#endif
 
 } // namespace ssds
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <vector>
 #include "ssdsMeta.h"
 
@@ -275,53 +276,41 @@ using quatd = tquat<double>;
 using double4x4 = tmat4x4<double>;
 
 
-struct Input
+enum class TransformType
 {
-    struct Frame
-    {
-        std::vector<float3> points;
-    };
-
-    struct NeighborData
-    {
-        int index = 0;
-        float weight = 0.0f;
-    };
-
-    int num_points{};
-    int num_joints{};
-    int num_rings{};
-
-    Frame rest_shape;
-    std::vector<Frame> sample;
-
-    //! model normalization matrix
-    float4x4 normalizer = float4x4::identity();
-
-
-    // internal
+    T,   // translation
+    RT,  // rotation & translation
+    SRT, // scale, rotation & translation
+};
 
-    //! neighbor information (per vertex)
-    std::vector<std::vector<NeighborData>> neighbor;
+struct Input
+{
+    span<float3> rest_shape;    // points of the bind pose
+    span<float3> samples;       // num_samples arrays of rest_shape.size() points, sample major
+    span<int2> edges;           // optional. joints of the neighbor vertices are the candidates that influence a vertex
+
+    int num_joints = 16;        // max joints. joints that end up with no vertices are removed
+    int num_indices = 4;        // max joints per vertex
+    int num_rings = 1;          // 1 or 2: candidate joints come from the n-ring neighbors. 0 or no edges: all joints are candidates
+    int num_iterations = 10;    // alternations of weight and transform updates after the initial clustering
+    TransformType transform_type = TransformType::RT;
 };
 
 
 struct JointWeight
 {
-    int index = 0;
+    int index = -1; // -1 if the slot is not used
     float weight = 0.0f;
 };
 
-struct JointData
-{
-    float3 rest_pos{};
-    std::vector<JointWeight> weights;
-    std::vector<float4x4> matrix; // per frame matrix (= animation data)
-};
-
 struct Output
 {
-    std::vector<JointData> joints;
+    int num_joints{};
+    int num_indices{};
+    std::vector<JointWeight> weights;   // num_points * num_indices, vertex major. sorted by weight in descending order
+    std::vector<float4x4> matrices;     // num_samples * num_joints, sample major. sample point = sum of weight * mul_p(matrix, rest point)
+    std::vector<float3> rest_joint_pos;
+    float error{};                      // rms distance between the samples and their reconstruction
 };
 
 } // namespace ssds
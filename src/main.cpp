@@ -1,5 +1,11 @@
 #include "pch.h"
 #include "WebAlembicViewer.h"
+#include "Parallel.h"
+#include "Headless.h"
+#include "SkinDecomposition.h"
+#ifdef wabcWithEigen
+    #include "libSSDS.h"
+#endif
 
 #pragma comment(lib, "Alembic.lib")
 #pragma comment(lib, "Half-2_5.lib")
@@ -17,6 +23,8 @@ using wabc::float3x3;
 using wabc::float4x4;
 
 static wabc::IScenePtr g_scene;
+static wabc::SceneSettings g_scene_settings;
+static wabc::IVATPtr g_vat; // if set, drawn instead of the scene's geometry
 static wabc::IRendererPtr g_renderer;
 static GLFWwindow* g_window;
 
@@ -32,25 +40,98 @@ static float g_camera_near = 0.025f;
 static float g_camera_far = 5000.0f;
 static double g_seek_time;
 
+// everything a frame depends on besides render flags and settings. frames are drawn only when this changes or
+// Invalidate() is called, so idle frames do no work.
+struct FrameState
+{
+    const void* scene{};
+    const void* vat{};
+    double time{};
+    float3 camera_position{};
+    float3 camera_target{};
+    float camera_fov{};
+    int active_camera{};
+    wabc::SensorFitMode sensor_fit_mode{};
+    float2 screen_size{};
+
+    bool operator==(const FrameState& v) const
+    {
+        return scene == v.scene && vat == v.vat && time == v.time && camera_position == v.camera_position && camera_target == v.camera_target &&
+            camera_fov == v.camera_fov && active_camera == v.active_camera && sensor_fit_mode == v.sensor_fit_mode && screen_size == v.screen_size;
+    }
+    bool operator!=(const FrameState& v) const { return !(*this == v); }
+};
+static FrameState g_last_frame;
+static bool g_redraw = true;
+
+// requests a redraw on the next frame
+static void Invalidate()
+{
+    g_redraw = true;
+}
+
 #ifdef wabcWithGL
+static FrameState GetFrameState()
+{
+    FrameState ret;
+    ret.scene = g_scene.get();
+    ret.vat = g_vat.get();
+    ret.time = g_scene ? g_scene->getTime() : g_seek_time;
+    ret.camera_position = g_camera_position;
+    ret.camera_target = g_camera_target;
+    ret.camera_fov = g_camera_fov;
+    ret.active_camera = g_active_camera;
+    ret.sensor_fit_mode = g_sensor_fit_mode;
+    ret.screen_size = g_renderer->getScreenSize();
+    return ret;
+}
+
+static bool IsLoading()
+{
+    return g_scene && g_scene->getLoadProgress().state == wabc::LoadState::Loading;
+}
+
 static void Draw()
 {
     if (!g_renderer)
         return;
 
+    if (g_scene) {
+        // the load job's data and frames evaluated by seekAsync() arrive in update(). the frame after they complete is drawn too.
+        if (IsLoading() || g_scene->hasPendingFrame())
+            g_redraw = true;
+        g_scene->update();
+    }
+
+    FrameState state = GetFrameState();
+    if (!g_redraw && state == g_last_frame)
+        return;
+    g_redraw = false;
+    g_last_frame = state;
+
     if (g_active_camera < 0) {
         float3 dir = normalize(g_camera_target - g_camera_position);
         float3 up = float3::up();
         g_renderer->setCamera(g_camera_position, dir, up, g_camera_fov, g_camera_near, g_camera_far);
     }
-    else if (g_scene) {
+    else if (g_scene && g_active_camera < (int)g_scene->getCameras().size()) {
+        // no cameras while loading
         g_renderer->setCamera(g_scene->getCameras()[g_active_camera], g_sensor_fit_mode);
     }
 
+    if (g_scene && !g_vat)
+        g_scene->cull(g_renderer->getViewProjection(), g_renderer->getScreenSize());
+
     g_renderer->beginDraw();
-    if (g_scene) {
+    if (g_vat) {
+        // the baked geometry replaces the scene's. the scene still provides cameras.
+        g_renderer->draw(g_vat.get(), g_seek_time);
+    }
+    else if (g_scene) {
         g_renderer->draw(g_scene->getMesh());
         g_renderer->draw(g_scene->getPoints());
+        for (auto mesh : g_scene->getInstancedMeshes())
+            g_renderer->draw(mesh);
     }
     g_renderer->endDraw();
 }
@@ -129,11 +210,17 @@ static void OnMouseMove(GLFWwindow* window, double x, double y)
             double t = move.x * 0.005;
             auto range = g_scene->getTimeRange();
             g_seek_time = clamp(g_seek_time + t, std::get<0>(range), std::get<1>(range));
-            g_scene->seek(g_seek_time);
+            // scrubbing doesn't wait for the evaluation. intermediate times are skipped if the mouse moves faster than that.
+            g_scene->seekAsync(g_seek_time);
         }
     }
 }
 
+static void OnRefresh(GLFWwindow* window)
+{
+    Invalidate();
+}
+
 static void OnScroll(GLFWwindow* window, double x, double y)
 {
     //printf("OnScroll() %lf %lf\n", x, y);
@@ -154,14 +241,41 @@ static void OnScroll(GLFWwindow* window, double x, double y)
 #endif
 
 
+static bool HasExtension(const std::string& path, const char* ext)
+{
+    size_t len = std::strlen(ext);
+    return path.size() >= len && std::equal(path.end() - len, path.end(), ext,
+        [](char a, char b) { return std::tolower(a) == std::tolower(b); });
+}
+
+// path: .wvat written by wabcExportVAT() or --convert. it is drawn over the current scene, which still provides cameras.
+wabcAPI bool wabcLoadVAT(std::string path)
+{
+    auto vat = wabc::LoadVAT(path.c_str());
+    if (!vat || (g_renderer && !vat->upload())) {
+        printf("wabcLoadVAT(\"%s\"): failed\n", path.c_str());
+        return false;
+    }
+    printf("wabcLoadVAT(\"%s\"): succeeded\n", path.c_str());
+    g_vat = vat;
+    Invalidate();
+    return true;
+}
+
 wabcAPI bool wabcLoadScene(std::string path)
 {
+    if (HasExtension(path, ".wvat"))
+        return wabcLoadVAT(path);
+
+    // baked geometry of the previous scene
+    g_vat = {};
     if (g_scene && g_scene->loadAdditive(path.c_str())) {
         printf("wabcLoadScene(\"%s\"): additive load succeeded\n", path.c_str());
+        Invalidate();
         return true;
     }
 
-    g_scene = wabc::LoadScene(path.c_str());
+    g_scene = wabc::LoadScene(path.c_str(), g_scene_settings);
     if (g_scene) {
         printf("wabcLoadScene(\"%s\"): succeeded\n", path.c_str());
         return true;
@@ -172,24 +286,289 @@ wabcAPI bool wabcLoadScene(std::string path)
     }
 }
 
+wabcAPI bool wabcLoadSceneAsync(std::string path)
+{
+    if (HasExtension(path, ".wvat"))
+        return wabcLoadVAT(path);
+
+    g_vat = {};
+    if (g_scene && g_scene->loadAdditive(path.c_str())) {
+        printf("wabcLoadSceneAsync(\"%s\"): additive load succeeded\n", path.c_str());
+        Invalidate();
+        return true;
+    }
+
+    // the cameras of the previous scene are gone
+    g_active_camera = -1;
+    g_scene = wabc::LoadSceneAsync(path.c_str(), g_scene_settings);
+    if (g_scene) {
+        printf("wabcLoadSceneAsync(\"%s\"): started\n", path.c_str());
+        return true;
+    }
+    else {
+        printf("wabcLoadSceneAsync(\"%s\"): failed\n", path.c_str());
+        return false;
+    }
+}
+
+static std::vector<std::string> SplitList(const std::string& src, char separator = ';')
+{
+    std::vector<std::string> ret;
+    size_t pos = 0;
+    while (pos < src.size()) {
+        size_t end = src.find(separator, pos);
+        if (end == std::string::npos)
+            end = src.size();
+        if (end > pos)
+            ret.push_back(src.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return ret;
+}
+
+// applied to scenes loaded after this
+wabcAPI void wabcSetBakeAnimation(bool v)
+{
+    g_scene_settings.bake_animation = v;
+}
+
+wabcAPI void wabcSetInterpolateAnimation(bool v)
+{
+    g_scene_settings.interpolate = v;
+    if (g_scene) {
+        // this one takes effect on the current scene too
+        auto settings = g_scene->getSettings();
+        settings.interpolate = v;
+        g_scene->setSettings(settings);
+        Invalidate();
+    }
+}
+
+// patterns: ';' separated glob patterns. applied to scenes loaded after this.
+wabcAPI void wabcSetIncludePatterns(std::string patterns)
+{
+    g_scene_settings.include_patterns = SplitList(patterns);
+}
+
+wabcAPI void wabcSetExcludePatterns(std::string patterns)
+{
+    g_scene_settings.exclude_patterns = SplitList(patterns);
+}
+
+wabcAPI void wabcSetSkipInvisible(bool v)
+{
+    g_scene_settings.skip_invisible = v;
+}
+
+wabcAPI void wabcSetInstancing(bool v)
+{
+    g_scene_settings.instancing = v;
+}
+
+// culling settings take effect on the current scene too
+wabcAPI void wabcSetFrustumCulling(bool v)
+{
+    g_scene_settings.frustum_culling = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.frustum_culling = v;
+        g_scene->setSettings(settings);
+        Invalidate();
+    }
+}
+
+wabcAPI void wabcSetCullDecode(bool v)
+{
+    g_scene_settings.cull_decode = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.cull_decode = v;
+        g_scene->setSettings(settings);
+        Invalidate();
+    }
+}
+
+// levels are built at load. applied to scenes loaded after this.
+wabcAPI void wabcSetLODLevels(int v)
+{
+    g_scene_settings.lod_levels = v;
+}
+
+// clusters are built at load. applied to scenes loaded after this.
+wabcAPI void wabcSetMeshClusters(bool v)
+{
+    g_scene_settings.mesh_clusters = v;
+}
+
+// applied to the current scene from the next seek
+wabcAPI void wabcSetQuantizePoints(bool v)
+{
+    g_scene_settings.quantize_points = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.quantize_points = v;
+        g_scene->setSettings(settings);
+    }
+}
+
+// applied to the current scene from the next seek
+wabcAPI void wabcSetInterpolateSamples(bool v)
+{
+    g_scene_settings.interpolate_samples = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.interpolate_samples = v;
+        g_scene->setSettings(settings);
+    }
+}
+
+// 0: draw all points
+wabcAPI void wabcSetPointsBudget(int v)
+{
+    g_scene_settings.points_budget = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.points_budget = v;
+        g_scene->setSettings(settings);
+        Invalidate();
+    }
+}
+
+wabcAPI void wabcSetLODPixelError(float v)
+{
+    g_scene_settings.lod_pixel_error = v;
+    if (g_scene) {
+        auto settings = g_scene->getSettings();
+        settings.lod_pixel_error = v;
+        g_scene->setSettings(settings);
+        Invalidate();
+    }
+}
+
+wabcAPI void wabcCancelLoad()
+{
+    if (g_scene)
+        g_scene->cancelLoad();
+}
+
+// 0: idle, 1: loading, 2: completed, 3: failed, 4: canceled
+wabcAPI int wabcGetLoadState()
+{
+    // VATs are loaded synchronously. scene loads reset g_vat, so it is set only if the last load was a VAT.
+    if (g_vat)
+        return (int)wabc::LoadState::Completed;
+    if (g_scene) {
+        g_scene->update();
+        return (int)g_scene->getLoadProgress().state;
+    }
+    return 0;
+}
+
+wabcAPI double wabcGetLoadBytesRead()
+{
+    return g_scene ? (double)g_scene->getLoadProgress().bytes_read : 0.0;
+}
+
+wabcAPI double wabcGetLoadBytesTotal()
+{
+    return g_scene ? (double)g_scene->getLoadProgress().bytes_total : 0.0;
+}
+
+wabcAPI int wabcGetLoadNodesScanned()
+{
+    return g_scene ? (int)g_scene->getLoadProgress().nodes_scanned : 0;
+}
+
+wabcAPI int wabcGetLoadObjectsBaked()
+{
+    return g_scene ? (int)g_scene->getLoadProgress().objects_baked : 0;
+}
+
 wabcAPI double wabcGetStartTime()
 {
+    if (g_vat && !g_scene)
+        return g_vat->getStartTime();
     return g_scene ? std::get<0>(g_scene->getTimeRange()) : 0.0;
 }
 
 wabcAPI double wabcGetEndTime()
 {
+    if (g_vat && !g_scene)
+        return g_vat->getStartTime() + (g_vat->getFrameCount() - 1) / g_vat->getFrameRate();
     return g_scene ? std::get<1>(g_scene->getTimeRange()) : 0.0;
 }
 
+// while baked geometry is drawn, seeking evaluates cameras only. the geometry follows g_seek_time on the GPU.
 wabcAPI void wabcSeek(double t)
+{
+    if (g_scene || g_vat) {
+        g_seek_time = t;
+        if (g_scene)
+            g_scene->seek(g_seek_time, g_vat ? wabc::EvalMask::Cameras : wabc::EvalMask::All);
+        Invalidate();
+    }
+}
+
+// returns without waiting for the evaluation. the frame is shown when it is ready. meant for timeline scrubbing.
+wabcAPI void wabcSeekAsync(double t)
+{
+    if (g_vat) {
+        wabcSeek(t);
+    }
+    else if (g_scene) {
+        g_seek_time = t;
+        g_scene->seekAsync(g_seek_time);
+        Invalidate();
+    }
+}
+
+// mask: combination of wabc::EvalMask. e.g. 2 (Cameras) updates cameras only.
+wabcAPI void wabcSeekPartial(double t, int mask)
 {
     if (g_scene) {
         g_seek_time = t;
-        g_scene->seek(g_seek_time);
+        g_scene->seek(g_seek_time, (wabc::EvalMask)mask);
+        Invalidate();
+    }
+}
+
+// paths: ';' separated object paths. empty: all objects.
+wabcAPI void wabcSetEvalPaths(std::string paths)
+{
+    if (g_scene) {
+        g_scene->setEvalPaths(SplitList(paths));
+        Invalidate();
     }
 }
 
+// bakes the current scene into vertex animation textures and draws them instead of its geometry.
+// the scene should be loaded with instancing disabled. instanced meshes are not baked.
+wabcAPI bool wabcBakeVAT(double fps, bool normals)
+{
+    if (!g_scene)
+        return false;
+    auto vat = wabc::BakeVAT(g_scene.get(), fps, normals);
+    if (!vat || (g_renderer && !vat->upload())) {
+        printf("wabcBakeVAT(): failed\n");
+        return false;
+    }
+    g_vat = vat;
+    wabcSeek(g_seek_time);
+    return true;
+}
+
+wabcAPI bool wabcExportVAT(std::string path)
+{
+    return g_vat && wabc::ExportVAT(g_vat.get(), path.c_str());
+}
+
+// back to the scene's geometry
+wabcAPI void wabcClearVAT()
+{
+    g_vat = {};
+    wabcSeek(g_seek_time);
+}
+
 wabcAPI int wabcGetCameraCount()
 {
     return g_scene ? (int)g_scene->getCameras().size() : 0;
@@ -197,7 +576,7 @@ wabcAPI int wabcGetCameraCount()
 
 std::string wabcGetCameraPath(int v)
 {
-    if (g_scene)
+    if (g_scene && v >= 0 && v < (int)g_scene->getCameras().size())
         return g_scene->getCameras()[v]->getPath();
     return "";
 }
@@ -221,25 +600,27 @@ wabcAPI void wabcSetDrawFaces(bool v)
 {
     if (g_renderer)
         g_renderer->setDrawFaces(v);
+    Invalidate();
 }
 
 wabcAPI void wabcSetDrawWireframe(float v)
 {
     if (g_renderer)
         g_renderer->setDrawWireframe(v);
+    Invalidate();
 }
 
 wabcAPI void wabcSetDrawPoints(float v)
 {
     if (g_renderer)
         g_renderer->setDrawPoints(v);
+    Invalidate();
 }
 
+// frames are drawn by the main loop. this only requests one.
 wabcAPI void wabcDraw()
 {
-#ifdef wabcWithGL
-    Draw();
-#endif
+    Invalidate();
 }
 
 using nanosec = uint64_t;
@@ -249,6 +630,35 @@ static nanosec Now()
     return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
+#ifdef wabcCountAllocations
+// counts heap allocations of the whole process, to verify that playback doesn't allocate once it is warmed up.
+// enabled with -DwabcCountAllocations (CMake: COUNT_ALLOCATIONS).
+static std::atomic<uint64_t> g_allocation_count{};
+
+void* operator new(size_t size)
+{
+    ++g_allocation_count;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+#endif
+
+// number of heap allocations so far. -1 if they are not counted.
+static int64_t GetAllocationCount()
+{
+#ifdef wabcCountAllocations
+    return (int64_t)g_allocation_count.load();
+#else
+    return -1;
+#endif
+}
+
 wabcAPI void wabcBenchmark()
 {
     if (!g_scene)
@@ -257,21 +667,474 @@ wabcAPI void wabcBenchmark()
     auto time_range = g_scene->getTimeRange();
     nanosec t_begin = Now();
     double step = 1.0 / 30.0;
+    int64_t allocations = 0;
     for (double t = std::get<0>(time_range); t < std::get<1>(time_range); t += step) {
+        // the first frame sizes the buffers. frames after it should reuse them.
+        int64_t count = GetAllocationCount();
         g_scene->seek(t);
+        if (t > std::get<0>(time_range))
+            allocations += GetAllocationCount() - count;
     }
     nanosec t_end = Now();
     printf("Benchmark: %lf\n", double(t_end - t_begin) / 1000000.0);
+    if (GetAllocationCount() >= 0)
+        printf("Benchmark: %lld heap allocations after the first frame\n", (long long)allocations);
+}
+
+wabcAPI void wabcSetWorkerCount(int v)
+{
+    wabc::SetWorkerCount(v);
+}
+
+// measures load time with 1, 2, 4, ... worker threads up to the hardware concurrency.
+wabcAPI void wabcBenchmarkLoad(std::string path)
+{
+    int max_workers = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::vector<int> worker_counts;
+    for (int n = 1; n < max_workers; n *= 2)
+        worker_counts.push_back(n);
+    worker_counts.push_back(max_workers);
+
+    double base_time = 0.0;
+    for (int n : worker_counts) {
+        // the scene's threads may be using the pool
+        g_scene = {};
+        wabc::SetWorkerCount(n);
+
+        nanosec t_begin = Now();
+        g_scene = wabc::LoadScene(path.c_str(), g_scene_settings);
+        nanosec t_end = Now();
+        if (!g_scene) {
+            printf("BenchmarkLoad: failed to load %s\n", path.c_str());
+            break;
+        }
+
+        double elapsed = double(t_end - t_begin) / 1000000.0;
+        if (n == 1)
+            base_time = elapsed;
+        printf("BenchmarkLoad: %2d workers %10.2lf ms (x%.2lf)\n", n, elapsed, base_time / elapsed);
+    }
+    wabc::SetWorkerCount(0);
+}
+
+// measures IScene::evaluateRange() over the whole time range at 30 fps with 1, 2, 4, ... worker threads.
+wabcAPI void wabcBenchmarkRange(std::string path)
+{
+    g_scene = wabc::LoadScene(path.c_str(), g_scene_settings);
+    if (!g_scene) {
+        printf("BenchmarkRange: failed to load %s\n", path.c_str());
+        return;
+    }
+
+    auto time_range = g_scene->getTimeRange();
+    std::vector<double> times;
+    for (double t = std::get<0>(time_range); t <= std::get<1>(time_range); t += 1.0 / 30.0)
+        times.push_back(t);
+    std::vector<wabc::FrameData> frames(times.size());
+
+    int max_workers = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::vector<int> worker_counts;
+    for (int n = 1; n < max_workers; n *= 2)
+        worker_counts.push_back(n);
+    worker_counts.push_back(max_workers);
+
+    double base_time = 0.0;
+    for (int n : worker_counts) {
+        wabc::SetWorkerCount(n);
+        nanosec t_begin = Now();
+        g_scene->evaluateRange(sfbx::make_span(times), sfbx::make_span(frames));
+        nanosec t_end = Now();
+
+        double elapsed = double(t_end - t_begin) / 1000000.0;
+        if (n == 1)
+            base_time = elapsed;
+        printf("BenchmarkRange: %2d workers %zu frames %10.2lf ms (x%.2lf)\n", n, times.size(), elapsed, base_time / elapsed);
+    }
+    wabc::SetWorkerCount(0);
+}
+
+// registers the joints of a synthetic skinned tube that bends at every joint, in every frame, with libSSDS.
+// the tube has num_points points along num_joints segments and vertices near the segment boundaries have 2 influences.
+wabcAPI void wabcBenchmarkRegistration(int num_points, int num_frames, int num_joints)
+{
+#ifdef wabcWithEigen
+    if (num_points <= 0 || num_frames <= 0 || num_joints <= 0)
+        return;
+
+    const int ring = 32;
+    std::vector<float3> rest(num_points);
+    for (int i = 0; i < num_points; ++i) {
+        float a = 6.2831853f * (i % ring) / ring;
+        rest[i] = { std::cos(a) * 0.3f, (float)num_joints * (i / ring) * ring / num_points, std::sin(a) * 0.3f };
+    }
+
+    ssds::Output output;
+    output.num_joints = num_joints;
+    output.num_indices = 2;
+    output.weights.resize(num_points * 2);
+    for (int j = 0; j < num_joints; ++j)
+        output.rest_joint_pos.push_back({ 0.0f, j + 0.5f, 0.0f });
+    for (int i = 0; i < num_points; ++i) {
+        float y = rest[i].y;
+        int j = std::min((int)y, num_joints - 1);
+        float t = y - j;
+        ssds::JointWeight* w = &output.weights[i * 2];
+        if (t < 0.2f && j > 0) {
+            w[0] = { j, 0.5f + t * 2.5f };
+            w[1] = { j - 1, 0.5f - t * 2.5f };
+        }
+        else if (t > 0.8f && j < num_joints - 1) {
+            w[0] = { j, 0.5f + (1.0f - t) * 2.5f };
+            w[1] = { j + 1, 0.5f - (1.0f - t) * 2.5f };
+        }
+        else {
+            w[0] = { j, 1.0f };
+        }
+    }
+
+    // each joint rotates around its start, relative to the previous one
+    std::vector<float3> samples((size_t)num_frames * num_points);
+    std::vector<float4x4> pose(num_joints);
+    for (int f = 0; f < num_frames; ++f) {
+        float phase = 6.2831853f * f / num_frames;
+        for (int j = 0; j < num_joints; ++j) {
+            float3 pivot{ 0.0f, (float)j, 0.0f };
+            auto rot = wabc::rotate_z(0.3f * std::sin(phase + j)) * wabc::rotate_x(0.2f * std::cos(phase + j));
+            auto local = wabc::translate(-pivot) * wabc::to_mat4x4(rot) * wabc::translate(pivot);
+            pose[j] = j == 0 ? local * wabc::translate(float3{ 0.01f * f, 0.0f, 0.0f }) : local * pose[j - 1];
+        }
+        for (int i = 0; i < num_points; ++i) {
+            float3 r{};
+            for (int k = 0; k < 2; ++k) {
+                const ssds::JointWeight& w = output.weights[i * 2 + k];
+                if (w.index >= 0)
+                    r += wabc::mul_p(pose[w.index], rest[i]) * w.weight;
+            }
+            samples[(size_t)f * num_points + i] = r;
+        }
+    }
+
+    ssds::Input input;
+    input.rest_shape = { (const ssds::float3*)rest.data(), rest.size() };
+    input.samples = { (const ssds::float3*)samples.data(), samples.size() };
+
+    int max_workers = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::vector<int> worker_counts;
+    for (int n = 1; n < max_workers; n *= 2)
+        worker_counts.push_back(n);
+    worker_counts.push_back(max_workers);
+
+    double base_time = 0.0;
+    for (int n : worker_counts) {
+        wabc::SetWorkerCount(n);
+        output.matrices.assign((size_t)num_frames * num_joints, ssds::float4x4::identity());
+        nanosec t_begin = Now();
+        ssds::UpdateTransforms(output, input);
+        nanosec t_end = Now();
+
+        double elapsed = double(t_end - t_begin) / 1000000.0;
+        if (n == 1)
+            base_time = elapsed;
+        printf("BenchmarkRegistration: %2d workers %d points %d frames %d joints %10.2lf ms (x%.2lf)\n",
+            n, num_points, num_frames, num_joints, elapsed, base_time / elapsed);
+    }
+    wabc::SetWorkerCount(0);
+#else
+    printf("BenchmarkRegistration: libSSDS is not available\n");
+#endif
+}
+
+// WebAlembicViewer --convert <src> <dst.wabc|dst.wvat> [--fps <n>] [--quantize <step>] [--pca <n>] [--normals]: bakes src into
+// a playback cache or vertex animation textures and exits.
+// --quantize stores mesh points of .wabc quantized to step and delta coded. --pca stores them as up to n basis shapes
+// and per frame coefficients. --normals adds normals to .wvat.
+static int ConvertScene(int argc, char** argv)
+{
+    double fps = 30.0;
+    float quantize_step = 0.0f;
+    int pca_components = 0;
+    bool normals = false;
+    for (int i = 4; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--fps") == 0 && has_value)
+            fps = atof(argv[++i]);
+        else if (strcmp(argv[i], "--quantize") == 0 && has_value)
+            quantize_step = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--pca") == 0 && has_value)
+            pca_components = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--normals") == 0)
+            normals = true;
+    }
+
+    // instanced meshes are not in the monolithic mesh that is baked
+    auto settings = g_scene_settings;
+    settings.instancing = false;
+    auto scene = wabc::LoadScene(argv[2], settings);
+    if (!scene) {
+        printf("Convert: failed to load %s\n", argv[2]);
+        return 1;
+    }
+    nanosec t_begin = Now();
+    bool ok = false;
+    if (HasExtension(argv[3], ".wvat")) {
+        auto vat = wabc::BakeVAT(scene.get(), fps, normals);
+        ok = vat && wabc::ExportVAT(vat.get(), argv[3]);
+    }
+    else {
+        ok = wabc::ExportWABC(scene.get(), argv[3], fps, quantize_step, pca_components);
+    }
+    nanosec t_end = Now();
+    printf("Convert: %s %s (%.2lf ms)\n", argv[3], ok ? "succeeded" : "failed", double(t_end - t_begin) / 1000000.0);
+    return ok ? 0 : 1;
+}
+
+// WebAlembicViewer --decompose <src> [--fps <n>] [--joints <n>] [--influences <n>] [--iterations <n>] [--scale]: approximates
+// the mesh animation of src with linear blend skinning by libSSDS, plays it back and reports the error and the data size.
+// --joints is the max number of joints and --influences the max joints per vertex. --scale lets joints scale.
+static int DecomposeScene(int argc, char** argv)
+{
+    wabc::SkinDecompositionSettings ds;
+    for (int i = 3; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--fps") == 0 && has_value)
+            ds.frame_rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--joints") == 0 && has_value)
+            ds.max_joints = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--influences") == 0 && has_value)
+            ds.max_influences = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0 && has_value)
+            ds.iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--scale") == 0)
+            ds.scale = true;
+    }
+
+    // instanced meshes are not in the monolithic mesh
+    auto settings = g_scene_settings;
+    settings.instancing = false;
+    auto scene = wabc::LoadScene(argv[2], settings);
+    if (!scene) {
+        printf("Decompose: failed to load %s\n", argv[2]);
+        return 1;
+    }
+    nanosec t_begin = Now();
+    wabc::SkinDecomposition skin;
+    bool ok = skin.build(scene.get(), ds);
+    nanosec t_end = Now();
+    if (!ok) {
+        printf("Decompose: %s failed\n", argv[2]);
+        return 1;
+    }
+    printf("Decompose: %s %d points %d frames -> %d joints (%.2lf ms)\n",
+        argv[2], (int)skin.getRestPoints().size(), skin.getFrameCount(), skin.getJointCount(), double(t_end - t_begin) / 1000000.0);
+    printf("Decompose: rms error %g, %.2lf MB -> %.2lf MB\n",
+        skin.getError(), double(skin.getSourceDataSize()) / (1024.0 * 1024.0), double(skin.getDataSize()) / (1024.0 * 1024.0));
+    return 0;
+}
+
+#ifdef wabcWithHeadless
+struct BatchRenderSettings
+{
+    std::vector<std::string> paths;
+    std::string output;     // printf pattern taking the frame number. e.g. "frames/%04d.tga". empty: images are not written
+    int width = 512;
+    int height = 512;
+    double fps = 30.0;
+    int frames = 0;         // 0: the whole time range
+    bool turntable = false; // orbit around the scene once over the sequence instead of using the scene's camera
+    bool benchmark = false; // report timing of each frame
+};
+
+// WebAlembicViewer --render <files> [--out <pattern>] [--size <w>x<h>] [--fps <n>] [--frames <n>] [--turntable] [--benchmark]
+static bool ParseBatchRenderArgs(int argc, char** argv, BatchRenderSettings& dst)
+{
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--out" && has_value)
+            dst.output = argv[++i];
+        else if (arg == "--size" && has_value)
+            sscanf(argv[++i], "%dx%d", &dst.width, &dst.height);
+        else if (arg == "--fps" && has_value)
+            dst.fps = atof(argv[++i]);
+        else if (arg == "--frames" && has_value)
+            dst.frames = atoi(argv[++i]);
+        else if (arg == "--turntable")
+            dst.turntable = true;
+        else if (arg == "--benchmark")
+            dst.benchmark = true;
+        else if (arg.compare(0, 2, "--") != 0)
+            dst.paths.push_back(arg);
+        else {
+            printf("BatchRender: unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return !dst.paths.empty() && dst.width > 0 && dst.height > 0 && dst.fps > 0.0;
+}
+
+// renders a frame sequence without a window. the readback of each frame overlaps with the seek of the next one,
+// and images are encoded and written on a background thread.
+static int BatchRender(const BatchRenderSettings& settings)
+{
+    using namespace wabc;
+    HeadlessContext context;
+    if (!context.initialize())
+        return 1;
+
+    int ret = 1;
+    g_renderer = CreateRenderer();
+    if (!g_renderer || !g_renderer->initializeOffscreen(settings.width, settings.height)) {
+        printf("BatchRender: failed to create the offscreen target\n");
+    }
+    else {
+        for (auto& path : settings.paths)
+            wabcLoadScene(path);
+    }
+
+    if (g_scene) {
+        auto time_range = g_scene->getTimeRange();
+        double start = std::get<0>(time_range);
+        int num_frames = settings.frames > 0 ? settings.frames :
+            (int)((std::get<1>(time_range) - start) * settings.fps + 1e-6) + 1;
+        g_scene->seek(start);
+
+        // frame the whole scene with the free camera if the scene's one is not used
+        auto cameras = g_scene->getCameras();
+        bool scene_camera = !cameras.empty() && !settings.turntable;
+        float3 center = float3::zero();
+        float radius = 10.0f;
+        {
+            const float inf = std::numeric_limits<float>::infinity();
+            float3 bmin{ inf, inf, inf };
+            float3 bmax{ -inf, -inf, -inf };
+            for (auto& p : g_scene->getMesh()->getPoints()) {
+                bmin = min(bmin, p);
+                bmax = max(bmax, p);
+            }
+            for (auto& p : g_scene->getPoints()->getPoints()) {
+                bmin = min(bmin, p);
+                bmax = max(bmax, p);
+            }
+            if (bmin.x <= bmax.x) {
+                center = (bmin + bmax) * 0.5f;
+                radius = std::max(length(bmax - bmin) * 0.5f, 1e-3f);
+            }
+        }
+
+        ImageWriter writer;
+        std::vector<uint8_t> pixels;
+        double seek_total = 0.0, render_total = 0.0, readback_total = 0.0;
+        auto to_ms = [](nanosec t) { return double(t) / 1000000.0; };
+        auto take_frame = [&](int frame) {
+            if (!g_renderer->endReadback(pixels))
+                return;
+            std::string path;
+            if (!settings.output.empty()) {
+                char buf[1024];
+                snprintf(buf, sizeof(buf), settings.output.c_str(), frame);
+                path = buf;
+            }
+            writer.push(path, settings.width, settings.height, std::move(pixels));
+        };
+
+        nanosec t_begin = Now();
+        for (int i = 0; i < num_frames; ++i) {
+            nanosec t0 = Now();
+            int64_t allocations = GetAllocationCount();
+            g_scene->seek(start + i / settings.fps);
+            allocations = GetAllocationCount() - allocations;
+            nanosec t1 = Now();
+            if (i > 0)
+                take_frame(i - 1);
+            nanosec t2 = Now();
+
+            if (scene_camera) {
+                g_renderer->setCamera(cameras[0], g_sensor_fit_mode);
+            }
+            else {
+                float angle = settings.turntable ? 360.0f * DegToRad * i / num_frames : 0.0f;
+                float3 offset = to_mat3x3(rotate_y(angle)) * float3{ 0.0f, radius * 0.5f, radius * 2.2f };
+                g_renderer->setCamera(center + offset, normalize(-offset), float3::up(), g_camera_fov, radius * 0.01f, radius * 10.0f);
+            }
+            g_scene->cull(g_renderer->getViewProjection(), g_renderer->getScreenSize());
+            g_renderer->beginDraw();
+            g_renderer->draw(g_scene->getMesh());
+            g_renderer->draw(g_scene->getPoints());
+            for (auto mesh : g_scene->getInstancedMeshes())
+                g_renderer->draw(mesh);
+            g_renderer->endDraw();
+            g_renderer->beginReadback();
+            nanosec t3 = Now();
+
+            seek_total += to_ms(t1 - t0);
+            readback_total += to_ms(t2 - t1);
+            render_total += to_ms(t3 - t2);
+            if (settings.benchmark) {
+                printf("BatchRender: frame %4d seek %8.2lf ms, render %8.2lf ms, readback %8.2lf ms (previous frame)",
+                    i, to_ms(t1 - t0), to_ms(t3 - t2), to_ms(t2 - t1));
+                if (GetAllocationCount() >= 0)
+                    printf(", %lld allocations in seek", (long long)allocations);
+                printf("\n");
+            }
+        }
+        nanosec t_readback = Now();
+        take_frame(num_frames - 1);
+        readback_total += to_ms(Now() - t_readback);
+        writer.wait();
+        nanosec t_end = Now();
+
+        double elapsed = to_ms(t_end - t_begin);
+        printf("BatchRender: %d frames %dx%d in %.2lf ms (%.2lf fps)\n", num_frames, settings.width, settings.height, elapsed, num_frames * 1000.0 / elapsed);
+        if (settings.benchmark) {
+            printf("BatchRender: average seek %.2lf ms, render %.2lf ms, readback %.2lf ms, encode %.2lf ms (background)\n",
+                seek_total / num_frames, render_total / num_frames, readback_total / num_frames, writer.getEncodeTime() / num_frames);
+        }
+        ret = writer.getErrorCount() == 0 ? 0 : 1;
+    }
+
+    // GL objects must be released while the context is alive
+    g_scene = {};
+    g_renderer = {};
+    return ret;
 }
+#endif // wabcWithHeadless
 
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_BINDINGS(wabc) {
     using namespace emscripten;
     function("wabcLoadScene", &wabcLoadScene);
+    function("wabcLoadSceneAsync", &wabcLoadSceneAsync);
+    function("wabcSetBakeAnimation", &wabcSetBakeAnimation);
+    function("wabcSetInterpolateAnimation", &wabcSetInterpolateAnimation);
+    function("wabcSetIncludePatterns", &wabcSetIncludePatterns);
+    function("wabcSetExcludePatterns", &wabcSetExcludePatterns);
+    function("wabcSetSkipInvisible", &wabcSetSkipInvisible);
+    function("wabcSetInstancing", &wabcSetInstancing);
+    function("wabcSetFrustumCulling", &wabcSetFrustumCulling);
+    function("wabcSetCullDecode", &wabcSetCullDecode);
+    function("wabcSetLODLevels", &wabcSetLODLevels);
+    function("wabcSetMeshClusters", &wabcSetMeshClusters);
+    function("wabcSetQuantizePoints", &wabcSetQuantizePoints);
+    function("wabcSetInterpolateSamples", &wabcSetInterpolateSamples);
+    function("wabcSetLODPixelError", &wabcSetLODPixelError);
+    function("wabcSetPointsBudget", &wabcSetPointsBudget);
+    function("wabcCancelLoad", &wabcCancelLoad);
+    function("wabcGetLoadState", &wabcGetLoadState);
+    function("wabcGetLoadBytesRead", &wabcGetLoadBytesRead);
+    function("wabcGetLoadBytesTotal", &wabcGetLoadBytesTotal);
+    function("wabcGetLoadNodesScanned", &wabcGetLoadNodesScanned);
+    function("wabcGetLoadObjectsBaked", &wabcGetLoadObjectsBaked);
     function("wabcGetStartTime", &wabcGetStartTime);
     function("wabcGetEndTime", &wabcGetEndTime);
     function("wabcSeek", &wabcSeek);
+    function("wabcSeekAsync", &wabcSeekAsync);
+    function("wabcSeekPartial", &wabcSeekPartial);
+    function("wabcSetEvalPaths", &wabcSetEvalPaths);
+    function("wabcBakeVAT", &wabcBakeVAT);
+    function("wabcLoadVAT", &wabcLoadVAT);
+    function("wabcExportVAT", &wabcExportVAT);
+    function("wabcClearVAT", &wabcClearVAT);
 
     function("wabcGetCameraCount", &wabcGetCameraCount);
     function("wabcGetCameraPath", &wabcGetCameraPath);
@@ -285,12 +1148,69 @@ EMSCRIPTEN_BINDINGS(wabc) {
     function("wabcDraw", &wabcDraw);
 
     function("wabcBenchmark", &wabcBenchmark);
+    function("wabcSetWorkerCount", &wabcSetWorkerCount);
+    function("wabcBenchmarkLoad", &wabcBenchmarkLoad);
+    function("wabcBenchmarkRange", &wabcBenchmarkRange);
+    function("wabcBenchmarkRegistration", &wabcBenchmarkRegistration);
 }
 #endif
 
 
 int main(int argc, char** argv)
 {
+    // WebAlembicViewer --benchmark-load <files>: report load time scaling and exit
+    bool benchmark_load = argc >= 2 && strcmp(argv[1], "--benchmark-load") == 0;
+    // WebAlembicViewer --benchmark-range <files>: report multi-frame evaluation scaling and exit
+    bool benchmark_range = argc >= 2 && strcmp(argv[1], "--benchmark-range") == 0;
+
+    if (argc >= 2 && strcmp(argv[1], "--convert") == 0) {
+        if (argc < 4) {
+            printf("usage: WebAlembicViewer --convert <src> <dst.wabc|dst.wvat> [--fps <n>] [--quantize <step>] [--pca <n>] [--normals]\n");
+            return 1;
+        }
+#ifdef wabcWithHeadless
+        // meshes create GL buffers
+        wabc::HeadlessContext context;
+        if (!context.initialize())
+            return 1;
+#endif
+        return ConvertScene(argc, argv);
+    }
+
+    // WebAlembicViewer --benchmark-registration [<points> <frames> <joints>]: report joint registration scaling and exit
+    if (argc >= 2 && strcmp(argv[1], "--benchmark-registration") == 0) {
+        int num_points = argc >= 5 ? atoi(argv[2]) : 50000;
+        int num_frames = argc >= 5 ? atoi(argv[3]) : 300;
+        int num_joints = argc >= 5 ? atoi(argv[4]) : 32;
+        wabcBenchmarkRegistration(num_points, num_frames, num_joints);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--decompose") == 0) {
+        if (argc < 3) {
+            printf("usage: WebAlembicViewer --decompose <src> [--fps <n>] [--joints <n>] [--influences <n>] [--iterations <n>] [--scale]\n");
+            return 1;
+        }
+#ifdef wabcWithHeadless
+        // meshes create GL buffers
+        wabc::HeadlessContext context;
+        if (!context.initialize())
+            return 1;
+#endif
+        return DecomposeScene(argc, argv);
+    }
+
+#ifdef wabcWithHeadless
+    if (argc >= 2 && strcmp(argv[1], "--render") == 0) {
+        BatchRenderSettings settings;
+        if (!ParseBatchRenderArgs(argc, argv, settings)) {
+            printf("usage: WebAlembicViewer --render <files> [--out <pattern>] [--size <w>x<h>] [--fps <n>] [--frames <n>] [--turntable] [--benchmark]\n");
+            return 1;
+        }
+        return BatchRender(settings);
+    }
+#endif
+
 #ifdef wabcWithGL
     if (!glfwInit()) {
         printf("glfwInit() failed\n");
@@ -310,6 +1230,7 @@ int main(int argc, char** argv)
     glfwSetMouseButtonCallback(g_window, OnMouseButton);
     glfwSetCursorPosCallback(g_window, OnMouseMove);
     glfwSetScrollCallback(g_window, OnScroll);
+    glfwSetWindowRefreshCallback(g_window, OnRefresh);
 
     glfwMakeContextCurrent(g_window);
 #endif
@@ -318,7 +1239,18 @@ int main(int argc, char** argv)
     if (g_renderer)
         g_renderer->initialize(g_window);
 
-    if (argc >= 2) {
+    if (benchmark_load) {
+        // meshes create GL buffers. so this must be after the context is made.
+        for (int i = 2; i < argc; ++i)
+            wabcBenchmarkLoad(argv[i]);
+        g_scene = {};
+    }
+    else if (benchmark_range) {
+        for (int i = 2; i < argc; ++i)
+            wabcBenchmarkRange(argv[i]);
+        g_scene = {};
+    }
+    else if (argc >= 2) {
         for (int i = 1; i < argc; ++i)
             wabcLoadScene(argv[i]);
 
@@ -345,9 +1277,13 @@ int main(int argc, char** argv)
     emscripten_set_main_loop(&Draw, 0, 1);
 #else
     glfwSwapInterval(1);
-    while (!glfwWindowShouldClose(g_window)) {
+    while (!benchmark_load && !benchmark_range && !glfwWindowShouldClose(g_window)) {
         Draw();
-        glfwPollEvents();
+        // sleep until input arrives unless the load job or the frame pipeline is running
+        if (IsLoading() || (g_scene && g_scene->hasPendingFrame()))
+            glfwPollEvents();
+        else
+            glfwWaitEvents();
     }
     glfwDestroyWindow(g_window);
     glfwTerminate();
@@ -1,15 +1,22 @@
 #pragma once
 
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <array>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <functional>
 #include <memory>
 #include <fstream>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #ifdef __cpp_lib_span
     #include <span>
 #endif
@@ -25,6 +32,13 @@
     #define wabcWithGL
 #endif
 
+// emscripten build without -s USE_PTHREADS=1 can't spawn threads. fall back to time-sliced jobs on the main thread.
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    #define wabcWithThreads
+#endif
+
+// wabcWithEigen is defined by the build when Eigen is found. libSSDS and the PCA compression of mesh caches need it.
+
 #ifdef wabcWithGL
     #define GLFW_INCLUDE_ES3
     #define GL_GLEXT_PROTOTYPES
@@ -41,6 +55,8 @@
 #else
     #ifdef wabcWithGL
         #include <EGL/egl.h>
+        #include <EGL/eglext.h>
+        #define wabcWithHeadless
     #endif
 
     #ifdef _WIN32